@@ -0,0 +1,330 @@
+#include <benchmark/benchmark.h>
+#include "../src/function_maxima.h"
+#include "../src/eytzinger_function_maxima.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+// Micro-benchmarks of every FunctionMaxima operation, for each combination
+// of argument/value type, data shape and domain size n.
+//
+// Functions of a given kind are built once and reused by the benchmarks
+// that do not need a fresh one. Sizes are capped per type so that the
+// largest functions still fit in memory: 10^7 points of ints, 10^6 with
+// 64 byte values and 10^5 with 1 KB arguments and values.
+
+namespace {
+
+// Ordered by `key` only, the rest stands for payload to copy.
+template<std::size_t Bytes>
+struct Payload {
+    std::int64_t key;
+    char pad[Bytes - sizeof(std::int64_t)];
+
+    bool operator<(const Payload &other) const { return key < other.key; }
+};
+
+template<typename T>
+T make(std::int64_t key) {
+    if constexpr (std::is_arithmetic_v<T>) {
+        return static_cast<T>(key);
+    } else {
+        T t;
+        t.key = key;
+        std::memset(t.pad, static_cast<int>(key & 0x7f), sizeof(t.pad));
+        return t;
+    }
+}
+
+enum class Shape {
+    random, monotone, sawtooth, plateau
+};
+
+const char *shape_name(Shape shape) {
+    switch (shape) {
+        case Shape::random:
+            return "random";
+        case Shape::monotone:
+            return "monotone";
+        case Shape::sawtooth:
+            return "sawtooth";
+        default:
+            return "plateau";
+    }
+}
+
+// Arguments 0..n-1 with values of the given shape, in insertion order:
+// shuffled for random data, increasing otherwise.
+std::vector<std::pair<std::int64_t, std::int64_t>>
+generate(Shape shape, std::int64_t n) {
+    std::mt19937_64 rng(2137);
+    std::vector<std::pair<std::int64_t, std::int64_t>> data;
+    data.reserve(static_cast<std::size_t>(n));
+    for (std::int64_t i = 0; i < n; i++) {
+        std::int64_t v = 0;
+        switch (shape) {
+            case Shape::random:
+                v = static_cast<std::int64_t>(rng() % 1000000);
+                break;
+            case Shape::monotone:
+                v = i;
+                break;
+            case Shape::sawtooth:
+                v = i % 100;
+                break;
+            case Shape::plateau:
+                v = 7;
+                break;
+        }
+        data.emplace_back(i, v);
+    }
+    if (shape == Shape::random)
+        std::shuffle(data.begin(), data.end(), rng);
+    return data;
+}
+
+// Random existing arguments to look up, update or erase.
+std::vector<std::int64_t> probes(std::int64_t n) {
+    std::mt19937_64 rng(1488);
+    std::vector<std::int64_t> keys(4096);
+    for (auto &k : keys)
+        k = static_cast<std::int64_t>(rng() % static_cast<std::uint64_t>(n));
+    return keys;
+}
+
+// Single-slot cache of the last built function, rebuilt when
+// another type, shape or size is asked for.
+template<typename A, typename V>
+FunctionMaxima<A, V> &prebuilt(Shape shape, std::int64_t n) {
+    static std::unique_ptr<FunctionMaxima<A, V>> cached;
+    static Shape cached_shape;
+    static std::int64_t cached_n = -1;
+    if (!cached || cached_shape != shape || cached_n != n) {
+        cached.reset();
+        cached = std::make_unique<FunctionMaxima<A, V>>();
+        for (auto &[a, v] : generate(shape, n))
+            cached->set_value(make<A>(a), make<V>(v));
+        cached_shape = shape;
+        cached_n = n;
+    }
+    return *cached;
+}
+
+template<typename A, typename V>
+void set_value_new(benchmark::State &state, Shape shape) {
+    auto n = state.range(0);
+    auto data = generate(shape, n);
+    std::vector<std::pair<A, V>> points;
+    points.reserve(data.size());
+    for (auto &[a, v] : data)
+        points.emplace_back(make<A>(a), make<V>(v));
+
+    for (auto _ : state) {
+        auto f = std::make_unique<FunctionMaxima<A, V>>();
+        for (auto &[a, v] : points)
+            f->set_value(a, v);
+        benchmark::DoNotOptimize(f->size());
+        state.PauseTiming();
+        f.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+template<typename A, typename V>
+void set_value_existing(benchmark::State &state, Shape shape) {
+    auto n = state.range(0);
+    auto &f = prebuilt<A, V>(shape, n);
+    std::vector<std::pair<A, V>> updates;
+    for (auto k : probes(n))
+        updates.emplace_back(make<A>(k), make<V>(k % 1000));
+
+    std::size_t i = 0;
+    for (auto _ : state) {
+        auto &[a, v] = updates[i++ % updates.size()];
+        f.set_value(a, v);
+    }
+    state.SetItemsProcessed(state.iterations());
+    // Leaves the cached function in its original shape.
+    auto original = generate(shape, n);
+    std::sort(original.begin(), original.end());
+    for (auto k : probes(n))
+        f.set_value(make<A>(k), make<V>(original[static_cast<std::size_t>(k)].second));
+}
+
+template<typename A, typename V>
+void erase(benchmark::State &state, Shape shape) {
+    auto n = state.range(0);
+    auto &f = prebuilt<A, V>(shape, n);
+    auto original = generate(shape, n);
+    std::sort(original.begin(), original.end());
+    auto keys = probes(n);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::vector<A> args;
+    for (auto k : keys)
+        args.push_back(make<A>(k));
+
+    // Erases a batch of distinct points, then restores them untimed.
+    for (auto _ : state) {
+        for (auto &a : args)
+            f.erase(a);
+        state.PauseTiming();
+        for (auto k : keys)
+            f.set_value(make<A>(k),
+                        make<V>(original[static_cast<std::size_t>(k)].second));
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<std::int64_t>(args.size()));
+}
+
+template<typename A, typename V>
+void find(benchmark::State &state, Shape shape) {
+    auto n = state.range(0);
+    const auto &f = prebuilt<A, V>(shape, n);
+    std::vector<A> args;
+    for (auto k : probes(n))
+        args.push_back(make<A>(k));
+
+    std::size_t i = 0;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(f.find(args[i++ % args.size()]));
+    state.SetItemsProcessed(state.iterations());
+}
+
+// find on the Eytzinger layout returned by freeze(), same probes as find.
+template<typename A, typename V>
+void frozen_find(benchmark::State &state, Shape shape) {
+    auto n = state.range(0);
+    const auto frozen = freeze(prebuilt<A, V>(shape, n));
+    std::vector<A> args;
+    for (auto k : probes(n))
+        args.push_back(make<A>(k));
+
+    std::size_t i = 0;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(frozen.find(args[i++ % args.size()]));
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename A, typename V>
+void value_at(benchmark::State &state, Shape shape) {
+    auto n = state.range(0);
+    const auto &f = prebuilt<A, V>(shape, n);
+    std::vector<A> args;
+    for (auto k : probes(n))
+        args.push_back(make<A>(k));
+
+    std::size_t i = 0;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(&f.value_at(args[i++ % args.size()]));
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename A, typename V>
+void iterate(benchmark::State &state, Shape shape) {
+    const auto &f = prebuilt<A, V>(shape, state.range(0));
+    for (auto _ : state) {
+        for (const auto &p : f)
+            benchmark::DoNotOptimize(&p.value());
+    }
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<std::int64_t>(f.size()));
+}
+
+template<typename A, typename V>
+void mx_iterate(benchmark::State &state, Shape shape) {
+    const auto &f = prebuilt<A, V>(shape, state.range(0));
+    std::int64_t k = 0;
+    for (auto _ : state) {
+        k = 0;
+        for (auto it = f.mx_begin(); it != f.mx_end(); ++it, ++k)
+            benchmark::DoNotOptimize(&it->value());
+    }
+    state.counters["maxima"] = static_cast<double>(k);
+    state.SetItemsProcessed(state.iterations() * k);
+}
+
+template<typename A, typename V>
+void copy(benchmark::State &state, Shape shape) {
+    const auto &f = prebuilt<A, V>(shape, state.range(0));
+    for (auto _ : state) {
+        auto g = std::make_unique<FunctionMaxima<A, V>>(f);
+        benchmark::DoNotOptimize(g->size());
+        state.PauseTiming();
+        g.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<std::int64_t>(f.size()));
+}
+
+template<typename A, typename V>
+void assign(benchmark::State &state, Shape shape) {
+    const auto &f = prebuilt<A, V>(shape, state.range(0));
+    FunctionMaxima<A, V> g;
+    for (auto _ : state) {
+        g = f;
+        benchmark::DoNotOptimize(g.size());
+        state.PauseTiming();
+        g = FunctionMaxima<A, V>();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<std::int64_t>(f.size()));
+}
+
+template<typename A, typename V>
+void register_all(const std::string &types, std::int64_t max_n) {
+    using bench_fn = void (*)(benchmark::State &, Shape);
+    const std::pair<const char *, bench_fn> operations[] = {
+            {"set_value_new",      set_value_new<A, V>},
+            {"set_value_existing", set_value_existing<A, V>},
+            {"erase",              erase<A, V>},
+            {"find",               find<A, V>},
+            {"frozen_find",        frozen_find<A, V>},
+            {"value_at",           value_at<A, V>},
+            {"iterate",            iterate<A, V>},
+            {"mx_iterate",         mx_iterate<A, V>},
+            {"copy",               copy<A, V>},
+            {"assign",             assign<A, V>},
+    };
+    const Shape shapes[] = {
+            Shape::random, Shape::monotone, Shape::sawtooth, Shape::plateau
+    };
+
+    // Shapes outermost, so consecutive benchmarks reuse the cached function.
+    for (Shape shape : shapes) {
+        for (std::int64_t n = 1000; n <= max_n; n *= 10) {
+            for (auto &[name, fn] : operations) {
+                std::string full = std::string(name) + "<" + types + ">/" +
+                                   shape_name(shape);
+                benchmark::RegisterBenchmark(full.c_str(), fn, shape)
+                        ->Arg(n)
+                        ->Unit(benchmark::kMicrosecond);
+            }
+        }
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    register_all<int, int>("int,int", 10000000);
+    register_all<int, Payload<64>>("int,64B", 1000000);
+    register_all<Payload<1024>, Payload<1024>>("1KB,1KB", 100000);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
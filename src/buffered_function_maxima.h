@@ -0,0 +1,141 @@
+#ifndef BUFFERED_FUNCTION_MAXIMA_H
+#define BUFFERED_FUNCTION_MAXIMA_H
+
+#include "function_maxima.h"
+
+#include <chrono>
+#include <map>
+
+/*
+ * FunctionMaxima with a front buffer coalescing writes: set_value only
+ * records the last value of each argument, and the buffer is applied with
+ * one FunctionMaxima::set_sorted_values call when it holds `capacity`
+ * arguments, when the oldest buffered write is `max_delay` old (checked on
+ * writes), or on flush(). An argument written many times in a row then
+ * costs one update instead of one per write, and the updates of a flush
+ * share one walk over the function instead of a search each.
+ *
+ * The buffer is ordered by operator< of A, like the function itself, so
+ * a flush hands it over in argument order without sorting it again. value_at looks in the buffer first;
+ * the other reads flush it, so concurrent reads are not safe. erase removes
+ * the argument from the buffer and the function right away. Like the
+ * function, the buffer only copy-constructs values.
+ *
+ * If a flush throws, the buffer is kept: updates already applied are
+ * applied again by the next flush, which does not change the result.
+ * A flush triggered by set_value does not fail the write, which is
+ * buffered either way; the error surfaces from flush() or a flushing read.
+ */
+struct BufferOptions {
+    // Buffered arguments that trigger a flush.
+    std::size_t capacity = 1024;
+    // Age of the oldest buffered write that triggers a flush, zero for none.
+    std::chrono::steady_clock::duration max_delay{};
+};
+
+template<typename A, typename V>
+class BufferedFunctionMaxima {
+public:
+    using Options = BufferOptions;
+    using function_type = FunctionMaxima<A, V>;
+    using point_type = typename function_type::point_type;
+    using iterator = typename function_type::iterator;
+    using mx_iterator = typename function_type::mx_iterator;
+    using size_type = typename function_type::size_type;
+
+    explicit BufferedFunctionMaxima(Options options = Options())
+            : limits(options) {}
+
+    iterator begin() const { return function().begin(); }
+
+    iterator end() const { return function().end(); }
+
+    iterator find(A const &x) const { return function().find(x); }
+
+    mx_iterator mx_begin() const { return function().mx_begin(); }
+
+    mx_iterator mx_end() const { return function().mx_end(); }
+
+    size_type size() const { return function().size(); }
+
+    // Sees buffered writes without flushing them. A reference to a
+    // buffered value is valid only until the next flush, which any
+    // set_value may trigger, or write to `a`. Flushed values live as long
+    // as in FunctionMaxima.
+    V const &value_at(const A &a) const;
+
+    void set_value(const A &a, const V &v);
+
+    void erase(const A &a);
+
+    // Applies buffered writes to the function.
+    void flush() const;
+
+    // Number of arguments with buffered writes.
+    size_type buffered() const noexcept { return buffer.size(); }
+
+    // The function with all writes applied.
+    function_type const &function() const {
+        flush();
+        return fun;
+    }
+
+private:
+    // Both are changed by flushes from const reads.
+    mutable function_type fun;
+    mutable std::map<A, V> buffer;
+    std::chrono::steady_clock::time_point oldest;
+    Options limits;
+};
+
+template<typename A, typename V>
+const V &BufferedFunctionMaxima<A, V>::value_at(const A &a) const {
+    auto it = buffer.find(a);
+    return it != buffer.end() ? it->second : fun.value_at(a);
+}
+
+template<typename A, typename V>
+void BufferedFunctionMaxima<A, V>::set_value(const A &a, const V &v) {
+    if (buffer.empty())
+        oldest = std::chrono::steady_clock::now();
+
+    auto it = buffer.lower_bound(a);
+    if (it != buffer.end() && !(a < it->first)) {
+        // V need not be assignable: the new pair gets a node of its own,
+        // made before the old one is dropped.
+        std::map<A, V> spare;
+        spare.emplace(a, v);
+        it = buffer.erase(it);
+        buffer.insert(it, spare.extract(spare.begin()));
+    } else {
+        buffer.emplace_hint(it, a, v);
+    }
+
+    if (buffer.size() >= limits.capacity ||
+        (limits.max_delay != limits.max_delay.zero() &&
+         std::chrono::steady_clock::now() - oldest >= limits.max_delay)) {
+        try {
+            flush();
+        } catch (...) {
+            // The write is buffered, the next flush retries it.
+        }
+    }
+}
+
+template<typename A, typename V>
+void BufferedFunctionMaxima<A, V>::erase(const A &a) {
+    fun.erase(a);
+    auto it = buffer.find(a);
+    if (it != buffer.end())
+        buffer.erase(it);
+}
+
+template<typename A, typename V>
+void BufferedFunctionMaxima<A, V>::flush() const {
+    if (buffer.empty())
+        return;
+    fun.set_sorted_values(buffer.begin(), buffer.end());
+    buffer.clear();
+}
+
+#endif /* BUFFERED_FUNCTION_MAXIMA_H */
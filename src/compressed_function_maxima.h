@@ -0,0 +1,367 @@
+#ifndef COMPRESSED_FUNCTION_MAXIMA_H
+#define COMPRESSED_FUNCTION_MAXIMA_H
+
+#include "function_maxima.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Read-only compressed form of a FunctionMaxima<A, V> with integral
+ * arguments, for large functions that are rarely modified.
+ *
+ * Arguments are split into blocks of block_points consecutive points.
+ * The first argument of each block is kept in a sparse index, the others
+ * as unsigned LEB128 varints of the difference from the previous one.
+ * Values are kept in a plain array, maxima as indices in the order of
+ * mx_begin(). A lookup binary searches the block index and decodes one
+ * block; iterators decode arguments as they go.
+ *
+ * decompress() gives back a mutable FunctionMaxima, without comparing
+ * or recomputing anything.
+ */
+template<typename A, typename V>
+class CompressedFunctionMaxima {
+    static_assert(std::is_integral_v<A>,
+                  "compressed functions delta encode integral arguments");
+
+public:
+    class point_type;
+    class iterator;
+    class mx_iterator;
+    using size_type = std::size_t;
+
+    static constexpr size_type block_points = 64;
+
+    // Compresses `f`, comparing nothing.
+    explicit CompressedFunctionMaxima(const FunctionMaxima<A, V> &f);
+
+    iterator begin() const noexcept { return iterator(this, 0); }
+
+    iterator end() const noexcept { return iterator(this, size()); }
+
+    iterator find(A const &) const;
+
+    mx_iterator mx_begin() const noexcept { return mx_iterator(this, 0); }
+
+    mx_iterator mx_end() const noexcept {
+        return mx_iterator(this, maxima.size());
+    }
+
+    size_type size() const noexcept { return values.size(); }
+
+    V const &value_at(A const &) const;
+
+    FunctionMaxima<A, V> decompress() const;
+
+    // Bytes held by the arrays, not counting what V itself allocates.
+    size_type memory_usage() const noexcept;
+
+private:
+    using bits = std::make_unsigned_t<A>;
+
+    // Decoding position: the argument at index `i` and the offset
+    // of the following delta.
+    struct Cursor {
+        size_type i;
+        A arg;
+        size_type next;
+    };
+
+    void append_varint(bits);
+
+    // Moves the cursor to the next point, which must exist.
+    void advance(Cursor &) const noexcept;
+
+    // Cursor at index `i`, decoding at most one block.
+    Cursor seek(size_type i) const noexcept;
+
+    InvalidArg invalid_exception;
+    std::vector<A> block_first;
+    // Offset of the first delta of each block in `deltas`.
+    std::vector<size_type> block_offset;
+    std::vector<unsigned char> deltas;
+    std::vector<V> values;
+    std::vector<size_type> maxima;
+};
+
+/*
+ * point_type and iterators' definitions.
+ */
+template<typename A, typename V>
+class CompressedFunctionMaxima<A, V>::point_type {
+public:
+    point_type() = default;
+
+    // Returns function argument.
+    A const &arg() const noexcept { return arg_; }
+
+    // Returns function value at a given point.
+    V const &value() const noexcept { return *val_; }
+
+private:
+    point_type(A a, const V *v) noexcept : arg_(a), val_(v) {}
+
+    A arg_{};
+    const V *val_ = nullptr;
+
+    friend class CompressedFunctionMaxima::iterator;
+
+    friend class CompressedFunctionMaxima::mx_iterator;
+};
+
+/*
+ * Iterators keep the decoded argument and return points by value, made on
+ * dereference, so they are input iterators. Decoding goes forward only;
+ * maxima are decoded one at a time, and --it steps back among them.
+ */
+template<typename A, typename V>
+class CompressedFunctionMaxima<A, V>::iterator {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = point_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = PointArrow<point_type>;
+    using reference = point_type;
+
+    iterator() = default;
+
+    reference operator*() const noexcept {
+        return point_type(cursor.arg, &owner->values[cursor.i]);
+    }
+
+    pointer operator->() const noexcept { return pointer{**this}; }
+
+    iterator &operator++() noexcept {
+        if (cursor.i + 1 < owner->size())
+            owner->advance(cursor);
+        else
+            cursor.i = owner->size();
+        return *this;
+    }
+
+    iterator operator++(int) noexcept {
+        iterator old = *this;
+        ++*this;
+        return old;
+    }
+
+    bool operator==(const iterator &other) const noexcept {
+        return cursor.i == other.cursor.i;
+    }
+
+    bool operator!=(const iterator &other) const noexcept {
+        return cursor.i != other.cursor.i;
+    }
+
+private:
+    friend class CompressedFunctionMaxima;
+
+    iterator(const CompressedFunctionMaxima *f, size_type index) noexcept
+            : owner(f), cursor{index, A(), 0} {
+        if (index < owner->size())
+            cursor = owner->seek(index);
+    }
+
+    iterator(const CompressedFunctionMaxima *f, const Cursor &at) noexcept
+            : owner(f), cursor(at) {}
+
+    const CompressedFunctionMaxima *owner = nullptr;
+    Cursor cursor{};
+};
+
+template<typename A, typename V>
+class CompressedFunctionMaxima<A, V>::mx_iterator {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = point_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = PointArrow<point_type>;
+    using reference = point_type;
+
+    mx_iterator() = default;
+
+    reference operator*() const noexcept {
+        return point_type(at.arg, &owner->values[at.i]);
+    }
+
+    pointer operator->() const noexcept { return pointer{**this}; }
+
+    mx_iterator &operator++() noexcept { return seek(i + 1); }
+
+    mx_iterator &operator--() noexcept { return seek(i - 1); }
+
+    mx_iterator operator++(int) noexcept {
+        mx_iterator old = *this;
+        ++*this;
+        return old;
+    }
+
+    mx_iterator operator--(int) noexcept {
+        mx_iterator old = *this;
+        --*this;
+        return old;
+    }
+
+    bool operator==(const mx_iterator &other) const noexcept {
+        return i == other.i;
+    }
+
+    bool operator!=(const mx_iterator &other) const noexcept {
+        return i != other.i;
+    }
+
+private:
+    friend class CompressedFunctionMaxima;
+
+    mx_iterator(const CompressedFunctionMaxima *f, size_type index) noexcept
+            : owner(f) { seek(index); }
+
+    mx_iterator &seek(size_type index) noexcept {
+        i = index;
+        if (i < owner->maxima.size())
+            at = owner->seek(owner->maxima[i]);
+        return *this;
+    }
+
+    const CompressedFunctionMaxima *owner = nullptr;
+    size_type i = 0;
+    // The decoded maximum, while `i` is in range.
+    Cursor at{};
+};
+
+/*
+ * CompressedFunctionMaxima definitions.
+ */
+template<typename A, typename V>
+CompressedFunctionMaxima<A, V>::CompressedFunctionMaxima(
+        const FunctionMaxima<A, V> &f) {
+    // Points in mx_points share their payloads with the ones in points,
+    // so maxima are located by the address of the argument.
+    std::unordered_map<const A *, size_type> index(f.size());
+    values.reserve(f.size());
+    block_first.reserve((f.size() + block_points - 1) / block_points);
+    block_offset.reserve(block_first.capacity());
+    deltas.reserve(f.size());
+
+    A previous{};
+    for (const auto &p : f) {
+        size_type i = values.size();
+        index.emplace(&p.arg(), i);
+        if (i % block_points == 0) {
+            block_first.push_back(p.arg());
+            block_offset.push_back(deltas.size());
+        } else {
+            append_varint(static_cast<bits>(static_cast<bits>(p.arg()) -
+                                            static_cast<bits>(previous)));
+        }
+        values.push_back(p.value());
+        previous = p.arg();
+    }
+
+    for (auto it = f.mx_begin(); it != f.mx_end(); ++it)
+        maxima.push_back(index.find(&it->arg())->second);
+
+    deltas.shrink_to_fit();
+    maxima.shrink_to_fit();
+}
+
+template<typename A, typename V>
+void CompressedFunctionMaxima<A, V>::append_varint(bits x) {
+    while (x >= 0x80) {
+        deltas.push_back(static_cast<unsigned char>(x | 0x80));
+        x = static_cast<bits>(x >> 7);
+    }
+    deltas.push_back(static_cast<unsigned char>(x));
+}
+
+template<typename A, typename V>
+void CompressedFunctionMaxima<A, V>::advance(Cursor &at) const noexcept {
+    at.i++;
+    if (at.i % block_points == 0) {
+        at.arg = block_first[at.i / block_points];
+        at.next = block_offset[at.i / block_points];
+        return;
+    }
+
+    bits delta = 0;
+    unsigned shift = 0;
+    unsigned char byte;
+    do {
+        byte = deltas[at.next++];
+        delta = static_cast<bits>(delta | static_cast<bits>(byte & 0x7f) << shift);
+        shift += 7;
+    } while (byte & 0x80);
+    at.arg = static_cast<A>(static_cast<bits>(static_cast<bits>(at.arg) + delta));
+}
+
+template<typename A, typename V>
+auto CompressedFunctionMaxima<A, V>::seek(size_type i) const noexcept
+-> Cursor {
+    size_type block = i / block_points;
+    Cursor at{block * block_points, block_first[block], block_offset[block]};
+    while (at.i < i)
+        advance(at);
+    return at;
+}
+
+template<typename A, typename V>
+auto CompressedFunctionMaxima<A, V>::find(A const &a) const -> iterator {
+    auto after = std::upper_bound(block_first.begin(), block_first.end(), a);
+    if (after == block_first.begin())
+        return end();
+
+    auto block = static_cast<size_type>(after - block_first.begin()) - 1;
+    size_type last = std::min(size(), (block + 1) * block_points) - 1;
+    Cursor at{block * block_points, block_first[block], block_offset[block]};
+    while (at.arg < a && at.i < last)
+        advance(at);
+    return at.arg < a || a < at.arg ? end() : iterator(this, at);
+}
+
+template<typename A, typename V>
+const V &CompressedFunctionMaxima<A, V>::value_at(A const &a) const {
+    iterator it = find(a);
+    if (it == end())
+        throw invalid_exception;
+    return it->value();
+}
+
+template<typename A, typename V>
+FunctionMaxima<A, V> CompressedFunctionMaxima<A, V>::decompress() const {
+    // The builder numbers maxima in argument order.
+    std::vector<size_type> by_arg(maxima);
+    std::sort(by_arg.begin(), by_arg.end());
+
+    MaximaBuilder<A, V> builder;
+    auto next_maximum = by_arg.begin();
+    for (const point_type &p : *this) {
+        bool is_maximum = next_maximum != by_arg.end() &&
+                          *next_maximum == static_cast<size_type>(&p.value() -
+                                                                  values.data());
+        if (is_maximum)
+            ++next_maximum;
+        builder.append(p.arg(), p.value(), is_maximum);
+    }
+    for (size_type i : maxima) {
+        auto rank = std::lower_bound(by_arg.begin(), by_arg.end(), i) -
+                    by_arg.begin();
+        builder.append_maximum(static_cast<size_type>(rank));
+    }
+    return builder.build();
+}
+
+template<typename A, typename V>
+auto CompressedFunctionMaxima<A, V>::memory_usage() const noexcept
+-> size_type {
+    return block_first.capacity() * sizeof(A) +
+           block_offset.capacity() * sizeof(size_type) +
+           deltas.capacity() + values.capacity() * sizeof(V) +
+           maxima.capacity() * sizeof(size_type);
+}
+
+#endif /* COMPRESSED_FUNCTION_MAXIMA_H */
@@ -0,0 +1,351 @@
+#ifndef EYTZINGER_FUNCTION_MAXIMA_H
+#define EYTZINGER_FUNCTION_MAXIMA_H
+
+#include "function_maxima.h"
+
+#include <algorithm>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Immutable in-memory copy of a FunctionMaxima<A, V> laid out for lookups.
+ *
+ * Points are stored in Eytzinger (BFS) order of the implicit search tree:
+ * the children of slot k are slots 2k and 2k + 1 (counting from 1), so the
+ * first levels of every search share a few cache lines and the slots of
+ * deeper levels can be prefetched early. The search loop has no
+ * data-dependent branches, which for arithmetic A compiles to conditional
+ * moves. Values are kept parallel to arguments, maxima as slot numbers
+ * in the order of mx_begin().
+ *
+ * Iteration walks the implicit tree in order, in amortized O(1) per step.
+ */
+template<typename A, typename V>
+class EytzingerFunctionMaxima {
+public:
+    class point_type;
+    class iterator;
+    class mx_iterator;
+    using size_type = std::size_t;
+
+    // Copies `f`, comparing nothing.
+    explicit EytzingerFunctionMaxima(const FunctionMaxima<A, V> &f);
+
+    iterator begin() const noexcept { return iterator(this, first()); }
+
+    iterator end() const noexcept { return iterator(this, 0); }
+
+    iterator find(A const &) const;
+
+    mx_iterator mx_begin() const noexcept { return mx_iterator(this, 0); }
+
+    mx_iterator mx_end() const noexcept {
+        return mx_iterator(this, maxima.size());
+    }
+
+    size_type size() const noexcept { return args.size(); }
+
+    V const &value_at(A const &) const;
+
+private:
+    // Slots are prefetched this many levels ahead of the search.
+    static constexpr size_type prefetch_levels = 4;
+
+    // Argument and value of slot k, counting from 1.
+    const A &arg(size_type k) const noexcept { return args[k - 1]; }
+
+    const V &value(size_type k) const noexcept { return values[k - 1]; }
+
+    // First and last slot in order, 0 if empty.
+    size_type first() const noexcept;
+
+    size_type last() const noexcept;
+
+    // Slots following and preceding slot k in order, 0 past the ends.
+    size_type next(size_type k) const noexcept;
+
+    size_type prev(size_type k) const noexcept;
+
+    // Assigns slots of the subtree at k to consecutive points from `it`.
+    template<typename It>
+    void place(size_type k, It &it, std::vector<It> &slots);
+
+    InvalidArg invalid_exception;
+    std::vector<A> args;
+    std::vector<V> values;
+    std::vector<size_type> maxima;
+};
+
+// Immutable copy of `f` for fast lookups.
+template<typename A, typename V>
+EytzingerFunctionMaxima<A, V> freeze(const FunctionMaxima<A, V> &f) {
+    return EytzingerFunctionMaxima<A, V>(f);
+}
+
+/*
+ * point_type and iterators' definitions.
+ */
+template<typename A, typename V>
+class EytzingerFunctionMaxima<A, V>::point_type {
+public:
+    point_type() = default;
+
+    // Returns function argument.
+    A const &arg() const noexcept { return *arg_; }
+
+    // Returns function value at a given point.
+    V const &value() const noexcept { return *val_; }
+
+private:
+    point_type(const A *a, const V *v) noexcept : arg_(a), val_(v) {}
+
+    const A *arg_ = nullptr;
+    const V *val_ = nullptr;
+
+    friend class EytzingerFunctionMaxima::iterator;
+
+    friend class EytzingerFunctionMaxima::mx_iterator;
+};
+
+/*
+ * Points live in no container, so iterators make them on dereference and
+ * return them by value. They are therefore input iterators, which
+ * std::reverse_iterator does not take; --it still steps back.
+ */
+template<typename A, typename V>
+class EytzingerFunctionMaxima<A, V>::iterator {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = point_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = PointArrow<point_type>;
+    using reference = point_type;
+
+    iterator() = default;
+
+    reference operator*() const noexcept {
+        return point_type(&owner->arg(k), &owner->value(k));
+    }
+
+    pointer operator->() const noexcept { return pointer{**this}; }
+
+    iterator &operator++() noexcept {
+        k = owner->next(k);
+        return *this;
+    }
+
+    // Decrementing end() gives the last point.
+    iterator &operator--() noexcept {
+        k = k == 0 ? owner->last() : owner->prev(k);
+        return *this;
+    }
+
+    iterator operator++(int) noexcept {
+        iterator old = *this;
+        ++*this;
+        return old;
+    }
+
+    iterator operator--(int) noexcept {
+        iterator old = *this;
+        --*this;
+        return old;
+    }
+
+    bool operator==(const iterator &other) const noexcept {
+        return k == other.k;
+    }
+
+    bool operator!=(const iterator &other) const noexcept {
+        return k != other.k;
+    }
+
+private:
+    friend class EytzingerFunctionMaxima;
+
+    iterator(const EytzingerFunctionMaxima *f, size_type slot) noexcept
+            : owner(f), k(slot) {}
+
+    const EytzingerFunctionMaxima *owner = nullptr;
+    size_type k = 0;
+};
+
+template<typename A, typename V>
+class EytzingerFunctionMaxima<A, V>::mx_iterator {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = point_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = PointArrow<point_type>;
+    using reference = point_type;
+
+    mx_iterator() = default;
+
+    reference operator*() const noexcept {
+        size_type k = owner->maxima[i];
+        return point_type(&owner->arg(k), &owner->value(k));
+    }
+
+    pointer operator->() const noexcept { return pointer{**this}; }
+
+    mx_iterator &operator++() noexcept {
+        i++;
+        return *this;
+    }
+
+    mx_iterator &operator--() noexcept {
+        i--;
+        return *this;
+    }
+
+    mx_iterator operator++(int) noexcept {
+        mx_iterator old = *this;
+        ++*this;
+        return old;
+    }
+
+    mx_iterator operator--(int) noexcept {
+        mx_iterator old = *this;
+        --*this;
+        return old;
+    }
+
+    bool operator==(const mx_iterator &other) const noexcept {
+        return i == other.i;
+    }
+
+    bool operator!=(const mx_iterator &other) const noexcept {
+        return i != other.i;
+    }
+
+private:
+    friend class EytzingerFunctionMaxima;
+
+    mx_iterator(const EytzingerFunctionMaxima *f, size_type index) noexcept
+            : owner(f), i(index) {}
+
+    const EytzingerFunctionMaxima *owner = nullptr;
+    size_type i = 0;
+};
+
+/*
+ * EytzingerFunctionMaxima definitions.
+ */
+template<typename A, typename V>
+EytzingerFunctionMaxima<A, V>::EytzingerFunctionMaxima(
+        const FunctionMaxima<A, V> &f) {
+    using It = typename FunctionMaxima<A, V>::iterator;
+    std::vector<It> slots(f.size() + 1);
+    It it = f.begin();
+    place(1, it, slots);
+
+    args.reserve(f.size());
+    values.reserve(f.size());
+    // Points in mx_points share their payloads with the ones in points,
+    // so maxima are located by the address of the argument.
+    std::unordered_map<const A *, size_type> slot_of(f.size());
+    for (size_type k = 1; k < slots.size(); k++) {
+        args.push_back(slots[k]->arg());
+        values.push_back(slots[k]->value());
+        slot_of.emplace(&slots[k]->arg(), k);
+    }
+    for (auto mx = f.mx_begin(); mx != f.mx_end(); ++mx)
+        maxima.push_back(slot_of.find(&mx->arg())->second);
+}
+
+template<typename A, typename V>
+template<typename It>
+void EytzingerFunctionMaxima<A, V>::place(size_type k, It &it,
+                                          std::vector<It> &slots) {
+    if (k >= slots.size())
+        return;
+    place(2 * k, it, slots);
+    slots[k] = it++;
+    place(2 * k + 1, it, slots);
+}
+
+template<typename A, typename V>
+auto EytzingerFunctionMaxima<A, V>::find(A const &a) const -> iterator {
+    const size_type n = size();
+    size_type k = 1;
+    while (k <= n) {
+#if defined(__GNUC__)
+        // Descendants prefetch_levels down start at slot k << prefetch_levels
+        // and fill one cache line for small arguments.
+        __builtin_prefetch(args.data() +
+                           std::min(k << prefetch_levels, n) - 1);
+#endif
+        k = 2 * k + static_cast<size_type>(arg(k) < a);
+    }
+    // Undoes the right turns taken after the last left one, landing on
+    // the first slot not less than `a`, or 0 if there is none.
+#if defined(__GNUC__)
+    k >>= __builtin_ffsll(static_cast<long long>(~k));
+#else
+    while (k & 1)
+        k >>= 1;
+    k >>= 1;
+#endif
+    return k == 0 || a < arg(k) ? end() : iterator(this, k);
+}
+
+template<typename A, typename V>
+const V &EytzingerFunctionMaxima<A, V>::value_at(A const &a) const {
+    iterator it = find(a);
+    if (it == end())
+        throw invalid_exception;
+    return it->value();
+}
+
+template<typename A, typename V>
+auto EytzingerFunctionMaxima<A, V>::first() const noexcept -> size_type {
+    if (size() == 0)
+        return 0;
+    size_type k = 1;
+    while (2 * k <= size())
+        k = 2 * k;
+    return k;
+}
+
+template<typename A, typename V>
+auto EytzingerFunctionMaxima<A, V>::last() const noexcept -> size_type {
+    if (size() == 0)
+        return 0;
+    size_type k = 1;
+    while (2 * k + 1 <= size())
+        k = 2 * k + 1;
+    return k;
+}
+
+template<typename A, typename V>
+auto EytzingerFunctionMaxima<A, V>::next(size_type k) const noexcept
+-> size_type {
+    if (2 * k + 1 <= size()) {
+        k = 2 * k + 1;
+        while (2 * k <= size())
+            k = 2 * k;
+        return k;
+    }
+    // Climbs while coming from a right child, then once more.
+    while (k & 1)
+        k >>= 1;
+    return k >> 1;
+}
+
+template<typename A, typename V>
+auto EytzingerFunctionMaxima<A, V>::prev(size_type k) const noexcept
+-> size_type {
+    if (2 * k <= size()) {
+        k = 2 * k;
+        while (2 * k + 1 <= size())
+            k = 2 * k + 1;
+        return k;
+    }
+    // Climbs while coming from a left child, then once more.
+    while (k > 1 && !(k & 1))
+        k >>= 1;
+    return k >> 1;
+}
+
+#endif /* EYTZINGER_FUNCTION_MAXIMA_H */
@@ -0,0 +1,452 @@
+#ifndef FROZEN_FUNCTION_MAXIMA_H
+#define FROZEN_FUNCTION_MAXIMA_H
+
+#include "function_maxima_io.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+
+/*
+ * Read-only snapshot of a FunctionMaxima<A, V> stored in a file and
+ * served straight from a shared memory mapping, so that opening it costs
+ * neither parsing nor allocation and the page cache is shared by all
+ * processes mapping the same file.
+ *
+ * File layout (native byte order, checked on open):
+ *
+ *   header   see FrozenHeader
+ *   args     A[n]   in increasing order
+ *   values   V[n]   values[i] is the value at args[i]
+ *   maxima   u64[k] indices of local maxima, in the order of mx_begin()
+ *
+ * Each array starts at an offset aligned for its element type.
+ * A and V must be trivially copyable.
+ */
+template<typename A, typename V>
+class FrozenFunctionMaxima {
+    static_assert(std::is_trivially_copyable_v<A> &&
+                  std::is_trivially_copyable_v<V>,
+                  "frozen functions store raw bytes of A and V");
+
+public:
+    class point_type;
+    class iterator;
+    class mx_iterator;
+    using size_type = std::size_t;
+
+    // Writes a frozen image of `f` to `path`. The image is written to a
+    // temporary file, synced and renamed over `path`, so that mappings of
+    // the old file stay valid and a crash leaves either file whole.
+    static void write(const FunctionMaxima<A, V> &f, const std::string &path);
+
+    // Maps the file at `path` read-only. Throws std::system_error if it
+    // cannot be opened or mapped and InvalidFormat if it is not a frozen
+    // image of FunctionMaxima<A, V>.
+    explicit FrozenFunctionMaxima(const std::string &path);
+
+    FrozenFunctionMaxima(FrozenFunctionMaxima &&other) noexcept;
+
+    FrozenFunctionMaxima &operator=(FrozenFunctionMaxima other) noexcept;
+
+    FrozenFunctionMaxima(const FrozenFunctionMaxima &) = delete;
+
+    ~FrozenFunctionMaxima();
+
+    iterator begin() const noexcept { return iterator(this, 0); }
+
+    iterator end() const noexcept { return iterator(this, n); }
+
+    iterator find(A const &) const;
+
+    mx_iterator mx_begin() const noexcept { return mx_iterator(this, 0); }
+
+    mx_iterator mx_end() const noexcept { return mx_iterator(this, k); }
+
+    size_type size() const noexcept { return n; }
+
+    V const &value_at(A const &) const;
+
+private:
+    struct FrozenHeader {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint32_t arg_size;
+        std::uint32_t value_size;
+        std::uint32_t reserved;
+        std::uint64_t n;
+        std::uint64_t k;
+        std::uint64_t args_offset;
+        std::uint64_t values_offset;
+        std::uint64_t maxima_offset;
+        std::uint64_t file_size;
+    };
+
+    static constexpr char frozen_magic[4] = {'F', 'M', 'X', 'F'};
+    static constexpr std::uint32_t frozen_version = 1;
+    static constexpr std::uint32_t byte_order_mark = 0x01020304;
+
+    static std::uint64_t align_up(std::uint64_t offset, std::uint64_t align) {
+        return (offset + align - 1) / align * align;
+    }
+
+    static FrozenHeader layout(std::uint64_t n, std::uint64_t k);
+
+    // Flushes the file or directory at `path` to disk.
+    static void sync(const std::string &path, int flags);
+
+    void swap(FrozenFunctionMaxima &) noexcept;
+
+    void *map = nullptr;
+    std::size_t map_size = 0;
+    size_type n = 0;
+    size_type k = 0;
+    const A *args = nullptr;
+    const V *values = nullptr;
+    const std::uint64_t *maxima = nullptr;
+};
+
+/*
+ * point_type definitions.
+ */
+template<typename A, typename V>
+class FrozenFunctionMaxima<A, V>::point_type {
+public:
+    point_type() = default;
+
+    // Returns function argument.
+    A const &arg() const noexcept { return *arg_; }
+
+    // Returns function value at a given point.
+    V const &value() const noexcept { return *val_; }
+
+private:
+    point_type(const A *a, const V *v) noexcept : arg_(a), val_(v) {}
+
+    const A *arg_ = nullptr;
+    const V *val_ = nullptr;
+
+    friend class FrozenFunctionMaxima::iterator;
+
+    friend class FrozenFunctionMaxima::mx_iterator;
+};
+
+/*
+ * Points live in no container, so iterators make them on dereference and
+ * return them by value. They are therefore input iterators, which
+ * std::reverse_iterator does not take; --it still steps back.
+ */
+template<typename A, typename V>
+class FrozenFunctionMaxima<A, V>::iterator {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = point_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = PointArrow<point_type>;
+    using reference = point_type;
+
+    iterator() = default;
+
+    reference operator*() const noexcept {
+        return point_type(owner->args + i, owner->values + i);
+    }
+
+    pointer operator->() const noexcept { return pointer{**this}; }
+
+    iterator &operator++() noexcept {
+        i++;
+        return *this;
+    }
+
+    iterator &operator--() noexcept {
+        i--;
+        return *this;
+    }
+
+    iterator operator++(int) noexcept {
+        iterator old = *this;
+        ++*this;
+        return old;
+    }
+
+    iterator operator--(int) noexcept {
+        iterator old = *this;
+        --*this;
+        return old;
+    }
+
+    bool operator==(const iterator &other) const noexcept {
+        return i == other.i;
+    }
+
+    bool operator!=(const iterator &other) const noexcept {
+        return i != other.i;
+    }
+
+private:
+    friend class FrozenFunctionMaxima;
+
+    iterator(const FrozenFunctionMaxima *f, size_type index) noexcept
+            : owner(f), i(index) {}
+
+    const FrozenFunctionMaxima *owner = nullptr;
+    size_type i = 0;
+};
+
+template<typename A, typename V>
+class FrozenFunctionMaxima<A, V>::mx_iterator {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = point_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = PointArrow<point_type>;
+    using reference = point_type;
+
+    mx_iterator() = default;
+
+    reference operator*() const noexcept {
+        auto at = static_cast<size_type>(owner->maxima[i]);
+        return point_type(owner->args + at, owner->values + at);
+    }
+
+    pointer operator->() const noexcept { return pointer{**this}; }
+
+    mx_iterator &operator++() noexcept {
+        i++;
+        return *this;
+    }
+
+    mx_iterator &operator--() noexcept {
+        i--;
+        return *this;
+    }
+
+    mx_iterator operator++(int) noexcept {
+        mx_iterator old = *this;
+        ++*this;
+        return old;
+    }
+
+    mx_iterator operator--(int) noexcept {
+        mx_iterator old = *this;
+        --*this;
+        return old;
+    }
+
+    bool operator==(const mx_iterator &other) const noexcept {
+        return i == other.i;
+    }
+
+    bool operator!=(const mx_iterator &other) const noexcept {
+        return i != other.i;
+    }
+
+private:
+    friend class FrozenFunctionMaxima;
+
+    mx_iterator(const FrozenFunctionMaxima *f, size_type index) noexcept
+            : owner(f), i(index) {}
+
+    const FrozenFunctionMaxima *owner = nullptr;
+    size_type i = 0;
+};
+
+/*
+ * FrozenFunctionMaxima definitions.
+ */
+template<typename A, typename V>
+auto FrozenFunctionMaxima<A, V>::layout(std::uint64_t n, std::uint64_t k)
+-> FrozenHeader {
+    FrozenHeader h{};
+    std::memcpy(h.magic, frozen_magic, sizeof(h.magic));
+    h.version = frozen_version;
+    h.byte_order = byte_order_mark;
+    h.arg_size = sizeof(A);
+    h.value_size = sizeof(V);
+    h.n = n;
+    h.k = k;
+    h.args_offset = align_up(sizeof(FrozenHeader), alignof(A));
+    h.values_offset = align_up(h.args_offset + n * sizeof(A), alignof(V));
+    h.maxima_offset = align_up(h.values_offset + n * sizeof(V),
+                               alignof(std::uint64_t));
+    h.file_size = h.maxima_offset + k * sizeof(std::uint64_t);
+    return h;
+}
+
+template<typename A, typename V>
+void FrozenFunctionMaxima<A, V>::write(const FunctionMaxima<A, V> &f,
+                                       const std::string &path) {
+    // Points in mx_points share their payloads with the ones in points,
+    // so maxima are located by the address of the argument.
+    std::unordered_map<const A *, std::uint64_t> index;
+    std::uint64_t i = 0;
+    for (const auto &p : f)
+        index.emplace(&p.arg(), i++);
+
+    std::vector<std::uint64_t> maxima;
+    for (auto it = f.mx_begin(); it != f.mx_end(); ++it)
+        maxima.push_back(index.at(&it->arg()));
+
+    FrozenHeader h = layout(f.size(), maxima.size());
+
+    std::string temporary = path + ".tmp";
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    auto pad_to = [&out](std::uint64_t offset) {
+        while (static_cast<std::uint64_t>(out.tellp()) < offset)
+            out.put('\0');
+    };
+
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    pad_to(h.args_offset);
+    for (const auto &p : f)
+        out.write(reinterpret_cast<const char *>(&p.arg()), sizeof(A));
+    pad_to(h.values_offset);
+    for (const auto &p : f)
+        out.write(reinterpret_cast<const char *>(&p.value()), sizeof(V));
+    pad_to(h.maxima_offset);
+    out.write(reinterpret_cast<const char *>(maxima.data()),
+              static_cast<std::streamsize>(maxima.size() *
+                                           sizeof(std::uint64_t)));
+    out.close();
+    if (!out)
+        throw std::ios_base::failure("frozen function: write failed");
+
+    sync(temporary, O_RDONLY | O_CLOEXEC);
+    if (::rename(temporary.c_str(), path.c_str()) != 0)
+        throw std::system_error(errno, std::generic_category(), path);
+    // The directory entry must reach the disk too.
+    auto slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "."
+                            : slash == 0 ? "/" : path.substr(0, slash);
+    sync(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+template<typename A, typename V>
+void FrozenFunctionMaxima<A, V>::sync(const std::string &path, int flags) {
+    int fd = ::open(path.c_str(), flags);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), path);
+    int synced = ::fsync(fd);
+    int err = errno;
+    ::close(fd);
+    if (synced != 0)
+        throw std::system_error(err, std::generic_category(), path);
+}
+
+template<typename A, typename V>
+FrozenFunctionMaxima<A, V>::FrozenFunctionMaxima(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), path);
+
+    struct stat st{};
+    if (::fstat(fd, &st) < 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+    }
+    map_size = static_cast<std::size_t>(st.st_size);
+    if (map_size < sizeof(FrozenHeader)) {
+        ::close(fd);
+        throw InvalidFormat();
+    }
+
+    map = ::mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        map = nullptr;
+        throw std::system_error(err, std::generic_category(), path);
+    }
+
+    FrozenHeader h;
+    std::memcpy(&h, map, sizeof(h));
+    FrozenHeader expected = layout(h.n, h.k);
+    // Bounds are checked before the layout is trusted, a corrupted
+    // count must not overflow the offsets computed from it.
+    if (std::memcmp(h.magic, frozen_magic, sizeof(h.magic)) != 0 ||
+        h.version != frozen_version || h.byte_order != byte_order_mark ||
+        h.arg_size != sizeof(A) || h.value_size != sizeof(V) ||
+        h.k > h.n || h.n > map_size / (sizeof(A) + sizeof(V)) ||
+        std::memcmp(&h, &expected, sizeof(h)) != 0 ||
+        h.file_size != map_size) {
+        ::munmap(map, map_size);
+        map = nullptr;
+        throw InvalidFormat();
+    }
+
+    auto base = static_cast<const char *>(map);
+    n = static_cast<size_type>(h.n);
+    k = static_cast<size_type>(h.k);
+    args = reinterpret_cast<const A *>(base + h.args_offset);
+    values = reinterpret_cast<const V *>(base + h.values_offset);
+    maxima = reinterpret_cast<const std::uint64_t *>(base + h.maxima_offset);
+
+    for (size_type i = 0; i < k; i++) {
+        if (maxima[i] >= h.n) {
+            ::munmap(map, map_size);
+            map = nullptr;
+            throw InvalidFormat();
+        }
+    }
+}
+
+template<typename A, typename V>
+FrozenFunctionMaxima<A, V>::FrozenFunctionMaxima(
+        FrozenFunctionMaxima &&other) noexcept {
+    swap(other);
+}
+
+// Move and swap idiom.
+template<typename A, typename V>
+auto FrozenFunctionMaxima<A, V>::operator=(FrozenFunctionMaxima other)
+noexcept -> FrozenFunctionMaxima & {
+    swap(other);
+    return *this;
+}
+
+template<typename A, typename V>
+FrozenFunctionMaxima<A, V>::~FrozenFunctionMaxima() {
+    if (map)
+        ::munmap(map, map_size);
+}
+
+template<typename A, typename V>
+void FrozenFunctionMaxima<A, V>::swap(FrozenFunctionMaxima &other) noexcept {
+    std::swap(map, other.map);
+    std::swap(map_size, other.map_size);
+    std::swap(n, other.n);
+    std::swap(k, other.k);
+    std::swap(args, other.args);
+    std::swap(values, other.values);
+    std::swap(maxima, other.maxima);
+}
+
+template<typename A, typename V>
+auto FrozenFunctionMaxima<A, V>::find(A const &a) const -> iterator {
+    const A *it = std::lower_bound(args, args + n, a);
+    if (it == args + n || a < *it)
+        return end();
+    return iterator(this, static_cast<size_type>(it - args));
+}
+
+template<typename A, typename V>
+V const &FrozenFunctionMaxima<A, V>::value_at(A const &a) const {
+    iterator it = find(a);
+    if (it == end())
+        throw InvalidArg();
+    return it->value();
+}
+
+#endif /* FROZEN_FUNCTION_MAXIMA_H */
@@ -3,7 +3,24 @@
 
 #include <variant>
 #include <memory>
+#include <optional>
 #include <set>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include "intern_pool.h"
+#include "order_statistics_tree.h"
+#include "slab_pool.h"
+
+#ifdef FUNCTION_MAXIMA_STATS
+#include <atomic>
+#include <chrono>
+#endif
 
 class InvalidArg : public std::exception {
 public:
@@ -12,33 +29,244 @@ public:
     }
 };
 
-namespace {
+template<typename A, typename V>
+class MaximaBuilder;
+
+// What operator-> of iterators returning points by value gives: the point,
+// held for the duration of the member access.
+template<typename Point>
+struct PointArrow {
+    Point point;
+
+    const Point *operator->() const noexcept { return &point; }
+};
+
+// Operations timed by the instrumentation.
+enum class MaximaOp {
+    set_value, erase, find, copy
+};
+
+// Snapshot of the instrumentation counters of one FunctionMaxima<A, V>
+// type, shared by all its objects. Counting is compiled in only when
+// FUNCTION_MAXIMA_STATS is defined, otherwise every counter stays zero
+// and the hooks compile to nothing.
+struct MaximaStats {
+    static constexpr std::size_t operations = 4;
+    // Latency bucket b counts calls that took [2^b, 2^(b+1)) nanoseconds.
+    static constexpr std::size_t buckets = 40;
+
+    std::uint64_t calls[operations] = {};
+    std::uint64_t latency[operations][buckets] = {};
+    std::uint64_t arg_comparisons = 0;
+    std::uint64_t value_comparisons = 0;
+    // Payloads, tree nodes and rollback guards.
+    std::uint64_t allocations = 0;
+    std::uint64_t rollbacks = 0;
+    std::uint64_t maxima_inserted = 0;
+    std::uint64_t maxima_removed = 0;
+
+    std::uint64_t calls_of(MaximaOp op) const noexcept {
+        return calls[static_cast<std::size_t>(op)];
+    }
+};
+
+// Bytes held by one FunctionMaxima<A, V>, see memory_usage() and
+// exact_memory_usage(). Payloads count sizeof(A) or sizeof(V), not memory
+// they own themselves; nodes count their links but not allocator headers.
+struct MaximaMemory {
+    // Nodes of the point set and of both maxima indexes.
+    std::size_t points = 0;
+    std::size_t maxima = 0;
+    // Payloads held by a single point of this function; in memory_usage(),
+    // all payloads of its points.
+    std::size_t args = 0;
+    std::size_t values = 0;
+    // Share of payloads held by several points, of this function or of
+    // others: a payload held n times here and m times in all counts n/m.
+    // Only exact_memory_usage() tells shared payloads apart.
+    std::size_t shared_args = 0;
+    std::size_t shared_values = 0;
+    // Reference counts of the payloads above, shared ones in proportion.
+    std::size_t control_blocks = 0;
+    // The function body and the lazy mode dirty list.
+    std::size_t bookkeeping = 0;
+    // Free blocks of the slab pool of reserve(), shared with split parts.
+    std::size_t reserved = 0;
+
+    std::size_t total() const noexcept {
+        return points + maxima + args + values + shared_args + shared_values +
+               control_blocks + bookkeeping + reserved;
+    }
+};
+
+/*
+ * Threading policies of FunctionMaxima, choosing how the argument and value
+ * payloads shared by copies of a point are counted.
+ *
+ * MultiThreaded counts with std::shared_ptr, so functions and points sharing
+ * payloads may be used from different threads. SingleThreaded counts with a
+ * plain integer stored next to the payload, saving the atomic operations of
+ * every point copy; a function, its copies and every point taken from them
+ * must then be used by one thread at a time. Payloads taken from an
+ * InternPool are still held through the pool's std::shared_ptr.
+ *
+ * The policy's mutex serializes the slab pool of reserve(). SingleThreaded
+ * payloads do not keep an allocator, so they stay on the general heap.
+ */
+struct MultiThreaded {
     template<typename T>
+    using payload = std::shared_ptr<T>;
+
+    using mutex = std::mutex;
+
+    template<typename T>
+    static payload<T> make(const T &x) { return std::make_shared<T>(x); }
+
+    // Payload and count in one block from `alloc`.
+    template<typename T, typename Allocator>
+    static payload<T> allocate(const Allocator &alloc, const T &x) {
+        return std::allocate_shared<T>(alloc, x);
+    }
+
+    template<typename T>
+    static payload<T> adopt(std::shared_ptr<T> interned) noexcept {
+        return interned;
+    }
+
+    // Bytes of the block allocate() takes from an allocator as big as
+    // `Allocator`, which the block keeps; 0 if it takes none.
+    template<typename T, typename Allocator>
+    static std::size_t block_size() noexcept {
+        using StandIn = BlockStandIn<T>;
+        static_assert(sizeof(BlockSizeProbe<StandIn>) == sizeof(Allocator));
+        return measure_block<StandIn>([](const auto &probe) {
+            std::allocate_shared<StandIn>(probe);
+        });
+    }
+
+    // Bytes of a payload's count: the control block of std::make_shared,
+    // a vtable pointer and two counts in the common implementations.
+    template<typename T>
+    static constexpr std::size_t counter_size() noexcept {
+        return sizeof(void *) + 2 * sizeof(int);
+    }
+};
+
+struct SingleThreaded {
+    template<typename T>
+    class payload;
+
+    struct mutex {
+        void lock() noexcept {}
+
+        void unlock() noexcept {}
+    };
+
+    template<typename T>
+    static payload<T> make(const T &x) {
+        return payload<T>(new typename payload<T>::Block(x));
+    }
+
+    // Blocks do not keep an allocator, so they stay on the general heap.
+    template<typename T, typename Allocator>
+    static payload<T> allocate(const Allocator &, const T &x) {
+        return make(x);
+    }
+
+    template<typename T>
+    static payload<T> adopt(std::shared_ptr<T> interned) noexcept {
+        return payload<T>(std::move(interned));
+    }
+
+    template<typename T, typename Allocator>
+    static std::size_t block_size() noexcept { return 0; }
+
+    template<typename T>
+    static constexpr std::size_t counter_size() noexcept {
+        return sizeof(typename payload<T>::Block) - sizeof(T);
+    }
+};
+
+template<typename T>
+class SingleThreaded::payload {
+public:
+    payload(const payload &other) noexcept
+            : block(other.block), interned(other.interned) {
+        if (block)
+            block->refs++;
+    }
+
+    payload &operator=(const payload &) = delete;
+
+    ~payload() {
+        if (block && --block->refs == 0)
+            delete block;
+    }
+
+    T const &operator*() const noexcept {
+        return block ? block->value : *interned;
+    }
+
+    std::size_t use_count() const noexcept {
+        return block ? block->refs
+                     : static_cast<std::size_t>(interned.use_count());
+    }
+
+private:
+    friend struct SingleThreaded;
+
+    struct Block {
+        explicit Block(const T &x) : value(x) {}
+
+        std::size_t refs = 1;
+        T value;
+    };
+
+    explicit payload(Block *b) noexcept : block(b) {}
+
+    explicit payload(std::shared_ptr<T> p) noexcept
+            : interned(std::move(p)) {}
+
+    Block *block = nullptr;
+    // Set instead of `block` for payloads taken from an InternPool.
+    std::shared_ptr<T> interned;
+};
+
+namespace {
+    template<typename T, typename Threading>
     class Pointer {
     private:
-        using PointerBase = std::variant<const std::shared_ptr<T>, const T *>;
+        using Payload = typename Threading::template payload<T>;
+        using PointerBase = std::variant<const Payload, const T *>;
 
         PointerBase pointer_base;
     public:
 
-        Pointer(const std::shared_ptr<T> &pointer) : pointer_base(pointer) {}
+        Pointer(const Payload &pointer) : pointer_base(pointer) {}
 
         Pointer(const T *&pointer) : pointer_base(pointer) {}
 
-        Pointer(const std::nullptr_t &pointer) : pointer_base(pointer) {}
+        Pointer(const std::nullptr_t &pointer)
+                : pointer_base(static_cast<const T *>(pointer)) {}
 
         T const &operator*() const noexcept {
-            return visit([](auto arg) -> T const & { return *arg; },
+            return visit([](const auto &arg) -> T const & { return *arg; },
                          pointer_base);
         }
 
         T *operator->() const noexcept {
             return &(**this);
         }
+
+        // Number of objects holding the payload, 0 if it is borrowed.
+        std::size_t owners() const noexcept {
+            auto *payload = std::get_if<0>(&pointer_base);
+            return payload ? static_cast<std::size_t>(payload->use_count()) : 0;
+        }
     };
 }
 
-template<typename A, typename V>
+template<typename A, typename V, typename Threading = MultiThreaded>
 class FunctionMaxima {
 
 private:
@@ -47,10 +275,18 @@ private:
 
 public:
     class point_type;
+    // A point owned outside of any function, see extract.
+    class node_type;
     using iterator = typename MaximaImpl::iterator;
     using mx_iterator = typename MaximaImpl::mx_iterator;
     using size_type = typename MaximaImpl::size_type;
 
+    struct insert_return_type {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
+
     FunctionMaxima() { imp = std::make_unique<MaximaImpl>(); }
 
     FunctionMaxima(const FunctionMaxima &);
@@ -65,25 +301,187 @@ public:
 
     iterator find(A const &x) const { return imp->find(x); }
 
+    // In lazy mode, these re-evaluate the points marked by earlier updates
+    // first, and may throw what comparisons of values throw.
     mx_iterator mx_begin() const { return imp->mx_begin(); }
 
     mx_iterator mx_end() const { return imp->mx_end(); }
 
     size_type size() const { return imp->size(); }
 
+    // Order statistics of the local maxima in the order of mx_begin(),
+    // in O(log k) for k maxima. Random access to maxima is
+    // nth_maximum(mx_rank(it) + d).
+
+    // The i-th local maximum counting from zero, mx_end() if there are
+    // not that many.
+    mx_iterator nth_maximum(size_type i) const { return imp->nth_maximum(i); }
+
+    // Number of local maxima before `it`.
+    size_type mx_rank(mx_iterator it) const { return imp->mx_rank(it); }
+
+    // Number of local maxima with values not less than `v`.
+    size_type count_maxima_at_least(const V &v) const {
+        return imp->count_maxima_at_least(v);
+    }
+
+    // The local maximum with the greatest argument not greater than `a`,
+    // end() if there is none. O(log k) for k maxima.
+    iterator prev_maximum(const A &a) const { return imp->prev_maximum(a); }
+
+    // The local maximum with the least argument not less than `a`,
+    // end() if there is none. O(log k) for k maxima.
+    iterator next_maximum(const A &a) const { return imp->next_maximum(a); }
+
     V const &value_at(const A &a) const { return imp->value_at(a); }
 
     void set_value(const A &a, const V &v) { imp->set_value(a, v); }
 
+    // Sets f(a) to the value of fn(p), where p points to the current value
+    // or is nullptr if `a` is not in the domain. fn returns something
+    // convertible to std::optional<V>, empty to leave the function as it is,
+    // and must not modify the function. `a` is looked up once and a missing
+    // argument throws nothing. Same guarantee as set_value.
+    template<typename Function>
+    void update(const A &a, Function fn) { imp->update(a, fn); }
+
+    // Sets f(a) = v if pred(p) holds, with p as in update.
+    template<typename Predicate>
+    void set_value_if(const A &a, const V &v, Predicate pred) {
+        imp->set_value_if(a, v, pred);
+    }
+
     void erase(const A &a) { imp->erase(a); }
 
+    // Removes the point at `a` and hands it over with its allocations,
+    // an empty node if there is none. Same guarantee as erase.
+    node_type extract(const A &a) { return node_type(imp->extract(a)); }
+
+    // Links in an extracted point, allocating nothing but maxima entries.
+    // If its argument is already present, nothing changes and the node is
+    // given back. Same guarantee as set_value, the node is kept if it throws.
+    insert_return_type insert(node_type &&node);
+
+    // Moves every point of `other` whose argument is not present into this
+    // function, like std::map::merge. Points landing between the same two
+    // points form a run, found with one search, and each point is moved
+    // in amortized O(1), so the cost is O(m + r log n) for m points and
+    // r runs, O(m + log n) if the argument ranges are disjoint. Only the
+    // ends of runs, their neighbours and the points of `other` next to
+    // moved ones are re-evaluated; maxima moved along keep their entries.
+    //
+    // If comparisons cannot throw and both functions take nodes from the
+    // same place (see reserve), gives the strong guarantee. Otherwise
+    // points are copied in and erased from `other` one by one, each with
+    // the strong guarantee; if erasing throws, the point is in both.
+    void merge(FunctionMaxima &other) { imp->merge(*other.imp); }
+
+    // Keeps the points with arguments less than `a` and returns a function
+    // with the others, taking this function's settings. Strong guarantee.
+    //
+    // If comparisons cannot throw, nodes, payloads and maxima entries of
+    // the smaller part are moved, found by walking from the cut both ways,
+    // so the cost is O(log n + s) for s moved points; only the two points
+    // at the cut are re-evaluated. Otherwise every point at or above `a`
+    // is copied into the result, sharing its payloads, and re-evaluated
+    // there with its neighbours, before the originals are erased: O(m log n)
+    // for m such points, however small they are next to the rest.
+    FunctionMaxima split(const A &a);
+
+    // Function with the points of `lo` and `hi`, whose arguments must all
+    // be less than those of `hi`, otherwise InvalidArg is thrown. The
+    // smaller one is merged into the larger one, as one run. The result
+    // takes the settings of `lo`. Same guarantee as merge.
+    static FunctionMaxima join(FunctionMaxima &&lo, FunctionMaxima &&hi);
+
+    // Removes all points before `last`, i.e. with arguments less than
+    // last->arg(). Takes time proportional to the number of removed points
+    // and the removed maxima; only the maximum status of the new first
+    // point is recomputed.
+    void erase_prefix(iterator last) { imp->erase_prefix(last); }
+
+    // Sets f(p.first) = p.second for every pair p in [first, last), the last
+    // pair wins among equal arguments. The pairs are sorted by argument and
+    // applied as by set_sorted_values.
+    template<typename ForwardIt>
+    void set_values(ForwardIt first, ForwardIt last);
+
+    // As set_values, for pairs already in strictly increasing order of
+    // arguments, which are not sorted again; throws InvalidArg, changing
+    // nothing, if they are not. The batch is applied in one walk: each
+    // point is located from the previous one, and the new nodes are linked
+    // in a group of pairs at a time, re-evaluating only the changed points
+    // and their neighbours.
+    //
+    // If comparisons cannot throw and the function is not lazy, each group
+    // is set with the strong guarantee. Otherwise the pairs are set one by
+    // one, each with the strong guarantee. Either way, the pairs set before
+    // a throwing group or pair stay in place.
+    template<typename InputIt>
+    void set_sorted_values(InputIt first, InputIt last);
+
+    // In lazy mode, set_value and erase only mark the points whose maximum
+    // status may have changed, and the next mx_begin() or mx_end() call
+    // re-evaluates just those, each once. Since reading the maxima then
+    // changes the object, concurrent mx_begin()/mx_end() calls are not safe.
+    // Leaving lazy mode re-evaluates the marked points right away.
+    // Off by default, not copied.
+    void set_lazy_maxima(bool lazy) { imp->set_lazy(lazy); }
+
+    bool lazy_maxima() const noexcept { return imp->is_lazy(); }
+
+    // Arguments and values inserted from now on take their payloads from
+    // the given pools, so that equal ones are stored once, also across
+    // functions sharing a pool. nullptr turns interning off. Looking up
+    // a pool compares payloads with operator<. Pools are shared by copies.
+    void set_intern_pools(std::shared_ptr<InternPool<A>> args,
+                          std::shared_ptr<InternPool<V>> values) noexcept {
+        imp->set_intern_pools(std::move(args), std::move(values));
+    }
+
+    // Bytes held by this function in O(1), counting the payloads of its
+    // points as its own even if copies or intern pools share them. Cheap
+    // enough to be exported as a metric.
+    MaximaMemory memory_usage() const noexcept { return imp->memory_usage(); }
+
+    // As above, with payloads split into own and shared ones by their
+    // owner counts. Walks all points, making no comparisons or allocations.
+    MaximaMemory exact_memory_usage() const noexcept {
+        return imp->exact_memory_usage();
+    }
+
+    // Takes point nodes, maxima index nodes and payloads from a slab pool
+    // of this function with room for `n` of each, made now, so that
+    // inserting up to `n` points does not call operator new. SingleThreaded
+    // payloads, and payloads taken from intern pools, are not covered.
+    // Erased nodes go back to the pool. The first call moves the points to
+    // the pool, invalidating iterators. Copies start without a pool;
+    // functions made by split share it. Nodes moved between functions with
+    // different pools are copied.
+    void reserve(size_type n);
+
+    // Frees the slabs of the pool holding no nodes or payloads, and the
+    // room kept by reserve.
+    void shrink_to_fit() { imp->shrink_to_fit(); }
+
+    // Instrumentation counters of all FunctionMaxima<A, V> objects.
+    static MaximaStats stats() noexcept;
+
+    static void reset_stats() noexcept;
+
 private:
+    // Instrumentation hooks, empty unless FUNCTION_MAXIMA_STATS is defined.
+    class Stats;
+
+    // Adopts an already built body, used by MaximaBuilder.
+    explicit FunctionMaxima(std::unique_ptr<MaximaImpl> body) noexcept
+            : imp(std::move(body)) {}
 
     void swap(FunctionMaxima &) noexcept;
 
     // Exposed point_type constructor.
     static point_type
-    make_point(const Pointer<A> &, const Pointer<V> &);
+    make_point(const Pointer<A, Threading> &, const Pointer<V, Threading> &);
 
     // Exposed point_type constructor.
     static point_type
@@ -91,49 +489,250 @@ private:
 
     std::unique_ptr<MaximaImpl> imp;
 
+    friend class MaximaBuilder<A, V>;
 };
 
 /*
  * FunctionMaxima definitions.
  */
-template<typename A, typename V>
-FunctionMaxima<A, V>::FunctionMaxima(const FunctionMaxima<A, V> &other) {
+template<typename A, typename V, typename Threading>
+FunctionMaxima<A, V, Threading>::FunctionMaxima(const FunctionMaxima<A, V, Threading> &other) {
+    typename Stats::Timer timer(MaximaOp::copy);
     // We use copy constructor of MaximaImpl
     imp = std::make_unique<MaximaImpl>(*other.imp);
 }
 
 // Exchanging pointers, nothrow swap idiom.
-template<typename A, typename V>
-void FunctionMaxima<A, V>::swap(FunctionMaxima<A, V> &other) noexcept {
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::swap(FunctionMaxima<A, V, Threading> &other) noexcept {
     std::swap(this->imp, other.imp);
 }
 
 // Copy and swap idiom.
-template<typename A, typename V>
-auto FunctionMaxima<A, V>::operator=(FunctionMaxima other)
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::operator=(FunctionMaxima other)
 noexcept -> FunctionMaxima & {
     other.swap(*this);
     return *this;
 }
 
-template<typename A, typename V>
-auto FunctionMaxima<A, V>::make_point(const Pointer<A> &arg,
-                                      const Pointer<V> &value) -> point_type {
+template<typename A, typename V, typename Threading>
+template<typename ForwardIt>
+void FunctionMaxima<A, V, Threading>::set_values(ForwardIt first, ForwardIt last) {
+    std::vector<ForwardIt> order;
+    order.reserve(static_cast<std::size_t>(std::distance(first, last)));
+    for (ForwardIt it = first; it != last; ++it)
+        order.push_back(it);
+
+    // Stability keeps the last write of each argument last.
+    std::stable_sort(order.begin(), order.end(),
+                     [](const ForwardIt &x, const ForwardIt &y) {
+                         return MaximaImpl::arg_less(x->first, y->first);
+                     });
+
+    typename MaximaImpl::batch_type batch;
+    batch.reserve(order.size());
+    for (auto it = order.begin(); it != order.end(); ++it) {
+        auto next = std::next(it);
+        if (next == order.end() ||
+            MaximaImpl::arg_less((*it)->first, (*next)->first))
+            batch.emplace_back(&(*it)->first, &(*it)->second);
+    }
+    imp->set_sorted(batch);
+}
+
+template<typename A, typename V, typename Threading>
+template<typename InputIt>
+void FunctionMaxima<A, V, Threading>::set_sorted_values(InputIt first,
+                                                        InputIt last) {
+    typename MaximaImpl::batch_type batch;
+    for (InputIt it = first; it != last; ++it) {
+        if (!batch.empty() && !MaximaImpl::arg_less(*batch.back().first, it->first))
+            throw InvalidArg();
+        batch.emplace_back(&it->first, &it->second);
+    }
+    imp->set_sorted(batch);
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::reserve(size_type n) {
+    if (!imp->pooled()) {
+        // Nodes cannot change allocator, so they are copied into a new body.
+        auto body = std::make_unique<MaximaImpl>(
+                *imp, MaximaImpl::slab_pool::create());
+        body->set_lazy(imp->is_lazy());
+        imp.swap(body);
+    }
+    imp->reserve(n);
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::split(const A &a) -> FunctionMaxima {
+    FunctionMaxima rest;
+    if (imp->split(a, *rest.imp))
+        swap(rest);
+    return rest;
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::join(FunctionMaxima &&lo, FunctionMaxima &&hi)
+-> FunctionMaxima {
+    if (lo.size() > 0 && hi.size() > 0 &&
+        !MaximaImpl::arg_less(std::prev(lo.end())->arg(), hi.begin()->arg()))
+        throw InvalidArg();
+
+    bool lo_larger = lo.size() >= hi.size();
+    FunctionMaxima &larger = lo_larger ? lo : hi;
+    larger.merge(lo_larger ? hi : lo);
+    FunctionMaxima result;
+    result.swap(larger);
+    if (!lo_larger)
+        result.imp->copy_settings(*lo.imp);
+    return result;
+}
+
+template<typename A, typename V, typename Threading>
+MaximaStats FunctionMaxima<A, V, Threading>::stats() noexcept {
+    return Stats::snapshot();
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::reset_stats() noexcept {
+    Stats::reset();
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::make_point(
+        const Pointer<A, Threading> &arg, const Pointer<V, Threading> &value)
+-> point_type {
     return point_type(arg, value);
 }
 
-template<typename A, typename V>
+template<typename A, typename V, typename Threading>
 auto
-FunctionMaxima<A, V>::make_point(const A &arg, const V &value) -> point_type {
-    return make_point(Pointer<A>(std::make_shared<A>(arg)),
-                      Pointer<V>(std::make_shared<V>(value)));
+FunctionMaxima<A, V, Threading>::make_point(const A &arg, const V &value) -> point_type {
+    Stats::allocation(2);
+    return make_point(Pointer<A, Threading>(Threading::make(arg)),
+                      Pointer<V, Threading>(Threading::make(value)));
 }
 
+/*
+ * Stats definitions.
+ */
+#ifdef FUNCTION_MAXIMA_STATS
+template<typename A, typename V, typename Threading>
+class FunctionMaxima<A, V, Threading>::Stats {
+public:
+    // Times one operation from construction to destruction.
+    class Timer {
+    public:
+        explicit Timer(MaximaOp timed) noexcept
+                : op(static_cast<std::size_t>(timed)),
+                  start(std::chrono::steady_clock::now()) {}
+
+        ~Timer() {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+            std::size_t bucket = 0;
+            while (bucket + 1 < MaximaStats::buckets && (ns >>= 1) > 0)
+                bucket++;
+            add(calls[op]);
+            add(latency[op][bucket]);
+        }
+
+    private:
+        std::size_t op;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    static void arg_comparison() noexcept { add(arg_comparisons); }
+
+    static void value_comparison() noexcept { add(value_comparisons); }
+
+    static void allocation(std::uint64_t n = 1) noexcept { add(allocations, n); }
+
+    static void rollback() noexcept { add(rollbacks); }
+
+    static void maximum_inserted() noexcept { add(maxima_inserted); }
+
+    static void maximum_removed(std::uint64_t n = 1) noexcept {
+        add(maxima_removed, n);
+    }
+
+    static MaximaStats snapshot() noexcept {
+        MaximaStats s;
+        for (std::size_t op = 0; op < MaximaStats::operations; op++) {
+            s.calls[op] = calls[op];
+            for (std::size_t b = 0; b < MaximaStats::buckets; b++)
+                s.latency[op][b] = latency[op][b];
+        }
+        s.arg_comparisons = arg_comparisons;
+        s.value_comparisons = value_comparisons;
+        s.allocations = allocations;
+        s.rollbacks = rollbacks;
+        s.maxima_inserted = maxima_inserted;
+        s.maxima_removed = maxima_removed;
+        return s;
+    }
+
+    static void reset() noexcept {
+        for (std::size_t op = 0; op < MaximaStats::operations; op++) {
+            calls[op] = 0;
+            for (std::size_t b = 0; b < MaximaStats::buckets; b++)
+                latency[op][b] = 0;
+        }
+        arg_comparisons = value_comparisons = allocations = 0;
+        rollbacks = maxima_inserted = maxima_removed = 0;
+    }
+
+private:
+    using counter = std::atomic<std::uint64_t>;
+
+    static void add(counter &c, std::uint64_t n = 1) noexcept {
+        c.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static inline counter calls[MaximaStats::operations];
+    static inline counter latency[MaximaStats::operations][MaximaStats::buckets];
+    static inline counter arg_comparisons;
+    static inline counter value_comparisons;
+    static inline counter allocations;
+    static inline counter rollbacks;
+    static inline counter maxima_inserted;
+    static inline counter maxima_removed;
+};
+#else
+template<typename A, typename V, typename Threading>
+class FunctionMaxima<A, V, Threading>::Stats {
+public:
+    class Timer {
+    public:
+        explicit Timer(MaximaOp) noexcept {}
+    };
+
+    static void arg_comparison() noexcept {}
+
+    static void value_comparison() noexcept {}
+
+    static void allocation(std::uint64_t = 1) noexcept {}
+
+    static void rollback() noexcept {}
+
+    static void maximum_inserted() noexcept {}
+
+    static void maximum_removed(std::uint64_t = 1) noexcept {}
+
+    static MaximaStats snapshot() noexcept { return MaximaStats(); }
+
+    static void reset() noexcept {}
+};
+#endif
+
 /*
  * point_type definitions.
  */
-template<typename A, typename V>
-class FunctionMaxima<A, V>::point_type {
+template<typename A, typename V, typename Threading>
+class FunctionMaxima<A, V, Threading>::point_type {
 public:
     // Returns function argument.
     A const &arg() const noexcept { return *arg_; }
@@ -147,42 +746,89 @@ public:
     point_type(const point_type &other) = default;
 
 private:
-    Pointer<A> arg_;
-    Pointer<V> val_;
+    Pointer<A, Threading> arg_;
+    Pointer<V, Threading> val_;
 
     friend point_type FunctionMaxima::make_point(
-            const Pointer<A> &, const Pointer<V> &
+            const Pointer<A, Threading> &, const Pointer<V, Threading> &
     );
 
     // For the purpose of avoiding copy constructing the argument
     // if it was already present in the function.
-    friend void
-    FunctionMaxima<A, V>::MaximaImpl::set_value(const A &, const V &);
+    friend void FunctionMaxima<A, V, Threading>::MaximaImpl::assign(
+            const iterator &, bool, const A &, const V &);
+
+    friend auto FunctionMaxima<A, V, Threading>::MaximaImpl::set_sorted_unguarded(
+            typename MaximaImpl::batch_type::const_iterator,
+            typename MaximaImpl::batch_type::const_iterator,
+            typename MaximaImpl::iterator) -> typename MaximaImpl::iterator;
+
+    // Reads the owner counts of the payloads.
+    friend MaximaMemory
+    FunctionMaxima<A, V, Threading>::MaximaImpl::exact_memory_usage() const noexcept;
+
+    point_type(const Pointer<A, Threading> &,
+               const Pointer<V, Threading> &) noexcept;
+};
+
+template<typename A, typename V, typename Threading>
+class FunctionMaxima<A, V, Threading>::node_type {
+public:
+    node_type() = default;
+
+    node_type(node_type &&) = default;
+
+    node_type &operator=(node_type &&) = default;
+
+    bool empty() const noexcept { return node.empty(); }
+
+    explicit operator bool() const noexcept { return !node.empty(); }
+
+    A const &arg() const { return node.value().arg(); }
+
+    V const &value() const { return node.value().value(); }
 
-    point_type(const Pointer<A> &, const Pointer<V> &) noexcept;
+private:
+    using handle = typename MaximaImpl::node_handle;
+
+    explicit node_type(handle &&h) noexcept : node(std::move(h)) {}
+
+    handle node;
+
+    friend class FunctionMaxima;
 };
 
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::insert(node_type &&node) -> insert_return_type {
+    if (node.empty())
+        return {end(), false, node_type()};
+    auto [position, inserted] = imp->insert(node.node);
+    if (inserted)
+        return {position, true, node_type()};
+    return {position, false, std::move(node)};
+}
+
 /*
  * point_type members' definitions.
  */
-template<typename A, typename V>
-auto FunctionMaxima<A, V>::point_type::operator=(
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::point_type::operator=(
         const point_type &other) -> point_type & {
     // We use copy constructors of A and V.
-    arg_ = std::make_shared<A>(other.arg());
-    val_ = std::make_shared<V>(other.value());
+    arg_ = Threading::make(other.arg());
+    val_ = Threading::make(other.value());
 }
 
-template<typename A, typename V>
-FunctionMaxima<A, V>::point_type::point_type(
-        const Pointer<A> &arg, const Pointer<V> &val
+template<typename A, typename V, typename Threading>
+FunctionMaxima<A, V, Threading>::point_type::point_type(
+        const Pointer<A, Threading> &arg, const Pointer<V, Threading> &val
 ) noexcept : arg_(arg), val_(val) {}
 
 /*
  * MaximaImpl definitions.
  */
-template<typename A, typename V>
-class FunctionMaxima<A, V>::MaximaImpl {
+template<typename A, typename V, typename Threading>
+class FunctionMaxima<A, V, Threading>::MaximaImpl {
 
 private:
     // First compares by argument, if equal compares by value.
@@ -191,17 +837,35 @@ private:
     // First compares by value, if equal compares by argument.
     class point_type_comparator_by_value;
 
+    // A point of the domain, caching whether it is a local maximum.
+    class Node;
+
+    // Nodes come from the slab pool of reserve(), if there is one.
+    template<typename T>
+    using slab_allocator = SlabAllocator<T, typename Threading::mutex>;
+
+    using point_set = std::multiset<Node, point_type_comparator_by_arg,
+                                    slab_allocator<Node>>;
+    // Multiset with order statistics in O(log k).
+    using maxima_set = OrderStatisticsTree<point_type, point_type_comparator_by_value,
+                                           slab_allocator<point_type>>;
+
 public:
+    using slab_pool = SlabPool<typename Threading::mutex>;
 
-    using iterator = typename std::multiset<point_type,
-            point_type_comparator_by_arg>::const_iterator;
-    using mx_iterator = typename std::multiset<point_type,
-            point_type_comparator_by_value>::const_iterator;
-    using size_type = typename std::multiset<point_type>::size_type;
+    using iterator = typename point_set::const_iterator;
+    using mx_iterator = typename maxima_set::const_iterator;
+    using size_type = typename point_set::size_type;
+    // A point unlinked from its function, keeping its allocation.
+    using node_handle = typename point_set::node_type;
 
     MaximaImpl() = default;
 
-    MaximaImpl(const MaximaImpl &other) = default;
+    // Copies both sets as they are, rebuilds the argument order of maxima
+    // and points the copied nodes at the copied maxima. Shares the intern
+    // pools; nodes come from `slabs`, from the heap without one.
+    MaximaImpl(const MaximaImpl &other,
+               std::shared_ptr<slab_pool> pool = nullptr);
 
     ~MaximaImpl() = default;
 
@@ -211,165 +875,1184 @@ public:
 
     iterator end() const { return points.end(); }
 
-    mx_iterator mx_begin() const { return mx_points.begin(); }
+    mx_iterator mx_begin() const {
+        flush();
+        return mx_points.begin();
+    }
+
+    mx_iterator mx_end() const {
+        flush();
+        return mx_points.end();
+    }
+
+    mx_iterator nth_maximum(size_type) const;
+
+    size_type mx_rank(const mx_iterator &) const;
+
+    size_type count_maxima_at_least(const V &) const;
+
+    iterator prev_maximum(const A &) const;
+
+    iterator next_maximum(const A &) const;
+
+    void set_lazy(bool);
+
+    bool is_lazy() const noexcept { return lazy; }
 
-    mx_iterator mx_end() const { return mx_points.end(); }
+    void set_intern_pools(std::shared_ptr<InternPool<A>> args,
+                          std::shared_ptr<InternPool<V>> values) noexcept {
+        arg_pool = std::move(args);
+        value_pool = std::move(values);
+    }
 
     size_type size() const { return points.size(); }
 
+    MaximaMemory memory_usage() const noexcept;
+
+    MaximaMemory exact_memory_usage() const noexcept;
+
+    bool pooled() const noexcept { return slabs != nullptr; }
+
+    // Makes room for `n` points in the slab pool, which must exist.
+    void reserve(size_type n);
+
+    void shrink_to_fit();
+
+    // Takes nodes from `pool`, only while empty.
+    void use_slabs(const std::shared_ptr<slab_pool> &pool);
+
     const V &value_at(const A &) const;
 
     void set_value(const A &, const V &);
 
+    // Arguments and values, in strictly increasing order of arguments.
+    using batch_type = std::vector<std::pair<const A *, const V *>>;
+
+    // Sets the values of `batch`, see set_sorted_values.
+    void set_sorted(const batch_type &batch);
+
+    // The path of set_sorted for types whose comparisons cannot throw:
+    // sets the pairs of [first, last), all or none, locating the first one
+    // from `hint`, the first point with an argument not less than those
+    // set before. Returns the hint for the pairs that follow.
+    iterator set_sorted_unguarded(typename batch_type::const_iterator first,
+                                  typename batch_type::const_iterator last,
+                                  iterator hint);
+
+    // Pairs set all or none at a time by set_sorted: small groups keep the
+    // nodes freed by one group warm for the next.
+    static constexpr std::size_t batch_group = 64;
+    // Points stepped over before set_sorted_unguarded searches instead.
+    static constexpr int batch_steps = 4;
+
+    template<typename Function>
+    void update(const A &, Function);
+
+    template<typename Predicate>
+    void set_value_if(const A &, const V &, Predicate);
+
+    // Sets the value at `a` to `v`, given where `a` was located.
+    void assign(const iterator &previous, bool new_argument,
+                const A &a, const V &v);
+
     void erase(const A &);
 
+    // Unlinks the point at `a`, an empty node if there is none.
+    node_handle extract(const A &);
+
+    // Links the point held by `node` in unless its argument is present,
+    // then leaving `node` as it is. The node is kept if this throws.
+    std::pair<iterator, bool> insert(node_handle &node);
+
+    void merge(MaximaImpl &other);
+
+    // Leaves the points with arguments less than `a` here and moves the
+    // others to the empty `rest`, which takes this function's settings.
+    // Returns true if instead the points less than `a` were moved.
+    bool split(const A &a, MaximaImpl &rest);
+
+    // Takes the lazy mode and the pools of `other`.
+    void copy_settings(const MaximaImpl &other);
+
+    void erase_prefix(const iterator &);
+
+    // Appends a point whose argument is greater than every argument present,
+    // without evaluating any maxima. A point flagged as a maximum must then
+    // be passed to append_maximum. Used only by MaximaBuilder.
+    iterator append(const point_type &, bool is_maximum);
+
+    // Appends the point pointed to by the given iterator as the last local
+    // maximum in value order. Used only by MaximaBuilder.
+    void append_maximum(const iterator &);
+
+    // Comparisons of arguments and values, counted by the instrumentation.
+    static bool arg_less(const A &x, const A &y) {
+        Stats::arg_comparison();
+        return x < y;
+    }
+
+    static bool value_less(const V &x, const V &y) {
+        Stats::value_comparison();
+        return x < y;
+    }
+
+    // Whether comparing arguments and values cannot throw. Updates then
+    // allocate everything they need up front and skip the rollback guards.
+    static constexpr bool nothrow_comparisons =
+            noexcept(std::declval<const A &>() < std::declval<const A &>()) &&
+            noexcept(std::declval<const V &>() < std::declval<const V &>());
+
 private:
 
     // Base Guard class with `commit()` functionality.
     class Guard;
 
-    // Guards inserting the point_type object into the given multiset
-    // with `it_type` iterator and `comparator` comparator.
-    template<typename comparator, typename it_type>
+    // Guards linking a node into the given multiset.
+    template<typename set_type>
     class InsertGuard;
 
-    // Guards erasing a given iterator from the given multiset
-    // with `it_type` iterator and `comparator` comparator.
-    template<typename comparator, typename it_type>
-    class DelayedErase;
+    // Guard indexing a point as a maximum, marking its node on commit.
+    class MarkGuard;
+
+    // Guard unindexing a maximum on commit, unmarking its node.
+    class UnmarkGuard;
 
     class EmptyGuard : public Guard {
     };
 
-    // Checks if the point pointed to by the given iterator is a local maximum.
-    // Omits the second given iterator.
-    bool is_a_local_maximum(const iterator &, const iterator &);
+    // Orders positions in `points` by argument.
+    class iterator_comparator_by_arg;
+
+    // Local maxima in argument order, for prev_maximum and next_maximum.
+    using maxima_by_arg_set = OrderStatisticsTree<iterator, iterator_comparator_by_arg,
+                                                  slab_allocator<iterator>>;
+
+    // Bytes of a `points` node, which the standard leaves to the library.
+    static std::size_t point_node_size() noexcept;
+
+    // The first point with an argument not less than the given one.
+    iterator lower_bound(A const &) const;
 
-    // Adds the point pointed to by the given iterator to mx_points
-    // if it is a local maximum. Omits the second given iterator in calculations.
-    std::unique_ptr<Guard> mark_as_maximum(const iterator &, const iterator &);
+    // lower_bound(a), also the hint for inserting, and whether `a`
+    // is missing from the domain.
+    std::pair<iterator, bool> locate(const A &a) const;
 
-    // Removes the point pointed to by the given iterator from mx_points
-    // if it is not a local maximum. Omits the second given iterator in calculations.
+    // Maximum status of a point after an unguarded update.
+    struct Plan {
+        iterator it;
+        bool maximum;
+        // Whether the point becomes a maximum.
+        bool insert;
+    };
+
+    // Value at `it`, nullptr for end().
+    const V *value_of(const iterator &it) const noexcept {
+        return it == end() ? nullptr : &it->value();
+    }
+
+    // Checks if a point with the given value is a local maximum
+    // when its neighbours have values `left` and `right` (nullptr if missing).
+    static bool is_a_local_maximum(const V &value, const V *left,
+                                   const V *right);
+
+    // Guards adding the point pointed to by `it` to mx_points or removing it
+    // from there, whichever is needed for its neighbours `left` and `right`.
     std::unique_ptr<Guard>
-    unmark_as_maximum(const iterator &, const iterator &);
+    update_maximum(const iterator &it, const iterator &left,
+                   const iterator &right);
+
+    // Decides the status of the point pointed to by `it` (possibly end())
+    // for neighbour values `left` and `right`. Changes nothing.
+    Plan plan_maximum(const iterator &it, const V *left, const V *right);
+
+    // Indexes the points becoming maxima, all or none.
+    // It is the only step of an unguarded update that may fail.
+    template<std::size_t N>
+    void insert_planned(Plan (&)[N]);
+
+    // Carries out a plan, cannot throw.
+    void apply(Plan &) noexcept;
+
+    // Inserts the point pointed to by `it` into both maxima indexes, all
+    // or none, keeping the handles in its node. Does not mark the node.
+    void index_maximum(const iterator &it) const;
+
+    // Erases the point pointed to by `it` from both maxima indexes.
+    void unindex_maximum(const iterator &it) const noexcept;
+
+    // Unindexes and unmarks the point pointed to by `it`, if it is a maximum.
+    void remove_maximum(const iterator &it) const noexcept;
+
+    // Makes room for `n` more dirty points, growing geometrically.
+    void reserve_dirty(size_type n);
+
+    // Marks the point pointed to by `it` (possibly end()) for re-evaluation.
+    // Needs room reserved with reserve_dirty.
+    void mark_dirty(const iterator &it) noexcept;
+
+    void unmark_dirty(const iterator &it) noexcept;
+
+    // Re-evaluates all dirty points. If a comparison throws, the points
+    // not re-evaluated yet stay dirty.
+    void flush() const;
+
+    // Flushes `other` so that it can be copied without its dirty points.
+    static const MaximaImpl &flushed(const MaximaImpl &other) {
+        other.flush();
+        return other;
+    }
+
+    // Links the point held by `node` in right before `previous`, replacing
+    // `previous` unless `new_argument`. Takes the node unless this throws.
+    iterator link(const iterator &previous, bool new_argument,
+                  node_handle &node);
+
+    // Unlinks the point pointed to by `it`, re-evaluating its neighbours.
+    node_handle detach(const iterator &it);
+
+    // Update paths for lazy mode, leaving mx_points to flush().
+    iterator set_value_lazy(const iterator &previous, bool new_argument,
+                            node_handle &node);
+
+    node_handle erase_lazy(const iterator &to_erase);
+
+    // Payload holding a copy of `x`, taken from `pool` if there is one,
+    // otherwise allocated from the slabs if there are some.
+    template<typename T>
+    Pointer<T, Threading>
+    payload(const T &x, const std::shared_ptr<InternPool<T>> &pool) const {
+        // A pool allocates only for values it does not hold yet, which it
+        // does not report, so interned payloads are not counted.
+        if (pool)
+            return Threading::adopt(pool->intern(x));
+        Stats::allocation();
+        if (slabs)
+            return Threading::allocate(slab_allocator<T>(slabs.get()), x);
+        return Threading::make(x);
+    }
+
+    // Allocates a node holding a copy of `point`.
+    node_handle allocate(const point_type &point) const;
+
+    // memory_usage() of the nodes, the body and the slab pool alone.
+    MaximaMemory node_usage() const noexcept;
 
-    // Returns left neighbour of `start`, omitting the second iterator if needed.
-    iterator left(const iterator &, const iterator &) noexcept;
+    // Update paths for types whose comparisons cannot throw.
+    iterator set_value_unguarded(const iterator &previous, bool new_argument,
+                                 node_handle &node);
 
-    // Returns right neighbour of `start`, omitting the second iterator if needed.
-    iterator right(const iterator &, const iterator &) noexcept;
+    node_handle erase_unguarded(const iterator &to_erase);
+
+    // Moves the points of [first, last) of `other` whose arguments are
+    // missing here, re-evaluating only the points next to the moved runs
+    // in both functions. All or nothing.
+    void splice(MaximaImpl &other, const iterator &first,
+                const iterator &last);
+
+    // Moves the maxima index entries of the point pointed to by `it`,
+    // just linked in from `from`, to this function's indexes.
+    void adopt_maximum(const iterator &it, MaximaImpl &from) const noexcept;
+
+    // Allocates a guard, counting the allocation.
+    template<typename guard_type, typename... Args>
+    static std::unique_ptr<Guard> make_guard(Args &&...);
 
     InvalidArg invalid_exception;
-    std::multiset<point_type, point_type_comparator_by_arg> points;
-    std::multiset<point_type, point_type_comparator_by_value> mx_points;
+    point_set points;
+    // Updated by flush() even in const calls.
+    mutable maxima_set mx_points;
+    mutable maxima_by_arg_set mx_by_arg;
+    // Points whose maximum status may be stale, only in lazy mode.
+    mutable std::vector<iterator> dirty;
+    bool lazy = false;
+    std::shared_ptr<InternPool<A>> arg_pool;
+    std::shared_ptr<InternPool<V>> value_pool;
+    // Pool of the nodes and payloads, null while they come from the heap.
+    std::shared_ptr<slab_pool> slabs;
+};
+
+template<typename A, typename V, typename Threading>
+class FunctionMaxima<A, V, Threading>::MaximaImpl::Node : public point_type {
+public:
+    Node(const point_type &point) : point_type(point) {}
+
+    static constexpr size_type clean = static_cast<size_type>(-1);
+
+    // Status changes only once an update can no longer fail,
+    // and does not take part in ordering.
+    mutable bool maximum = false;
+    // Entries in mx_points and mx_by_arg, valid only if `maximum`.
+    mutable mx_iterator mx_handle;
+    mutable typename maxima_by_arg_set::const_iterator mx_arg_handle;
+    // Position in MaximaImpl::dirty, or `clean`.
+    mutable size_type dirty_index = clean;
 };
 
 /*
  * MaximaImpl members' definitions.
  */
-template<typename A, typename V>
-auto FunctionMaxima<A, V>::MaximaImpl::find(A const &a) const -> iterator {
+template<typename A, typename V, typename Threading>
+FunctionMaxima<A, V, Threading>::MaximaImpl::MaximaImpl(
+        const MaximaImpl &other, std::shared_ptr<slab_pool> pool)
+        : points(flushed(other).points, slab_allocator<Node>(pool.get())),
+          mx_points(other.mx_points, slab_allocator<point_type>(pool.get())),
+          mx_by_arg(slab_allocator<iterator>(pool.get())),
+          arg_pool(other.arg_pool), value_pool(other.value_pool),
+          slabs(std::move(pool)) {
+    // Copies share payloads, so the argument's address identifies a point
+    // in both sets without comparing anything.
+    std::unordered_map<const A *, mx_iterator> copied_mx(mx_points.size());
+    for (auto it = mx_points.begin(); it != mx_points.end(); ++it)
+        copied_mx.emplace(&it->arg(), it);
+    for (iterator it = begin(); it != end(); ++it) {
+        if (it->maximum) {
+            it->mx_handle = copied_mx.find(&it->arg())->second;
+            it->mx_arg_handle = mx_by_arg.push_back(it);
+        }
+    }
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::find(A const &a) const -> iterator {
+    typename Stats::Timer timer(MaximaOp::find);
     const A *aa = &a;
-    Pointer<A> A_ptr(aa);
+    Pointer<A, Threading> A_ptr(aa);
     point_type pt = make_point(A_ptr, nullptr);
     return points.find(pt);
 }
 
-template<typename A, typename V>
-const V &FunctionMaxima<A, V>::MaximaImpl::value_at(const A &a) const {
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::lower_bound(A const &a) const
+-> iterator {
+    const A *aa = &a;
+    Pointer<A, Threading> A_ptr(aa);
+    point_type pt = make_point(A_ptr, nullptr);
+    return points.lower_bound(pt);
+}
+
+template<typename A, typename V, typename Threading>
+const V &FunctionMaxima<A, V, Threading>::MaximaImpl::value_at(const A &a) const {
     iterator it = find(a);
     if (it == end())
         throw invalid_exception;
     return it->value();
 }
 
-template<typename A, typename V>
-void FunctionMaxima<A, V>::MaximaImpl::set_value(const A &a, const V &v) {
-    iterator previous = find(a);
-    if (previous != end() && !(previous->value() < v || v < previous->value()))
-        return;
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::locate(const A &a) const
+-> std::pair<iterator, bool> {
+    iterator previous = lower_bound(a);
+    return {previous, previous == end() || arg_less(a, previous->arg())};
+}
 
-    bool new_argument = previous == end();
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::set_value(const A &a, const V &v) {
+    typename Stats::Timer timer(MaximaOp::set_value);
+    auto [previous, new_argument] = locate(a);
+    assign(previous, new_argument, a, v);
+}
 
-    // Avoids copy constructing `a` if it is already present in the domain.
-    point_type to_be_inserted = new_argument ?
-                                make_point(a, v) : make_point(previous->arg_,
-                                                              std::make_shared<V>(
-                                                                      v));
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::set_sorted(const batch_type &batch) {
+    if constexpr (nothrow_comparisons) {
+        if (!lazy) {
+            iterator hint = begin();
+            for (auto first = batch.begin(); first != batch.end();) {
+                auto last = first + static_cast<std::ptrdiff_t>(std::min<std::size_t>(
+                        batch_group, static_cast<std::size_t>(batch.end() - first)));
+                hint = set_sorted_unguarded(first, last, hint);
+                first = last;
+            }
+            return;
+        }
+    }
+    for (const auto &[a, v] : batch)
+        set_value(*a, *v);
+}
 
-    InsertGuard<point_type_comparator_by_arg, iterator> currentGuard
-            (to_be_inserted, points);
-    iterator current = currentGuard.it;
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::set_sorted_unguarded(
+        typename batch_type::const_iterator first,
+        typename batch_type::const_iterator last, iterator hint) -> iterator {
+    struct Change {
+        const V *value;
+        node_handle node;
+        // The first point with an argument not less than the new one, which
+        // is replaced if the arguments are equal.
+        iterator hint;
+        bool replaces;
+        Plan plan;
+        // The first point left after the new one, end() if none.
+        iterator after() const { return replaces ? std::next(hint) : hint; }
+    };
 
-    iterator neighbours[]{
-            left(current, new_argument ? end() : previous),
-            current,
-            right(current, end())
+    // Each point is located from the previous one, and its node allocated
+    // up front, as nothing else may throw but indexing new maxima.
+    std::vector<Change> changes;
+    changes.reserve(static_cast<std::size_t>(last - first));
+    for (; first != last; ++first) {
+        const auto &[a, v] = *first;
+        // Nearby points are reached by stepping, the rest by a search.
+        for (int steps = 0; hint != end() && arg_less(hint->arg(), *a); steps++) {
+            if (steps == batch_steps) {
+                hint = lower_bound(*a);
+                break;
+            }
+            ++hint;
+        }
+        bool replaces = hint != end() && !arg_less(*a, hint->arg());
+        if (!replaces || value_less(hint->value(), *v) ||
+            value_less(*v, hint->value())) {
+            Pointer<V, Threading> value = payload(*v, value_pool);
+            node_handle node = allocate(make_point(
+                    replaces ? hint->arg_ : payload(*a, arg_pool), value));
+            changes.push_back(Change{&node.value().value(), std::move(node),
+                                     hint, replaces, Plan{}});
+        }
+        if (replaces)
+            ++hint;
+    }
+    if (changes.empty())
+        return hint;
+
+    // Changes with no point left between them are neighbours. Otherwise
+    // the points left next to a change are re-evaluated too, each once.
+    auto adjacent = [&changes](std::size_t i) {
+        return i + 1 < changes.size() && changes[i].after() == changes[i + 1].hint;
+    };
+    auto before = [this](const Change &change) {
+        return change.hint == begin() ? end() : std::prev(change.hint);
     };
+    std::vector<Plan> plans;
+    plans.reserve(2 * changes.size());
+    for (std::size_t i = 0; i < changes.size(); i++) {
+        Change &change = changes[i];
+        bool joined_left = i > 0 && adjacent(i - 1);
+        iterator left = before(change);
+        const V *left_value = joined_left ? changes[i - 1].value : value_of(left);
+        const V *right_value = adjacent(i) ? changes[i + 1].value
+                                           : value_of(change.after());
+        bool maximum = is_a_local_maximum(*change.value, left_value, right_value);
+        change.plan = Plan{end(), maximum, maximum};
+
+        if (!joined_left && left != end()) {
+            bool after_previous = i > 0 && changes[i - 1].after() == left;
+            const V *outer = after_previous ? changes[i - 1].value
+                                            : left == begin()
+                                              ? nullptr
+                                              : &std::prev(left)->value();
+            plans.push_back(plan_maximum(left, outer, change.value));
+        }
+        iterator right = change.after();
+        if (!adjacent(i) && right != end() &&
+            (i + 1 == changes.size() || before(changes[i + 1]) != right))
+            plans.push_back(plan_maximum(right, change.value,
+                                         value_of(std::next(right))));
+    }
 
-    std::unique_ptr<Guard> updateGuards[]{
-            mark_as_maximum(neighbours[0], new_argument ? end() : previous),
-            mark_as_maximum(neighbours[1], new_argument ? end() : previous),
-            mark_as_maximum(neighbours[2], end())
+    for (Change &change : changes)
+        change.plan.it = points.insert(change.hint, std::move(change.node));
+
+    // Indexes new maxima, changes first, all or none.
+    auto plan_at = [&changes, &plans](std::size_t i) -> Plan & {
+        return i < changes.size() ? changes[i].plan : plans[i - changes.size()];
     };
+    std::size_t total = changes.size() + plans.size();
+    std::size_t indexed = 0;
+    try {
+        for (; indexed < total; indexed++) {
+            if (plan_at(indexed).insert)
+                index_maximum(plan_at(indexed).it);
+        }
+    } catch (...) {
+        while (indexed-- > 0) {
+            if (plan_at(indexed).insert)
+                unindex_maximum(plan_at(indexed).it);
+        }
+        for (Change &change : changes)
+            points.erase(change.plan.it);
+        throw;
+    }
+
+    // From this point, the function will not throw an exception
+    for (Change &change : changes) {
+        if (change.replaces) {
+            remove_maximum(change.hint);
+            points.erase(change.hint);
+        }
+    }
+    for (std::size_t i = 0; i < total; i++)
+        apply(plan_at(i));
+    return hint;
+}
+
+template<typename A, typename V, typename Threading>
+template<typename Function>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::update(const A &a, Function fn) {
+    typename Stats::Timer timer(MaximaOp::set_value);
+    auto [previous, new_argument] = locate(a);
+    std::optional<V> v = fn(new_argument ? nullptr : &previous->value());
+    if (v)
+        assign(previous, new_argument, a, *v);
+}
+
+template<typename A, typename V, typename Threading>
+template<typename Predicate>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::set_value_if(const A &a, const V &v,
+                                                    Predicate pred) {
+    typename Stats::Timer timer(MaximaOp::set_value);
+    auto [previous, new_argument] = locate(a);
+    if (pred(new_argument ? nullptr : &previous->value()))
+        assign(previous, new_argument, a, v);
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::assign(const iterator &previous,
+                                              bool new_argument,
+                                              const A &a, const V &v) {
+    if (!new_argument && !(value_less(previous->value(), v) ||
+                           value_less(v, previous->value())))
+        return;
+
+    // Avoids copy constructing `a` if it is already present in the domain.
+    Pointer<V, Threading> value = payload(v, value_pool);
+    point_type to_be_inserted = make_point(
+            new_argument ? payload(a, arg_pool) : previous->arg_, value);
 
-    std::unique_ptr<Guard> eraseGuards[]{
-            unmark_as_maximum(neighbours[0], new_argument ? end() : previous),
-            unmark_as_maximum(neighbours[1], new_argument ? end() : previous),
-            unmark_as_maximum(neighbours[2], end())
+    node_handle node = allocate(to_be_inserted);
+    link(previous, new_argument, node);
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::link(const iterator &previous,
+                                            bool new_argument,
+                                            node_handle &node) -> iterator {
+    if (lazy)
+        return set_value_lazy(previous, new_argument, node);
+    if constexpr (nothrow_comparisons)
+        return set_value_unguarded(previous, new_argument, node);
+
+    // Inserted right before `previous`, so it is never a left neighbour.
+    InsertGuard<point_set> currentGuard(node, points, previous);
+    iterator current = currentGuard.it;
+
+    iterator left = current == begin() ? end() : std::prev(current);
+    iterator right = std::next(current);
+    if (!new_argument)
+        right = std::next(right);
+    iterator left_left = left == end() || left == begin() ? end() : std::prev(left);
+    iterator right_right = right == end() ? end() : std::next(right);
+
+    std::unique_ptr<Guard> guards[]{
+            update_maximum(left, left_left, current),
+            update_maximum(current, left, right),
+            update_maximum(right, current, right_right)
     };
 
+    // From this point, the function will not throw an exception
     if (!new_argument) {
-        mx_points.erase(*previous);
-        // From this point, the function will not throw an exception
+        remove_maximum(previous);
         points.erase(previous);
     }
 
     currentGuard.commit();
-    for (auto &guard : updateGuards)
+    for (auto &guard : guards)
         guard->commit();
+    return current;
+}
 
-    for (auto &guard : eraseGuards)
-        guard->commit();
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::set_value_unguarded(
+        const iterator &previous, bool new_argument, node_handle &node)
+-> iterator {
+    const point_type &point = node.value();
+    iterator left = previous == begin() ? end() : std::prev(previous);
+    iterator right = new_argument ? previous : std::next(previous);
+    iterator left_left = left == end() || left == begin() ? end() : std::prev(left);
+    iterator right_right = right == end() ? end() : std::next(right);
+
+    bool current_maximum = is_a_local_maximum(point.value(), value_of(left),
+                                              value_of(right));
+    Plan plans[]{
+            plan_maximum(left, value_of(left_left), &point.value()),
+            Plan{end(), current_maximum, current_maximum},
+            plan_maximum(right, &point.value(), value_of(right_right))
+    };
+    // The new point is linked in first, so that it can be indexed.
+    // Nothing looks at it until the plans are applied.
+    plans[1].it = points.insert(previous, std::move(node));
+    try {
+        insert_planned(plans);
+    } catch (...) {
+        node = points.extract(plans[1].it);
+        throw;
+    }
+
+    // From this point, the function will not throw an exception
+    if (!new_argument) {
+        remove_maximum(previous);
+        points.erase(previous);
+    }
+    for (auto &plan : plans)
+        apply(plan);
+    return plans[1].it;
 }
 
-template<typename A, typename V>
-void FunctionMaxima<A, V>::MaximaImpl::erase(const A &a) {
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::erase(const A &a) {
+    typename Stats::Timer timer(MaximaOp::erase);
     iterator to_erase = find(a);
-    if (to_erase == end())
+    if (to_erase != end())
+        detach(to_erase);
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::extract(const A &a) -> node_handle {
+    typename Stats::Timer timer(MaximaOp::erase);
+    iterator to_extract = find(a);
+    return to_extract == end() ? node_handle() : detach(to_extract);
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::insert(node_handle &node)
+-> std::pair<iterator, bool> {
+    typename Stats::Timer timer(MaximaOp::set_value);
+    auto [previous, new_argument] = locate(node.value().arg());
+    if (!new_argument)
+        return {previous, false};
+    if (node.get_allocator() != points.get_allocator()) {
+        // Nodes move only within a pool, a copy shares the payloads.
+        node_handle copy = allocate(node.value());
+        iterator linked = link(previous, true, copy);
+        node = node_handle();
+        return {linked, true};
+    }
+    return {link(previous, true, node), true};
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::detach(const iterator &to_erase)
+-> node_handle {
+    if (lazy)
+        return erase_lazy(to_erase);
+    if constexpr (nothrow_comparisons)
+        return erase_unguarded(to_erase);
+
+    iterator left = to_erase == begin() ? end() : std::prev(to_erase);
+    iterator right = std::next(to_erase);
+    iterator left_left = left == end() || left == begin() ? end() : std::prev(left);
+    iterator right_right = right == end() ? end() : std::next(right);
+
+    std::unique_ptr<Guard> guards[]{
+            update_maximum(left, left_left, right),
+            update_maximum(right, left, right_right)
+    };
+
+    for (auto &guard : guards)
+        guard->commit();
+
+    remove_maximum(to_erase);
+    return points.extract(to_erase);
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::erase_unguarded(const iterator &to_erase)
+-> node_handle {
+    iterator left = to_erase == begin() ? end() : std::prev(to_erase);
+    iterator right = std::next(to_erase);
+    iterator left_left = left == end() || left == begin() ? end() : std::prev(left);
+    iterator right_right = right == end() ? end() : std::next(right);
+
+    Plan plans[]{
+            plan_maximum(left, value_of(left_left), value_of(right)),
+            plan_maximum(right, value_of(left), value_of(right_right))
+    };
+    insert_planned(plans);
+
+    // From this point, the function will not throw an exception
+    remove_maximum(to_erase);
+    node_handle node = points.extract(to_erase);
+    for (auto &plan : plans)
+        apply(plan);
+    return node;
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::merge(MaximaImpl &other) {
+    if (&other == this)
         return;
+    flush();
+    other.flush();
+    if constexpr (nothrow_comparisons) {
+        if (points.get_allocator() == other.points.get_allocator()) {
+            splice(other, other.begin(), other.end());
+            return;
+        }
+    }
 
-    mx_iterator to_erase_mx = mx_points.find(*to_erase);
+    // Each point is linked in as a new node sharing the payloads before it
+    // is erased from `other`, so that none is lost if a comparison throws.
+    for (iterator it = other.begin(); it != other.end();) {
+        iterator moved = it++;
+        auto [previous, new_argument] = locate(moved->arg());
+        if (!new_argument)
+            continue;
+        node_handle node = allocate(*moved);
+        link(previous, true, node);
+        other.detach(moved);
+    }
+}
 
-    iterator neighbours[]{
-            left(to_erase, end()),
-            right(to_erase, end())
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::splice(MaximaImpl &other,
+                                              const iterator &first,
+                                              const iterator &last) {
+    struct Move {
+        iterator from;
+        // The point it is linked in before.
+        iterator hint;
+        iterator placed;
     };
 
-    std::unique_ptr<Guard> updateGuards[]{
-            mark_as_maximum(neighbours[0], to_erase),
-            mark_as_maximum(neighbours[1], to_erase)
+    // Runs of points landing between the same two points of this function
+    // share a hint, found once per run. Points of `other` next to the ones
+    // moved out are its seams.
+    std::vector<Move> moves;
+    std::vector<iterator> other_seams;
+    size_type runs = 0;
+    iterator hint = begin();
+    bool previous_moved = false;
+    for (iterator it = first; it != last; ++it) {
+        if (hint != end() && !arg_less(it->arg(), hint->arg()))
+            hint = lower_bound(it->arg());
+        bool moved = hint == end() || arg_less(it->arg(), hint->arg());
+        if (moved && !previous_moved && it != other.begin())
+            other_seams.push_back(std::prev(it));
+        if (!moved && previous_moved)
+            other_seams.push_back(it);
+        previous_moved = moved;
+        if (!moved)
+            continue;
+        if (moves.empty() || moves.back().hint != hint)
+            runs++;
+        moves.push_back(Move{it, hint, end()});
+    }
+    if (previous_moved && last != other.end())
+        other_seams.push_back(last);
+    if (moves.empty())
+        return;
+
+    // Only the points at both ends of a run and their new neighbours may
+    // change status.
+    std::vector<std::pair<MaximaImpl *, Plan>> plans;
+    plans.reserve(4 * runs + other_seams.size());
+
+    // From this point, only indexing new maxima may throw.
+    for (Move &move : moves) {
+        move.placed = points.insert(move.hint, other.points.extract(move.from));
+        if (move.placed->maximum)
+            adopt_maximum(move.placed, other);
+    }
+
+    auto plan = [&plans](MaximaImpl &owner, const iterator &it) {
+        if (!plans.empty() && plans.back().first == &owner &&
+            plans.back().second.it == it)
+            return;
+        iterator left = it == owner.begin() ? owner.end() : std::prev(it);
+        plans.emplace_back(&owner, owner.plan_maximum(
+                it, owner.value_of(left), owner.value_of(std::next(it))));
     };
+    for (size_type i = 0; i < moves.size(); i++) {
+        if (i == 0 || moves[i - 1].hint != moves[i].hint) {
+            if (moves[i].placed != begin())
+                plan(*this, std::prev(moves[i].placed));
+            plan(*this, moves[i].placed);
+        }
+        if (i + 1 == moves.size() || moves[i + 1].hint != moves[i].hint) {
+            plan(*this, moves[i].placed);
+            if (moves[i].hint != end())
+                plan(*this, moves[i].hint);
+        }
+    }
+    for (const iterator &it : other_seams)
+        plan(other, it);
+
+    size_type indexed = 0;
+    try {
+        for (; indexed < plans.size(); indexed++) {
+            auto &[owner, p] = plans[indexed];
+            if (p.insert)
+                owner->index_maximum(p.it);
+        }
+    } catch (...) {
+        while (indexed-- > 0) {
+            auto &[owner, p] = plans[indexed];
+            if (p.insert)
+                owner->unindex_maximum(p.it);
+        }
+        for (Move &move : moves) {
+            iterator back = other.points.insert(points.extract(move.placed));
+            if (back->maximum)
+                other.adopt_maximum(back, *this);
+        }
+        throw;
+    }
 
-    std::unique_ptr<Guard> eraseGuards[]{
-            unmark_as_maximum(neighbours[0], to_erase),
-            unmark_as_maximum(neighbours[1], to_erase)
+    for (auto &[owner, p] : plans)
+        owner->apply(p);
+}
+
+template<typename A, typename V, typename Threading>
+MaximaMemory
+FunctionMaxima<A, V, Threading>::MaximaImpl::memory_usage() const noexcept {
+    MaximaMemory usage = node_usage();
+    usage.args = size() * sizeof(A);
+    usage.values = size() * sizeof(V);
+    usage.control_blocks = size() * (Threading::template counter_size<A>() +
+                                     Threading::template counter_size<V>());
+    return usage;
+}
+
+template<typename A, typename V, typename Threading>
+MaximaMemory
+FunctionMaxima<A, V, Threading>::MaximaImpl::exact_memory_usage() const noexcept {
+    MaximaMemory usage = node_usage();
+
+    double shared_args = 0, shared_values = 0, shared_counters = 0;
+    auto count = [&usage, &shared_counters](std::size_t owners, std::size_t held,
+                                            std::size_t bytes, std::size_t counter,
+                                            std::size_t &own, double &shared) {
+        if (owners == held) {
+            own += bytes;
+            usage.control_blocks += counter;
+        } else if (owners > 0) {
+            double share = static_cast<double>(held) / static_cast<double>(owners);
+            shared += share * static_cast<double>(bytes);
+            shared_counters += share * static_cast<double>(counter);
+        }
     };
+    for (const Node &point : points) {
+        // Maxima are held by their entry in mx_points too.
+        std::size_t held = point.maximum ? 2 : 1;
+        count(point.arg_.owners(), held, sizeof(A),
+              Threading::template counter_size<A>(), usage.args, shared_args);
+        count(point.val_.owners(), held, sizeof(V),
+              Threading::template counter_size<V>(), usage.values, shared_values);
+    }
+    usage.shared_args = static_cast<std::size_t>(shared_args + 0.5);
+    usage.shared_values = static_cast<std::size_t>(shared_values + 0.5);
+    usage.control_blocks += static_cast<std::size_t>(shared_counters + 0.5);
+    return usage;
+}
 
-    for (auto &guard : updateGuards)
-        guard->commit();
+template<typename A, typename V, typename Threading>
+MaximaMemory
+FunctionMaxima<A, V, Threading>::MaximaImpl::node_usage() const noexcept {
+    MaximaMemory usage;
+    usage.points = size() * point_node_size();
+    usage.maxima = mx_points.size() * maxima_set::node_size() +
+                   mx_by_arg.size() * maxima_by_arg_set::node_size();
+    usage.bookkeeping = sizeof(MaximaImpl) + dirty.capacity() * sizeof(iterator);
+    usage.reserved = slabs ? slabs->unused() : 0;
+    return usage;
+}
 
-    for (auto &guard : eraseGuards)
-        guard->commit();
+template<typename A, typename V, typename Threading>
+bool FunctionMaxima<A, V, Threading>::MaximaImpl::split(const A &a, MaximaImpl &rest) {
+    flush();
+    rest.copy_settings(*this);
+    rest.use_slabs(slabs);
+    iterator cut = lower_bound(a);
+
+    if constexpr (nothrow_comparisons) {
+        // Walking away from the cut both ways at once finds the smaller
+        // part, which is the one moved, in time proportional to its size.
+        iterator up = cut, down = cut;
+        while (up != end() && down != begin()) {
+            ++up;
+            --down;
+        }
+        if (up != end()) {
+            rest.splice(*this, begin(), cut);
+            return true;
+        }
+        rest.splice(*this, cut, end());
+        return false;
+    }
+
+    // Copies sharing the payloads are linked into `rest` first, so that
+    // nothing changes here if a comparison throws.
+    for (iterator it = cut; it != end(); ++it) {
+        node_handle node = rest.allocate(*it);
+        rest.link(rest.end(), true, node);
+    }
 
-    if (to_erase_mx != mx_end())
-        mx_points.erase(to_erase_mx);
-    points.erase(to_erase);
+    // With no right neighbour, the new last point can only become a maximum.
+    iterator last = cut == begin() ? end() : std::prev(cut);
+    std::unique_ptr<Guard> updateGuard =
+            last == end() ? make_guard<EmptyGuard>()
+                          : update_maximum(last, last == begin() ? end()
+                                                                 : std::prev(last),
+                                           end());
+
+    updateGuard->commit();
+    for (iterator it = cut; it != end(); ++it)
+        remove_maximum(it);
+    points.erase(cut, end());
+    return false;
 }
 
-template<typename A, typename V>
-class FunctionMaxima<A, V>::MaximaImpl::Guard {
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::reserve(size_type n) {
+    slabs->reserve(n);
+    slabs->reserve_class(point_node_size());
+    slabs->reserve_class(maxima_set::node_size());
+    slabs->reserve_class(maxima_by_arg_set::node_size());
+    std::size_t arg_block = Threading::template block_size<A, slab_allocator<A>>();
+    if (arg_block && !arg_pool)
+        slabs->reserve_class(arg_block);
+    std::size_t value_block = Threading::template block_size<V, slab_allocator<V>>();
+    if (value_block && !value_pool)
+        slabs->reserve_class(value_block);
+}
+
+template<typename A, typename V, typename Threading>
+std::size_t
+FunctionMaxima<A, V, Threading>::MaximaImpl::point_node_size() noexcept {
+    using StandIn = BlockStandIn<Node>;
+    struct Unordered {
+        bool operator()(const StandIn &, const StandIn &) const noexcept {
+            return false;
+        }
+    };
+    static const std::size_t size = measure_block<StandIn>([](const auto &probe) {
+        std::multiset<StandIn, Unordered, BlockSizeProbe<StandIn>> nodes(probe);
+        nodes.emplace();
+    });
+    return size;
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::shrink_to_fit() {
+    dirty.shrink_to_fit();
+    if (slabs)
+        slabs->shrink_to_fit();
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::use_slabs(
+        const std::shared_ptr<slab_pool> &pool) {
+    // Move assignment takes the allocator along.
+    points = point_set(slab_allocator<Node>(pool.get()));
+    mx_points = maxima_set(slab_allocator<point_type>(pool.get()));
+    mx_by_arg = maxima_by_arg_set(slab_allocator<iterator>(pool.get()));
+    slabs = pool;
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::copy_settings(const MaximaImpl &other) {
+    set_lazy(other.lazy);
+    arg_pool = other.arg_pool;
+    value_pool = other.value_pool;
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::adopt_maximum(
+        const iterator &it, MaximaImpl &from) const noexcept {
+    it->mx_handle = mx_points.insert(from.mx_points.extract(it->mx_handle));
+    auto entry = from.mx_by_arg.extract(it->mx_arg_handle);
+    entry.value() = it;
+    it->mx_arg_handle = mx_by_arg.insert(std::move(entry));
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::erase_prefix(const iterator &last) {
+    if (last == begin())
+        return;
+
+    if (lazy) {
+        reserve_dirty(1);
+        for (iterator it = begin(); it != last; ++it) {
+            remove_maximum(it);
+            unmark_dirty(it);
+        }
+        points.erase(begin(), last);
+        mark_dirty(begin());
+        return;
+    }
+
+    // With no left neighbour, the new first point can only become a maximum.
+    // Nothing else may throw.
+    std::unique_ptr<Guard> updateGuard =
+            last == end() ? make_guard<EmptyGuard>()
+                          : update_maximum(last, end(), std::next(last));
+
+    updateGuard->commit();
+    for (iterator it = begin(); it != last; ++it)
+        remove_maximum(it);
+    points.erase(begin(), last);
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::nth_maximum(size_type i) const
+-> mx_iterator {
+    flush();
+    return mx_points.find_by_order(i);
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::mx_rank(const mx_iterator &it) const
+-> size_type {
+    flush();
+    return mx_points.rank(it);
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::count_maxima_at_least(const V &v) const
+-> size_type {
+    flush();
+    // Maxima are ordered by decreasing values, so the ones counted
+    // form a prefix.
+    return mx_points.prefix_length([&v](const point_type &p) {
+        return !value_less(p.value(), v);
+    });
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::prev_maximum(const A &a) const
+-> iterator {
+    flush();
+    auto after = mx_by_arg.partition_point([&a](const iterator &it) {
+        return !arg_less(a, it->arg());
+    });
+    return after == mx_by_arg.begin() ? end() : *std::prev(after);
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::next_maximum(const A &a) const
+-> iterator {
+    flush();
+    auto first = mx_by_arg.partition_point([&a](const iterator &it) {
+        return arg_less(it->arg(), a);
+    });
+    return first == mx_by_arg.end() ? end() : *first;
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::set_lazy(bool enabled) {
+    if (!enabled)
+        flush();
+    lazy = enabled;
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::set_value_lazy(
+        const iterator &previous, bool new_argument, node_handle &node)
+-> iterator {
+    reserve_dirty(3);
+    iterator current = points.insert(previous, std::move(node));
+
+    // From this point, the function will not throw an exception
+    if (!new_argument) {
+        remove_maximum(previous);
+        unmark_dirty(previous);
+        points.erase(previous);
+    }
+    mark_dirty(current == begin() ? end() : std::prev(current));
+    mark_dirty(current);
+    mark_dirty(std::next(current));
+    return current;
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::erase_lazy(const iterator &to_erase)
+-> node_handle {
+    reserve_dirty(2);
+    iterator left = to_erase == begin() ? end() : std::prev(to_erase);
+    iterator right = std::next(to_erase);
+
+    remove_maximum(to_erase);
+    unmark_dirty(to_erase);
+    node_handle node = points.extract(to_erase);
+    mark_dirty(left);
+    mark_dirty(right);
+    return node;
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::reserve_dirty(size_type n) {
+    if (dirty.capacity() - dirty.size() < n)
+        dirty.reserve(std::max(2 * dirty.capacity(), dirty.size() + n));
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::mark_dirty(const iterator &it) noexcept {
+    if (it != end() && it->dirty_index == Node::clean) {
+        it->dirty_index = dirty.size();
+        dirty.push_back(it);
+    }
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::unmark_dirty(const iterator &it) noexcept {
+    if (it->dirty_index == Node::clean)
+        return;
+    dirty[it->dirty_index] = dirty.back();
+    dirty[it->dirty_index]->dirty_index = it->dirty_index;
+    dirty.pop_back();
+    it->dirty_index = Node::clean;
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::flush() const {
+    while (!dirty.empty()) {
+        iterator it = dirty.back();
+        iterator left = it == begin() ? end() : std::prev(it);
+        iterator right = std::next(it);
+        bool is_maximum = is_a_local_maximum(it->value(), value_of(left),
+                                             value_of(right));
+        if (is_maximum && !it->maximum) {
+            index_maximum(it);
+            it->maximum = true;
+            Stats::maximum_inserted();
+        } else if (!is_maximum) {
+            remove_maximum(it);
+        }
+        it->dirty_index = Node::clean;
+        dirty.pop_back();
+    }
+}
+
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::append(const point_type &point,
+                                              bool is_maximum) -> iterator {
+    Stats::allocation();
+    iterator it = points.insert(points.end(), point);
+    if (is_maximum) {
+        Stats::allocation();
+        it->mx_arg_handle = mx_by_arg.push_back(it);
+    }
+    return it;
+}
+
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::append_maximum(const iterator &it) {
+    Stats::allocation();
+    it->mx_handle = mx_points.push_back(*it);
+    it->maximum = true;
+    Stats::maximum_inserted();
+}
+
+template<typename A, typename V, typename Threading>
+template<typename guard_type, typename... Args>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::make_guard(Args &&... args)
+-> std::unique_ptr<Guard> {
+    Stats::allocation();
+    return std::make_unique<guard_type>(std::forward<Args>(args)...);
+}
+
+template<typename A, typename V, typename Threading>
+class FunctionMaxima<A, V, Threading>::MaximaImpl::Guard {
 protected:
     bool done;
 
@@ -381,130 +2064,262 @@ public:
     void commit() { done = true; }
 };
 
-template<typename A, typename V>
-template<typename comparator, typename it_type>
-class FunctionMaxima<A, V>::MaximaImpl::InsertGuard : public Guard {
+template<typename A, typename V, typename Threading>
+template<typename set_type>
+class FunctionMaxima<A, V, Threading>::MaximaImpl::InsertGuard : public Guard {
 public:
+    using it_type = typename set_type::const_iterator;
+
+    using node_type = typename set_type::node_type;
 
     it_type it;
-    std::multiset<point_type, comparator> *multiset;
+    set_type *multiset;
 
-    InsertGuard(
-            const point_type &point,
-            std::multiset<point_type, comparator> &multiset
-    ) : Guard() {
-        it = multiset.insert(point);
-        this->multiset = &multiset;
-    }
+    // Links `node` in as close as possible before `hint`, in constant time
+    // if that is the right place. The node is given back on rollback.
+    InsertGuard(node_type &node, set_type &set, const it_type &hint)
+            : Guard(), it(set.insert(hint, std::move(node))),
+              multiset(&set), source(&node) {}
 
     ~InsertGuard() noexcept {
-        if (!Guard::done)
-            multiset->erase(it);
+        if (!Guard::done) {
+            *source = multiset->extract(it);
+            Stats::rollback();
+        }
     }
+
+private:
+    node_type *source;
 };
 
-template<typename A, typename V>
-template<typename comparator, typename it_type>
-class FunctionMaxima<A, V>::MaximaImpl::DelayedErase : public Guard {
+template<typename A, typename V, typename Threading>
+class FunctionMaxima<A, V, Threading>::MaximaImpl::MarkGuard : public Guard {
 public:
+    MarkGuard(const iterator &it, const MaximaImpl &impl)
+            : Guard(), marked(it), owner(impl) {
+        owner.index_maximum(marked);
+    }
 
-    it_type it;
-    std::multiset<point_type, comparator> *multiset;
+    ~MarkGuard() noexcept {
+        if (Guard::done) {
+            marked->maximum = true;
+            Stats::maximum_inserted();
+        } else {
+            owner.unindex_maximum(marked);
+            Stats::rollback();
+        }
+    }
 
-    DelayedErase(
-            const it_type &iter, std::multiset<point_type, comparator> &multiset
-    ) : Guard(), it(iter), multiset(&multiset) {}
+private:
+    iterator marked;
+    const MaximaImpl &owner;
+};
 
-    ~DelayedErase() noexcept {
-        if (Guard::done)
-            multiset->erase(it);
+template<typename A, typename V, typename Threading>
+class FunctionMaxima<A, V, Threading>::MaximaImpl::UnmarkGuard : public Guard {
+public:
+    UnmarkGuard(const iterator &it, const MaximaImpl &impl)
+            : Guard(), unmarked(it), owner(impl) {}
+
+    ~UnmarkGuard() noexcept {
+        if (Guard::done) {
+            owner.unindex_maximum(unmarked);
+            unmarked->maximum = false;
+            Stats::maximum_removed();
+        } else {
+            Stats::rollback();
+        }
     }
+
+private:
+    iterator unmarked;
+    const MaximaImpl &owner;
 };
 
-template<typename A, typename V>
-bool FunctionMaxima<A, V>::MaximaImpl::is_a_local_maximum(const iterator &it,
-                                                          const iterator &to_omit) {
-    return (left(it, to_omit) == end() ||
-            !(it->value() < left(it, to_omit)->value()))
-           &&
-           (right(it, to_omit) == end() ||
-            !(it->value() < right(it, to_omit)->value()));
+template<typename A, typename V, typename Threading>
+bool FunctionMaxima<A, V, Threading>::MaximaImpl::is_a_local_maximum(
+        const V &value, const V *left, const V *right) {
+    return (!left || !value_less(value, *left)) &&
+           (!right || !value_less(value, *right));
 }
 
-template<typename A, typename V>
-auto FunctionMaxima<A, V>::MaximaImpl::mark_as_maximum(
-        const iterator &it, const iterator &to_omit
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::update_maximum(
+        const iterator &it, const iterator &left, const iterator &right
 ) -> std::unique_ptr<Guard> {
-    if (it == points.end())
-        return std::make_unique<EmptyGuard>();
-    auto it_mx = mx_points.find(*it);
-
-    bool was_a_local_maximum = (it_mx != mx_points.end());
-
-    if (!was_a_local_maximum && is_a_local_maximum(it, to_omit))
-        return std::make_unique<InsertGuard<point_type_comparator_by_value, mx_iterator>>(
-                *it, mx_points);
-    return std::make_unique<EmptyGuard>();
+    if (it == end())
+        return make_guard<EmptyGuard>();
+
+    bool is_maximum = is_a_local_maximum(it->value(), value_of(left),
+                                         value_of(right));
+    if (is_maximum && !it->maximum)
+        return make_guard<MarkGuard>(it, *this);
+    if (!is_maximum && it->maximum)
+        return make_guard<UnmarkGuard>(it, *this);
+    return make_guard<EmptyGuard>();
 }
 
-template<typename A, typename V>
-auto FunctionMaxima<A, V>::MaximaImpl::unmark_as_maximum(
-        const iterator &it, const iterator &to_omit
-) -> std::unique_ptr<Guard> {
-    if (it == points.end())
-        return std::make_unique<EmptyGuard>();
-    auto it_mx = mx_points.find(*it);
-
-    bool was_a_local_maximum = (it_mx != mx_points.end());
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::plan_maximum(
+        const iterator &it, const V *left, const V *right) -> Plan {
+    if (it == end())
+        return Plan{it, false, false};
 
-    if (was_a_local_maximum && !is_a_local_maximum(it, to_omit))
-        return std::make_unique<DelayedErase<point_type_comparator_by_value, mx_iterator>>(
-                it_mx, mx_points);
+    bool is_maximum = is_a_local_maximum(it->value(), left, right);
+    return Plan{it, is_maximum, is_maximum && !it->maximum};
+}
 
-    return std::make_unique<EmptyGuard>();
+template<typename A, typename V, typename Threading>
+template<std::size_t N>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::insert_planned(Plan (&plans)[N]) {
+    std::size_t inserted = 0;
+    try {
+        for (; inserted < N; inserted++) {
+            if (plans[inserted].insert)
+                index_maximum(plans[inserted].it);
+        }
+    } catch (...) {
+        while (inserted-- > 0) {
+            if (plans[inserted].insert)
+                unindex_maximum(plans[inserted].it);
+        }
+        throw;
+    }
 }
 
-template<typename A, typename V>
-auto FunctionMaxima<A, V>::MaximaImpl::left(
-        const iterator &start, const iterator &to_omit
-) noexcept -> iterator {
-    if (start == begin())
-        return end();
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::apply(Plan &plan) noexcept {
+    if (plan.it == end())
+        return;
 
-    iterator ans = std::prev(start);
+    if (plan.insert) {
+        plan.it->maximum = true;
+        Stats::maximum_inserted();
+    } else if (!plan.maximum) {
+        remove_maximum(plan.it);
+    }
+}
 
-    return ans == to_omit ? left(ans, to_omit) : ans;
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::index_maximum(const iterator &it) const {
+    Stats::allocation();
+    it->mx_handle = mx_points.insert(*it);
+    try {
+        Stats::allocation();
+        it->mx_arg_handle = mx_by_arg.insert(it);
+    } catch (...) {
+        mx_points.erase(it->mx_handle);
+        throw;
+    }
 }
 
-template<typename A, typename V>
-auto FunctionMaxima<A, V>::MaximaImpl::right(
-        const iterator &start, const iterator &to_omit
-) noexcept -> iterator {
-    if (start == end())
-        return end();
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::unindex_maximum(
+        const iterator &it) const noexcept {
+    mx_points.erase(it->mx_handle);
+    mx_by_arg.erase(it->mx_arg_handle);
+}
 
-    iterator ans = std::next(start);
+template<typename A, typename V, typename Threading>
+void FunctionMaxima<A, V, Threading>::MaximaImpl::remove_maximum(
+        const iterator &it) const noexcept {
+    if (it->maximum) {
+        unindex_maximum(it);
+        it->maximum = false;
+        Stats::maximum_removed();
+    }
+}
 
-    return ans == to_omit ? right(ans, to_omit) : ans;
+template<typename A, typename V, typename Threading>
+auto FunctionMaxima<A, V, Threading>::MaximaImpl::allocate(const point_type &point) const
+-> node_handle {
+    Stats::allocation();
+    // Inserting into an empty set makes no comparisons.
+    point_set spare(points.get_allocator());
+    spare.insert(point);
+    return spare.extract(spare.begin());
 }
 
-template<typename A, typename V>
-class FunctionMaxima<A, V>::MaximaImpl::point_type_comparator_by_arg {
+template<typename A, typename V, typename Threading>
+class FunctionMaxima<A, V, Threading>::MaximaImpl::point_type_comparator_by_arg {
 public:
     bool operator()(const point_type &p1, const point_type &p2) const {
-        return p1.arg() < p2.arg();
+        return arg_less(p1.arg(), p2.arg());
     }
 };
 
-template<typename A, typename V>
-class FunctionMaxima<A, V>::MaximaImpl::point_type_comparator_by_value {
+template<typename A, typename V, typename Threading>
+class FunctionMaxima<A, V, Threading>::MaximaImpl::iterator_comparator_by_arg {
+public:
+    bool operator()(const iterator &it1, const iterator &it2) const {
+        return arg_less(it1->arg(), it2->arg());
+    }
+};
+
+template<typename A, typename V, typename Threading>
+class FunctionMaxima<A, V, Threading>::MaximaImpl::point_type_comparator_by_value {
 public:
     bool operator()(const point_type &p1, const point_type &p2) const {
-        if (p2.value() < p1.value())
+        if (value_less(p2.value(), p1.value()))
             return true;
         else
-            return !(p1.value() < p2.value()) && p1.arg() < p2.arg();
+            return !value_less(p1.value(), p2.value()) &&
+                   arg_less(p1.arg(), p2.arg());
     }
 };
 
+/*
+ * MaximaBuilder definitions.
+ */
+
+// Builds a FunctionMaxima from points already known to be sorted by argument
+// and from maxima already known to be sorted by value, without recomputing
+// the maxima: each point is compared only with the last one, as the hint
+// of its insertion. Preconditions are not checked: the caller (e.g. a
+// deserializer) is responsible for validating its input.
+template<typename A, typename V>
+class MaximaBuilder {
+public:
+    using function_type = FunctionMaxima<A, V>;
+    using size_type = typename function_type::size_type;
+
+    MaximaBuilder() : imp(std::make_unique<Impl>()) {}
+
+    // Appends a point with an argument greater than all appended so far.
+    // Points flagged as maxima are numbered in the order of appending.
+    void append(const A &, const V &, bool is_maximum);
+
+    // Makes the `rank`-th flagged point (counting from zero) the next
+    // local maximum in the order of decreasing values.
+    void append_maximum(size_type rank);
+
+    // Number of points flagged as maxima so far.
+    size_type flagged() const noexcept { return maxima_by_arg.size(); }
+
+    // Hands over the built function. The builder must not be used afterwards.
+    function_type build() noexcept { return function_type(std::move(imp)); }
+
+private:
+    using Impl = typename function_type::MaximaImpl;
+
+    std::unique_ptr<Impl> imp;
+    std::vector<typename Impl::iterator> maxima_by_arg;
+};
+
+template<typename A, typename V>
+void MaximaBuilder<A, V>::append(const A &a, const V &v, bool is_maximum) {
+    // Room is made first, so that the point is not left unrecorded; the
+    // capacity grows geometrically to keep appending linear.
+    if (is_maximum && maxima_by_arg.size() == maxima_by_arg.capacity())
+        maxima_by_arg.reserve(std::max<size_type>(1, 2 * maxima_by_arg.capacity()));
+    auto it = imp->append(function_type::make_point(a, v), is_maximum);
+    if (is_maximum)
+        maxima_by_arg.push_back(it);
+}
+
+template<typename A, typename V>
+void MaximaBuilder<A, V>::append_maximum(size_type rank) {
+    imp->append_maximum(maxima_by_arg[rank]);
+}
+
 #endif /* FUNCTION_MAXIMA_H */
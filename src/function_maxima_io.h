@@ -0,0 +1,299 @@
+#ifndef FUNCTION_MAXIMA_IO_H
+#define FUNCTION_MAXIMA_IO_H
+
+#include "function_maxima.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unistd.h>
+
+/*
+ * Binary format (version 1), all integers little-endian:
+ *
+ *   magic    "FMAX"
+ *   version  u32
+ *   n        u64   number of points
+ *   k        u64   number of local maxima
+ *   n times  u8 flags (bit 0 set for a local maximum), A, V
+ *   k times  u64 rank of the maximum among flagged points,
+ *                in the order of mx_begin()..mx_end()
+ *
+ * Points are stored in argument order, so loading appends them without
+ * searching and takes the maxima as stored instead of recomputing them.
+ */
+
+class InvalidFormat : public std::exception {
+public:
+    virtual const char *what() const throw() {
+        return "invalid function maxima format";
+    }
+};
+
+// Encodes T as bytes. Specialize for argument and value types other than
+// arithmetic types, enums and std::string:
+//
+//   static void write(std::ostream &, const T &);
+//   static T read(std::istream &);
+//
+// `read` should throw InvalidFormat (or leave the stream failed) on bad input.
+template<typename T, typename = void>
+struct MaximaCodec;
+
+namespace maxima_io {
+    inline void write_bytes(std::ostream &os, const void *data, std::size_t n) {
+        os.write(static_cast<const char *>(data),
+                 static_cast<std::streamsize>(n));
+    }
+
+    inline void read_bytes(std::istream &is, void *data, std::size_t n) {
+        is.read(static_cast<char *>(data), static_cast<std::streamsize>(n));
+        if (!is)
+            throw InvalidFormat();
+    }
+
+    template<typename U>
+    void write_le(std::ostream &os, U x) {
+        unsigned char bytes[sizeof(U)];
+        for (std::size_t i = 0; i < sizeof(U); i++)
+            bytes[i] = static_cast<unsigned char>(x >> (8 * i));
+        write_bytes(os, bytes, sizeof(U));
+    }
+
+    template<typename U>
+    U read_le(std::istream &is) {
+        unsigned char bytes[sizeof(U)];
+        read_bytes(is, bytes, sizeof(U));
+        U x = 0;
+        for (std::size_t i = 0; i < sizeof(U); i++)
+            x = static_cast<U>(x | static_cast<U>(bytes[i]) << (8 * i));
+        return x;
+    }
+
+    // Unsigned integer of the same width as T.
+    template<typename T>
+    using bits_t = std::conditional_t<sizeof(T) == 1, std::uint8_t,
+            std::conditional_t<sizeof(T) == 2, std::uint16_t,
+                    std::conditional_t<sizeof(T) == 4, std::uint32_t,
+                            std::uint64_t>>>;
+
+    constexpr char magic[4] = {'F', 'M', 'A', 'X'};
+    constexpr std::uint32_t version = 1;
+    constexpr std::uint8_t maximum_flag = 1;
+}
+
+// Arithmetic types and enums are stored little-endian with their own width.
+template<typename T>
+struct MaximaCodec<T, std::enable_if_t<
+        std::is_arithmetic_v<T> || std::is_enum_v<T>>> {
+    using bits = maxima_io::bits_t<T>;
+    static_assert(sizeof(T) == sizeof(bits), "unsupported arithmetic width");
+
+    static void write(std::ostream &os, const T &x) {
+        bits b;
+        std::memcpy(&b, &x, sizeof(T));
+        maxima_io::write_le(os, b);
+    }
+
+    static T read(std::istream &is) {
+        bits b = maxima_io::read_le<bits>(is);
+        T x;
+        std::memcpy(&x, &b, sizeof(T));
+        return x;
+    }
+};
+
+// Strings are stored as u64 length followed by raw characters.
+template<>
+struct MaximaCodec<std::string> {
+    static void write(std::ostream &os, const std::string &x) {
+        maxima_io::write_le<std::uint64_t>(os, x.size());
+        maxima_io::write_bytes(os, x.data(), x.size());
+    }
+
+    static std::string read(std::istream &is) {
+        auto size = maxima_io::read_le<std::uint64_t>(is);
+        std::string x;
+        // Grows with the data actually read, a corrupted length
+        // must not allocate gigabytes up front.
+        char chunk[4096];
+        while (size > 0) {
+            auto n = static_cast<std::size_t>(
+                    std::min<std::uint64_t>(size, sizeof(chunk)));
+            maxima_io::read_bytes(is, chunk, n);
+            x.append(chunk, n);
+            size -= n;
+        }
+        return x;
+    }
+};
+
+// Minimal buffered stream buffer over a POSIX file descriptor.
+// Does not own the descriptor.
+class FdStreamBuf : public std::streambuf {
+public:
+    explicit FdStreamBuf(int descriptor) : fd(descriptor) {
+        setg(in, in, in);
+        setp(out, out + sizeof(out));
+    }
+
+    ~FdStreamBuf() override { sync(); }
+
+protected:
+    int_type underflow() override {
+        ssize_t got;
+        do {
+            got = ::read(fd, in, sizeof(in));
+        } while (got < 0 && errno == EINTR);
+        if (got <= 0)
+            return traits_type::eof();
+        setg(in, in, in + got);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    int_type overflow(int_type c) override {
+        if (flush_out() < 0)
+            return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override { return flush_out(); }
+
+private:
+    int flush_out() {
+        const char *p = pbase();
+        while (p < pptr()) {
+            ssize_t put = ::write(fd, p, static_cast<std::size_t>(pptr() - p));
+            if (put < 0 && errno == EINTR)
+                continue;
+            if (put <= 0)
+                return -1;
+            p += put;
+        }
+        setp(out, out + sizeof(out));
+        return 0;
+    }
+
+    int fd;
+    char in[1 << 15];
+    char out[1 << 15];
+};
+
+// Writes `f` in the binary format. Throws std::ios_base::failure
+// if the stream fails.
+template<typename A, typename V,
+        typename ACodec = MaximaCodec<A>, typename VCodec = MaximaCodec<V>>
+void serialize(const FunctionMaxima<A, V> &f, std::ostream &os) {
+    using namespace maxima_io;
+    using size_type = typename FunctionMaxima<A, V>::size_type;
+
+    write_bytes(os, magic, sizeof(magic));
+    write_le(os, version);
+    write_le<std::uint64_t>(os, f.size());
+
+    // Points in mx_points share their payloads with the ones in points,
+    // so maxima are recognized by the address of the argument and no
+    // comparisons are made.
+    std::unordered_map<const A *, std::uint64_t> mx_position;
+    std::uint64_t k = 0;
+    for (auto it = f.mx_begin(); it != f.mx_end(); ++it)
+        mx_position.emplace(&it->arg(), k++);
+    write_le(os, k);
+
+    std::vector<std::uint64_t> rank(static_cast<size_type>(k));
+    std::uint64_t flagged = 0;
+    for (const auto &p : f) {
+        auto mx = mx_position.find(&p.arg());
+        bool is_maximum = mx != mx_position.end();
+        if (is_maximum)
+            rank[static_cast<size_type>(mx->second)] = flagged++;
+        write_le<std::uint8_t>(os, is_maximum ? maximum_flag : 0);
+        ACodec::write(os, p.arg());
+        VCodec::write(os, p.value());
+    }
+
+    for (auto r : rank)
+        write_le(os, r);
+
+    os.flush();
+    if (!os)
+        throw std::ios_base::failure("serialize: stream write failed");
+}
+
+template<typename A, typename V,
+        typename ACodec = MaximaCodec<A>, typename VCodec = MaximaCodec<V>>
+void serialize(const FunctionMaxima<A, V> &f, int fd) {
+    FdStreamBuf buf(fd);
+    std::ostream os(&buf);
+    serialize<A, V, ACodec, VCodec>(f, os);
+}
+
+// Reads a function written by `serialize`. Throws InvalidFormat on
+// malformed or truncated input; the stream position is then unspecified.
+template<typename A, typename V,
+        typename ACodec = MaximaCodec<A>, typename VCodec = MaximaCodec<V>>
+FunctionMaxima<A, V> deserialize(std::istream &is) {
+    using namespace maxima_io;
+    using size_type = typename FunctionMaxima<A, V>::size_type;
+
+    char header[sizeof(magic)];
+    read_bytes(is, header, sizeof(header));
+    if (std::memcmp(header, magic, sizeof(magic)) != 0 ||
+        read_le<std::uint32_t>(is) != version)
+        throw InvalidFormat();
+
+    auto n = read_le<std::uint64_t>(is);
+    auto k = read_le<std::uint64_t>(is);
+    if (k > n)
+        throw InvalidFormat();
+
+    MaximaBuilder<A, V> builder;
+    // Arguments must be strictly increasing, as the builder takes them.
+    std::optional<A> prev;
+    for (std::uint64_t i = 0; i < n; i++) {
+        auto flags = read_le<std::uint8_t>(is);
+        if (flags & ~maximum_flag)
+            throw InvalidFormat();
+        A a = ACodec::read(is);
+        V v = VCodec::read(is);
+        if (!is || (prev && !(*prev < a)))
+            throw InvalidFormat();
+        builder.append(a, v, flags & maximum_flag);
+        prev = std::move(a);
+    }
+    if (builder.flagged() != k)
+        throw InvalidFormat();
+
+    std::vector<bool> used(static_cast<size_type>(k), false);
+    for (std::uint64_t i = 0; i < k; i++) {
+        auto r = read_le<std::uint64_t>(is);
+        if (r >= k || used[static_cast<size_type>(r)])
+            throw InvalidFormat();
+        used[static_cast<size_type>(r)] = true;
+        builder.append_maximum(static_cast<size_type>(r));
+    }
+
+    return builder.build();
+}
+
+template<typename A, typename V,
+        typename ACodec = MaximaCodec<A>, typename VCodec = MaximaCodec<V>>
+FunctionMaxima<A, V> deserialize(int fd) {
+    FdStreamBuf buf(fd);
+    std::istream is(&buf);
+    return deserialize<A, V, ACodec, VCodec>(is);
+}
+
+#endif /* FUNCTION_MAXIMA_IO_H */
@@ -0,0 +1,452 @@
+#ifndef FUNCTION_MAXIMA_JOURNAL_H
+#define FUNCTION_MAXIMA_JOURNAL_H
+
+#include "function_maxima_io.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Durable FunctionMaxima: every set_value and erase is appended to a
+ * write-ahead journal, and the function can be rebuilt after a crash from
+ * the latest checkpoint (written by `serialize`) and the journal tail.
+ *
+ * Journal records, all integers little-endian:
+ *
+ *   length    u32   bytes of the body
+ *   checksum  u32   FNV-1a of the body
+ *   body      u8 operation, A, and V for set_value
+ *
+ * An update is applied to the function first and journaled only if it
+ * succeeded, so updates rolled back by FunctionMaxima never reach the
+ * journal. Records are buffered and written with a single write and fsync
+ * per group of `group_records` updates (group commit); commit() forces one.
+ * Updates not yet committed are lost on a crash.
+ *
+ * A checkpoint serializes the function to a temporary file, renames it
+ * over the previous one and truncates the journal. Replaying records that
+ * are already in the checkpoint gives the same function, so a crash
+ * between the two steps is harmless. Recovery drops a torn record at the
+ * end of the journal and replays the rest. The set_value records between
+ * consecutive erases go through FunctionMaxima::set_values, which sorts
+ * them, drops all but the last write of each argument and applies the rest
+ * in one walk over the function, re-evaluating only the changed points and
+ * their neighbours.
+ *
+ * A newly created journal has its directory synced before the first record
+ * is committed, so that committed records do not vanish with its entry.
+ *
+ * I/O errors throw std::system_error. An update whose commit failed stays
+ * applied and buffered, and is written by the next successful commit.
+ */
+struct JournalOptions {
+    // Updates buffered before they are written and synced together.
+    std::size_t group_records = 64;
+    // Journal size after which a commit is followed by a checkpoint,
+    // 0 for no automatic checkpoints.
+    std::uint64_t checkpoint_bytes = std::uint64_t(64) << 20;
+};
+
+namespace maxima_journal {
+    enum Operation : std::uint8_t {
+        set_op = 1, erase_op = 2
+    };
+
+    constexpr std::size_t header_size = 8;
+
+    inline std::uint32_t checksum(const char *data, std::size_t n) noexcept {
+        std::uint32_t h = 2166136261u;
+        for (std::size_t i = 0; i < n; i++) {
+            h ^= static_cast<unsigned char>(data[i]);
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    inline void put_u32(char *at, std::uint32_t x) noexcept {
+        for (std::size_t i = 0; i < 4; i++)
+            at[i] = static_cast<char>(x >> (8 * i));
+    }
+
+    inline std::uint32_t get_u32(const char *at) noexcept {
+        std::uint32_t x = 0;
+        for (std::size_t i = 0; i < 4; i++)
+            x |= static_cast<std::uint32_t>(static_cast<unsigned char>(at[i]))
+                    << (8 * i);
+        return x;
+    }
+
+    [[noreturn]] inline void fail(const char *what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    // Stream buffer appending to a string, for encoding records.
+    class StringSink : public std::streambuf {
+    public:
+        explicit StringSink(std::string &into) noexcept : out(into) {}
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (!traits_type::eq_int_type(c, traits_type::eof()))
+                out.push_back(traits_type::to_char_type(c));
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char *s, std::streamsize n) override {
+            out.append(s, static_cast<std::size_t>(n));
+            return n;
+        }
+
+    private:
+        std::string &out;
+    };
+
+    // Owned POSIX file descriptor.
+    class File {
+    public:
+        File(const std::string &path, int flags) { open(path, flags); }
+
+        File(const File &) = delete;
+
+        File &operator=(const File &) = delete;
+
+        ~File() { close(); }
+
+        // Closes the file held and opens `path`; stays closed if it does
+        // not exist.
+        void open(const std::string &path, int flags) {
+            close();
+            do {
+                fd = ::open(path.c_str(), flags, 0644);
+            } while (fd < 0 && errno == EINTR);
+            if (fd < 0 && errno != ENOENT)
+                fail("journal: open");
+        }
+
+        bool is_open() const noexcept { return fd >= 0; }
+
+        int get() const noexcept { return fd; }
+
+        void close() noexcept {
+            if (fd >= 0)
+                ::close(fd);
+            fd = -1;
+        }
+
+        void sync() const {
+            if (::fsync(fd) != 0)
+                fail("journal: fsync");
+        }
+
+        void write_at(const char *data, std::size_t n, std::uint64_t offset) const {
+            while (n > 0) {
+                ssize_t put = ::pwrite(fd, data, n, static_cast<off_t>(offset));
+                if (put < 0 && errno == EINTR)
+                    continue;
+                if (put <= 0)
+                    fail("journal: write");
+                data += put;
+                n -= static_cast<std::size_t>(put);
+                offset += static_cast<std::uint64_t>(put);
+            }
+        }
+
+        std::string read_all() const {
+            std::string data;
+            char chunk[1 << 15];
+            for (std::uint64_t offset = 0;;) {
+                ssize_t got = ::pread(fd, chunk, sizeof(chunk),
+                                      static_cast<off_t>(offset));
+                if (got < 0 && errno == EINTR)
+                    continue;
+                if (got < 0)
+                    fail("journal: read");
+                if (got == 0)
+                    return data;
+                data.append(chunk, static_cast<std::size_t>(got));
+                offset += static_cast<std::uint64_t>(got);
+            }
+        }
+
+        void truncate(std::uint64_t size) const {
+            if (::ftruncate(fd, static_cast<off_t>(size)) != 0)
+                fail("journal: truncate");
+        }
+
+    private:
+        int fd = -1;
+    };
+
+    // Directory holding `path`, whose entry must be synced after a rename.
+    inline std::string directory_of(const std::string &path) {
+        auto slash = path.rfind('/');
+        if (slash == std::string::npos)
+            return ".";
+        return slash == 0 ? "/" : path.substr(0, slash);
+    }
+
+    // Syncs the entry of `path` in its directory, if the directory opens.
+    inline void sync_entry(const std::string &path) {
+        File directory(directory_of(path), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directory.is_open())
+            directory.sync();
+    }
+}
+
+template<typename A, typename V,
+        typename ACodec = MaximaCodec<A>, typename VCodec = MaximaCodec<V>>
+class JournaledFunctionMaxima {
+public:
+    using Options = JournalOptions;
+    using function_type = FunctionMaxima<A, V>;
+    using point_type = typename function_type::point_type;
+    using iterator = typename function_type::iterator;
+    using mx_iterator = typename function_type::mx_iterator;
+    using size_type = typename function_type::size_type;
+
+    // Recovers the function from the given files, creating the journal if
+    // it does not exist. A missing checkpoint stands for an empty function.
+    // Throws InvalidFormat if a checkpoint or a checksummed record cannot
+    // be decoded.
+    JournaledFunctionMaxima(std::string checkpoint_path,
+                            std::string journal_path,
+                            Options options = Options());
+
+    JournaledFunctionMaxima(const JournaledFunctionMaxima &) = delete;
+
+    JournaledFunctionMaxima &operator=(const JournaledFunctionMaxima &) = delete;
+
+    // Commits buffered updates, ignoring errors.
+    ~JournaledFunctionMaxima();
+
+    iterator begin() const { return fun.begin(); }
+
+    iterator end() const { return fun.end(); }
+
+    iterator find(A const &x) const { return fun.find(x); }
+
+    mx_iterator mx_begin() const { return fun.mx_begin(); }
+
+    mx_iterator mx_end() const { return fun.mx_end(); }
+
+    size_type size() const { return fun.size(); }
+
+    V const &value_at(const A &a) const { return fun.value_at(a); }
+
+    void set_value(const A &a, const V &v);
+
+    void erase(const A &a);
+
+    // Writes and syncs buffered updates.
+    void commit();
+
+    // Commits, writes a new checkpoint and empties the journal.
+    void checkpoint();
+
+    // Number of updates not committed yet.
+    size_type pending() const noexcept { return pending_records; }
+
+    // The journaled function itself.
+    function_type const &function() const noexcept { return fun; }
+
+private:
+    // Appends a framed record to `buffer`.
+    void encode(maxima_journal::Operation, const A &, const V *);
+
+    // Counts an applied update, committing a full group.
+    void updated();
+
+    void recover();
+
+    function_type fun;
+    std::string checkpoint_file;
+    std::string journal_file;
+    Options options;
+    maxima_journal::File journal;
+    // Committed bytes of the journal, where the buffer is written next.
+    std::uint64_t journal_size = 0;
+    std::string buffer;
+    size_type pending_records = 0;
+};
+
+template<typename A, typename V, typename ACodec, typename VCodec>
+JournaledFunctionMaxima<A, V, ACodec, VCodec>::JournaledFunctionMaxima(
+        std::string checkpoint_path, std::string journal_path, Options opts)
+        : checkpoint_file(std::move(checkpoint_path)),
+          journal_file(std::move(journal_path)), options(opts),
+          journal(journal_file, O_RDWR | O_CLOEXEC) {
+    recover();
+}
+
+template<typename A, typename V, typename ACodec, typename VCodec>
+JournaledFunctionMaxima<A, V, ACodec, VCodec>::~JournaledFunctionMaxima() {
+    try {
+        commit();
+    } catch (...) {
+    }
+}
+
+template<typename A, typename V, typename ACodec, typename VCodec>
+void JournaledFunctionMaxima<A, V, ACodec, VCodec>::set_value(const A &a,
+                                                              const V &v) {
+    auto mark = buffer.size();
+    try {
+        encode(maxima_journal::set_op, a, &v);
+        fun.set_value(a, v);
+    } catch (...) {
+        buffer.resize(mark);
+        throw;
+    }
+    updated();
+}
+
+template<typename A, typename V, typename ACodec, typename VCodec>
+void JournaledFunctionMaxima<A, V, ACodec, VCodec>::erase(const A &a) {
+    auto mark = buffer.size();
+    try {
+        encode(maxima_journal::erase_op, a, nullptr);
+        fun.erase(a);
+    } catch (...) {
+        buffer.resize(mark);
+        throw;
+    }
+    updated();
+}
+
+template<typename A, typename V, typename ACodec, typename VCodec>
+void JournaledFunctionMaxima<A, V, ACodec, VCodec>::encode(
+        maxima_journal::Operation op, const A &a, const V *v) {
+    using namespace maxima_journal;
+    auto start = buffer.size();
+    buffer.append(header_size, '\0');
+    StringSink sink(buffer);
+    std::ostream os(&sink);
+    os.put(static_cast<char>(op));
+    ACodec::write(os, a);
+    if (v)
+        VCodec::write(os, *v);
+    if (!os)
+        throw std::ios_base::failure("journal: record encoding failed");
+
+    auto body = buffer.size() - start - header_size;
+    put_u32(&buffer[start], static_cast<std::uint32_t>(body));
+    put_u32(&buffer[start + 4],
+            checksum(buffer.data() + start + header_size, body));
+}
+
+template<typename A, typename V, typename ACodec, typename VCodec>
+void JournaledFunctionMaxima<A, V, ACodec, VCodec>::updated() {
+    if (++pending_records < options.group_records)
+        return;
+    commit();
+    if (options.checkpoint_bytes != 0 &&
+        journal_size >= options.checkpoint_bytes)
+        checkpoint();
+}
+
+template<typename A, typename V, typename ACodec, typename VCodec>
+void JournaledFunctionMaxima<A, V, ACodec, VCodec>::commit() {
+    if (buffer.empty())
+        return;
+    // Writing at the committed size overwrites whatever a failed
+    // attempt left behind.
+    journal.write_at(buffer.data(), buffer.size(), journal_size);
+    journal.sync();
+    journal_size += buffer.size();
+    buffer.clear();
+    pending_records = 0;
+}
+
+template<typename A, typename V, typename ACodec, typename VCodec>
+void JournaledFunctionMaxima<A, V, ACodec, VCodec>::checkpoint() {
+    using maxima_journal::File;
+    commit();
+
+    std::string temporary = checkpoint_file + ".tmp";
+    {
+        File out(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+        if (!out.is_open())
+            maxima_journal::fail("journal: open checkpoint");
+        serialize<A, V, ACodec, VCodec>(fun, out.get());
+        out.sync();
+    }
+    if (::rename(temporary.c_str(), checkpoint_file.c_str()) != 0)
+        maxima_journal::fail("journal: rename checkpoint");
+    maxima_journal::sync_entry(checkpoint_file);
+
+    journal.truncate(0);
+    journal.sync();
+    journal_size = 0;
+}
+
+template<typename A, typename V, typename ACodec, typename VCodec>
+void JournaledFunctionMaxima<A, V, ACodec, VCodec>::recover() {
+    using namespace maxima_journal;
+    if (!journal.is_open()) {
+        journal.open(journal_file, O_RDWR | O_CREAT | O_CLOEXEC);
+        if (!journal.is_open())
+            fail("journal: open");
+        sync_entry(journal_file);
+    }
+
+    File saved(checkpoint_file, O_RDONLY | O_CLOEXEC);
+    if (saved.is_open())
+        fun = deserialize<A, V, ACodec, VCodec>(saved.get());
+
+    // The valid prefix ends at the first incomplete or damaged record,
+    // which a crash in the middle of a write may leave behind.
+    std::string data = journal.read_all();
+    std::size_t valid = 0;
+    while (data.size() - valid >= header_size) {
+        std::uint32_t body = get_u32(data.data() + valid);
+        if (data.size() - valid - header_size < body ||
+            checksum(data.data() + valid + header_size, body) !=
+            get_u32(data.data() + valid + 4))
+            break;
+        valid += header_size + body;
+    }
+
+    std::istringstream is(data.substr(0, valid));
+    std::vector<std::pair<A, V>> batch;
+    auto apply_batch = [&] {
+        fun.set_values(batch.begin(), batch.end());
+        batch.clear();
+    };
+    for (std::size_t at = 0; at < valid;) {
+        auto next = at + header_size + get_u32(data.data() + at);
+        is.seekg(static_cast<std::streamoff>(at + header_size));
+        auto op = maxima_io::read_le<std::uint8_t>(is);
+        A a = ACodec::read(is);
+        if (op == set_op) {
+            V v = VCodec::read(is);
+            batch.emplace_back(std::move(a), std::move(v));
+        } else if (op == erase_op) {
+            apply_batch();
+            fun.erase(a);
+        } else {
+            throw InvalidFormat();
+        }
+        if (!is || static_cast<std::size_t>(is.tellg()) != next)
+            throw InvalidFormat();
+        at = next;
+    }
+    apply_batch();
+
+    if (valid != data.size()) {
+        journal.truncate(valid);
+        journal.sync();
+    }
+    journal_size = valid;
+}
+
+#endif /* FUNCTION_MAXIMA_JOURNAL_H */
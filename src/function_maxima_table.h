@@ -0,0 +1,464 @@
+#ifndef FUNCTION_MAXIMA_TABLE_H
+#define FUNCTION_MAXIMA_TABLE_H
+
+#include "function_maxima.h"
+
+#include <iterator>
+#include <set>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * Several functions over a shared domain: rows keyed by argument, each
+ * holding one value per column. Arguments are stored and looked up once
+ * per row, local maxima are kept per column and mx_begin(column) behaves
+ * like FunctionMaxima::mx_begin() of that column.
+ *
+ * A row update makes one argument lookup and re-evaluates the row and its
+ * two neighbours in every column. set_value re-evaluates them in its
+ * column only, assigning the value in place, if assigning and comparing
+ * cannot throw; otherwise it copies the row and updates it whole. set_row,
+ * set_value and erase give the strong guarantee, like their FunctionMaxima
+ * counterparts.
+ */
+template<typename A, typename V>
+class FunctionMaximaTable {
+public:
+    class point_type;
+    class row_type;
+
+private:
+    class row_comparator;
+
+    // Decreasing values, then increasing arguments, as in FunctionMaxima.
+    class point_comparator_by_value;
+
+    using row_set = std::set<row_type, row_comparator>;
+    using maxima_set = std::multiset<point_type, point_comparator_by_value>;
+
+public:
+    using iterator = typename row_set::const_iterator;
+    using mx_iterator = typename maxima_set::const_iterator;
+    using size_type = std::size_t;
+
+    explicit FunctionMaximaTable(size_type columns) : mx_points(columns) {}
+
+    // Copies rows as they are and rebuilds the maxima from the copied ones,
+    // one comparison per maximum.
+    FunctionMaximaTable(const FunctionMaximaTable &);
+
+    FunctionMaximaTable(FunctionMaximaTable &&) = default;
+
+    FunctionMaximaTable &operator=(FunctionMaximaTable) noexcept;
+
+    ~FunctionMaximaTable() = default;
+
+    iterator begin() const { return rows.begin(); }
+
+    iterator end() const { return rows.end(); }
+
+    iterator find(A const &a) const { return rows.find(a); }
+
+    mx_iterator mx_begin(size_type column) const {
+        return mx_points[column].begin();
+    }
+
+    mx_iterator mx_end(size_type column) const {
+        return mx_points[column].end();
+    }
+
+    size_type size() const { return rows.size(); }
+
+    size_type columns() const noexcept { return mx_points.size(); }
+
+    V const &value_at(const A &a, size_type column) const;
+
+    // Sets the whole row at `a`, one value per column.
+    // Throws std::invalid_argument if the number of values is wrong.
+    void set_row(const A &a, const std::vector<V> &values);
+
+    // Sets one value of the existing row at `a`.
+    // Throws InvalidArg if there is no such row.
+    void set_value(const A &a, size_type column, const V &v);
+
+    void erase(const A &a);
+
+    void swap(FunctionMaximaTable &) noexcept;
+
+private:
+    struct Cell {
+        V value;
+        bool maximum = false;
+        // Entry in mx_points[column], singular unless `maximum`.
+        mx_iterator handle;
+
+        Cell(const V &v) : value(v) {}
+    };
+
+    // Change of the maximum status of one cell.
+    struct Change {
+        Cell *cell;
+        const A *arg;
+        size_type column;
+        // Whether the cell becomes a maximum, with its new entry in `handle`.
+        bool maximum;
+        mx_iterator handle;
+    };
+
+    // Whether set_value may assign a cell in place: after its node is
+    // allocated, the maxima entry is then re-linked without throwing.
+    static constexpr bool in_place_updates =
+            std::is_nothrow_copy_assignable_v<V> &&
+            noexcept(std::declval<const A &>() < std::declval<const A &>()) &&
+            noexcept(std::declval<const V &>() < std::declval<const V &>());
+
+    // Value of `column` at `it`, nullptr for end().
+    const V *value_of(const iterator &it, size_type column) const noexcept {
+        return it == end() ? nullptr : &it->cells[column].value;
+    }
+
+    static bool is_a_local_maximum(const V &value, const V *left,
+                                   const V *right);
+
+    // Decides the status of `cell` in `column` for neighbour values
+    // `left` and `right`, adding a change to `changes` if it differs.
+    static void plan(std::vector<Change> &changes, Cell &cell, const A &arg,
+                     size_type column, const V *left, const V *right);
+
+    // As above, for the cell of the row at `it`, possibly end().
+    void plan(std::vector<Change> &changes, const iterator &it,
+              size_type column, const V *left, const V *right) const;
+
+    // Gives the row at `current` the values of `cells`, re-evaluating it and
+    // its neighbours. A new row, already holding them, is erased if this
+    // throws.
+    void set_cells(const iterator &current, bool new_argument,
+                   std::vector<Cell> &cells);
+
+    // Inserts the new entries of `changes`, all or none.
+    void insert_planned(std::vector<Change> &changes);
+
+    // Carries out the changes, cannot throw.
+    void apply(std::vector<Change> &changes) noexcept;
+
+    // Erases the entries of the maxima among `cells`.
+    void remove_maxima(std::vector<Cell> &cells) noexcept;
+
+    InvalidArg invalid_exception;
+    row_set rows;
+    std::vector<maxima_set> mx_points;
+};
+
+/*
+ * point_type and row_type definitions.
+ */
+template<typename A, typename V>
+class FunctionMaximaTable<A, V>::point_type {
+public:
+    // Returns function argument.
+    A const &arg() const noexcept { return *arg_; }
+
+    // Returns function value at a given point.
+    V const &value() const noexcept { return *val_; }
+
+private:
+    point_type(const A *a, const V *v) noexcept : arg_(a), val_(v) {}
+
+    const A *arg_;
+    const V *val_;
+
+    friend class FunctionMaximaTable;
+};
+
+template<typename A, typename V>
+class FunctionMaximaTable<A, V>::row_type {
+public:
+    A const &arg() const noexcept { return arg_; }
+
+    V const &value(size_type column) const { return cells[column].value; }
+
+    size_type columns() const noexcept { return cells.size(); }
+
+private:
+    row_type(const A &a, std::vector<Cell> &&c) : arg_(a), cells(std::move(c)) {}
+
+    A arg_;
+    // Swapped whole by updates, which does not move the values.
+    mutable std::vector<Cell> cells;
+
+    friend class FunctionMaximaTable;
+};
+
+template<typename A, typename V>
+class FunctionMaximaTable<A, V>::row_comparator {
+public:
+    using is_transparent = void;
+
+    bool operator()(const row_type &r1, const row_type &r2) const {
+        return r1.arg() < r2.arg();
+    }
+
+    bool operator()(const row_type &r, const A &a) const { return r.arg() < a; }
+
+    bool operator()(const A &a, const row_type &r) const { return a < r.arg(); }
+};
+
+template<typename A, typename V>
+class FunctionMaximaTable<A, V>::point_comparator_by_value {
+public:
+    bool operator()(const point_type &p1, const point_type &p2) const {
+        if (p2.value() < p1.value())
+            return true;
+        return !(p1.value() < p2.value()) && p1.arg() < p2.arg();
+    }
+};
+
+/*
+ * FunctionMaximaTable definitions.
+ */
+template<typename A, typename V>
+FunctionMaximaTable<A, V>::FunctionMaximaTable(const FunctionMaximaTable &other)
+        : rows(other.rows), mx_points(other.columns()) {
+    // Rows are copied in order, the argument's address then leads
+    // from a copied maximum to its row.
+    std::unordered_map<const A *, const row_type *> copied(rows.size());
+    for (auto it = rows.begin(), from = other.rows.begin(); it != rows.end();
+         ++it, ++from)
+        copied.emplace(&from->arg(), &*it);
+
+    for (size_type column = 0; column < columns(); column++) {
+        maxima_set &mx = mx_points[column];
+        for (const point_type &p : other.mx_points[column]) {
+            const row_type *row = copied.find(&p.arg())->second;
+            Cell &cell = row->cells[column];
+            cell.handle = mx.insert(mx.end(), point_type(&row->arg(), &cell.value));
+        }
+    }
+}
+
+// Copy and swap idiom.
+template<typename A, typename V>
+auto FunctionMaximaTable<A, V>::operator=(FunctionMaximaTable other) noexcept
+-> FunctionMaximaTable & {
+    swap(other);
+    return *this;
+}
+
+template<typename A, typename V>
+void FunctionMaximaTable<A, V>::swap(FunctionMaximaTable &other) noexcept {
+    rows.swap(other.rows);
+    mx_points.swap(other.mx_points);
+}
+
+template<typename A, typename V>
+const V &FunctionMaximaTable<A, V>::value_at(const A &a,
+                                             size_type column) const {
+    iterator it = find(a);
+    if (it == end())
+        throw invalid_exception;
+    return it->value(column);
+}
+
+template<typename A, typename V>
+void FunctionMaximaTable<A, V>::set_row(const A &a,
+                                        const std::vector<V> &values) {
+    if (values.size() != columns())
+        throw std::invalid_argument("FunctionMaximaTable: wrong number of values");
+
+    std::vector<Cell> cells(values.begin(), values.end());
+    iterator current = rows.lower_bound(a);
+    bool new_argument = current == end() || a < current->arg();
+    if (new_argument)
+        current = rows.insert(current, row_type(a, std::move(cells)));
+    set_cells(current, new_argument, cells);
+}
+
+template<typename A, typename V>
+void FunctionMaximaTable<A, V>::set_cells(const iterator &current,
+                                          bool new_argument,
+                                          std::vector<Cell> &cells) {
+    std::vector<Change> changes;
+    changes.reserve(3 * columns());
+    // The new values, already in place for a new argument. Otherwise the row
+    // takes them over by swapping buffers, which keeps their addresses.
+    std::vector<Cell> &fresh = new_argument ? current->cells : cells;
+
+    try {
+        iterator left = current == begin() ? end() : std::prev(current);
+        iterator right = std::next(current);
+        iterator left_left = left == end() || left == begin() ? end()
+                                                             : std::prev(left);
+        iterator right_right = right == end() ? end() : std::next(right);
+
+        for (size_type column = 0; column < columns(); column++) {
+            const V *value = &fresh[column].value;
+            plan(changes, left, column, value_of(left_left, column), value);
+            plan(changes, fresh[column], current->arg(), column,
+                 value_of(left, column), value_of(right, column));
+            plan(changes, right, column, value, value_of(right_right, column));
+        }
+        insert_planned(changes);
+    } catch (...) {
+        if (new_argument)
+            rows.erase(current);
+        throw;
+    }
+
+    // From this point, the function will not throw an exception
+    if (!new_argument) {
+        remove_maxima(current->cells);
+        current->cells.swap(cells);
+    }
+    apply(changes);
+}
+
+template<typename A, typename V>
+void FunctionMaximaTable<A, V>::set_value(const A &a, size_type column,
+                                          const V &v) {
+    iterator current = find(a);
+    if (current == end())
+        throw invalid_exception;
+
+    if constexpr (!in_place_updates) {
+        std::vector<Cell> cells;
+        cells.reserve(columns());
+        for (size_type c = 0; c < columns(); c++)
+            cells.emplace_back(c == column ? v : current->cells[c].value);
+        set_cells(current, false, cells);
+    } else {
+        iterator left = current == begin() ? end() : std::prev(current);
+        iterator right = std::next(current);
+        iterator left_left = left == end() || left == begin() ? end()
+                                                             : std::prev(left);
+        iterator right_right = right == end() ? end() : std::next(right);
+
+        std::vector<Change> changes;
+        changes.reserve(2);
+        plan(changes, left, column, value_of(left_left, column), &v);
+        plan(changes, right, column, &v, value_of(right_right, column));
+        bool maximum = is_a_local_maximum(v, value_of(left, column),
+                                          value_of(right, column));
+
+        Cell &cell = current->cells[column];
+        maxima_set &mx = mx_points[column];
+        typename maxima_set::node_type entry;
+        if (maximum && !cell.maximum) {
+            // Inserting into an empty set makes no comparisons.
+            maxima_set spare;
+            spare.insert(point_type(&current->arg(), &cell.value));
+            entry = spare.extract(spare.begin());
+        }
+        insert_planned(changes);
+
+        // From this point, the function will not throw an exception
+        if (cell.maximum && maximum)
+            entry = mx.extract(cell.handle);
+        else if (cell.maximum)
+            mx.erase(cell.handle);
+        cell.value = v;
+        cell.maximum = maximum;
+        cell.handle = maximum ? mx.insert(std::move(entry)) : mx_iterator();
+        apply(changes);
+    }
+}
+
+template<typename A, typename V>
+void FunctionMaximaTable<A, V>::erase(const A &a) {
+    iterator to_erase = find(a);
+    if (to_erase == end())
+        return;
+
+    iterator left = to_erase == begin() ? end() : std::prev(to_erase);
+    iterator right = std::next(to_erase);
+    iterator left_left = left == end() || left == begin() ? end()
+                                                         : std::prev(left);
+    iterator right_right = right == end() ? end() : std::next(right);
+
+    std::vector<Change> changes;
+    changes.reserve(2 * columns());
+    for (size_type column = 0; column < columns(); column++) {
+        plan(changes, left, column, value_of(left_left, column),
+             value_of(right, column));
+        plan(changes, right, column, value_of(left, column),
+             value_of(right_right, column));
+    }
+    insert_planned(changes);
+
+    // From this point, the function will not throw an exception
+    remove_maxima(to_erase->cells);
+    rows.erase(to_erase);
+    apply(changes);
+}
+
+template<typename A, typename V>
+bool FunctionMaximaTable<A, V>::is_a_local_maximum(const V &value,
+                                                   const V *left,
+                                                   const V *right) {
+    return (!left || !(value < *left)) && (!right || !(value < *right));
+}
+
+template<typename A, typename V>
+void FunctionMaximaTable<A, V>::plan(std::vector<Change> &changes, Cell &cell,
+                                     const A &arg, size_type column,
+                                     const V *left, const V *right) {
+    bool maximum = is_a_local_maximum(cell.value, left, right);
+    if (maximum != cell.maximum)
+        changes.push_back(Change{&cell, &arg, column, maximum, {}});
+}
+
+template<typename A, typename V>
+void FunctionMaximaTable<A, V>::plan(std::vector<Change> &changes,
+                                     const iterator &it, size_type column,
+                                     const V *left, const V *right) const {
+    if (it != end())
+        plan(changes, it->cells[column], it->arg(), column, left, right);
+}
+
+template<typename A, typename V>
+void FunctionMaximaTable<A, V>::insert_planned(std::vector<Change> &changes) {
+    size_type inserted = 0;
+    try {
+        for (; inserted < changes.size(); inserted++) {
+            Change &change = changes[inserted];
+            if (change.maximum)
+                change.handle = mx_points[change.column].insert(
+                        point_type(change.arg, &change.cell->value));
+        }
+    } catch (...) {
+        while (inserted-- > 0) {
+            if (changes[inserted].maximum)
+                mx_points[changes[inserted].column].erase(changes[inserted].handle);
+        }
+        throw;
+    }
+}
+
+template<typename A, typename V>
+void FunctionMaximaTable<A, V>::apply(std::vector<Change> &changes) noexcept {
+    for (Change &change : changes) {
+        Cell &cell = *change.cell;
+        if (change.maximum) {
+            cell.handle = change.handle;
+        } else {
+            mx_points[change.column].erase(cell.handle);
+            cell.handle = mx_iterator();
+        }
+        cell.maximum = change.maximum;
+    }
+}
+
+template<typename A, typename V>
+void FunctionMaximaTable<A, V>::remove_maxima(std::vector<Cell> &cells) noexcept {
+    for (size_type column = 0; column < cells.size(); column++) {
+        if (cells[column].maximum) {
+            mx_points[column].erase(cells[column].handle);
+            cells[column].handle = mx_iterator();
+            cells[column].maximum = false;
+        }
+    }
+}
+
+#endif /* FUNCTION_MAXIMA_TABLE_H */
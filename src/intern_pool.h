@@ -0,0 +1,89 @@
+#ifndef INTERN_POOL_H
+#define INTERN_POOL_H
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+
+/*
+ * Pool of shared payloads, keeping one copy of equal objects alive at a
+ * time. intern(x) returns the payload equal to `x` if there is one alive,
+ * otherwise copies `x` into the pool. An entry is released when the last
+ * shared_ptr to it goes away.
+ *
+ * Lookup is ordered, so T needs only operator<, like arguments and values
+ * of FunctionMaxima. The pool must be owned by a std::shared_ptr: payloads
+ * keep it alive, so it may be dropped before them. Interning and releasing
+ * are serialized by a mutex, payloads may be released from any thread.
+ */
+template<typename T>
+class InternPool : public std::enable_shared_from_this<InternPool<T>> {
+public:
+    InternPool() = default;
+
+    InternPool(const InternPool &) = delete;
+
+    InternPool &operator=(const InternPool &) = delete;
+
+    // Payloads are never modified through the returned pointer.
+    std::shared_ptr<T> intern(const T &value);
+
+    // Number of payloads held.
+    std::size_t size() const;
+
+private:
+    // Equal keys coexist only while a released entry waits for the lock.
+    using entry_map = std::multimap<T, std::weak_ptr<T>>;
+
+    class Release;
+
+    entry_map entries;
+    // Recursive, as a failed shared_ptr construction releases the entry
+    // from within intern().
+    mutable std::recursive_mutex mutex;
+};
+
+template<typename T>
+class InternPool<T>::Release {
+public:
+    Release(std::shared_ptr<InternPool> owner,
+            typename entry_map::iterator entry) noexcept
+            : pool(std::move(owner)), it(entry) {}
+
+    void operator()(T *) const noexcept {
+        std::lock_guard<std::recursive_mutex> lock(pool->mutex);
+        pool->entries.erase(it);
+    }
+
+private:
+    std::shared_ptr<InternPool> pool;
+    typename entry_map::iterator it;
+};
+
+template<typename T>
+std::shared_ptr<T> InternPool<T>::intern(const T &value) {
+    std::shared_ptr<InternPool> self = this->shared_from_this();
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    auto range = entries.equal_range(value);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (std::shared_ptr<T> alive = it->second.lock())
+            return alive;
+    }
+
+    auto it = entries.emplace_hint(range.second, value, std::weak_ptr<T>());
+    // If this throws, Release has already erased the entry.
+    std::shared_ptr<T> payload(const_cast<T *>(&it->first),
+                               Release(std::move(self), it));
+    it->second = payload;
+    return payload;
+}
+
+template<typename T>
+std::size_t InternPool<T>::size() const {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return entries.size();
+}
+
+#endif /* INTERN_POOL_H */
@@ -0,0 +1,400 @@
+#ifndef MAXIMA_INGEST_H
+#define MAXIMA_INGEST_H
+
+#include "function_maxima_io.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Pipelined loading of updates from a stream into a FunctionMaxima:
+ *
+ *   reader (caller's thread)  reads fixed-size chunks cut at record ends,
+ *   parsers (worker threads)  turn chunks into batches of (A, V) pairs,
+ *   applier (one thread)      applies batches in stream order with
+ *                             FunctionMaxima::set_values.
+ *
+ * At most `Options::in_flight` chunks exist at any time, whether being
+ * read, parsed, queued or applied, so memory use does not depend on the
+ * size of the input.
+ *
+ * A Format parses records of one encoding:
+ *
+ *   // Length of the longest prefix of [data, data + n) made of whole records.
+ *   std::size_t complete(const char *data, std::size_t n) const;
+ *   // Appends updates parsed from whole records in [data, data + n).
+ *   void parse(const char *data, std::size_t n,
+ *              std::vector<std::pair<A, V>> &out) const;
+ *
+ * `parse` may be called concurrently and throws InvalidFormat on bad input.
+ */
+
+// Text records "arg,value" separated by newlines, for arithmetic A and V.
+// Blank lines are skipped, spaces and '\r' around fields are ignored.
+template<typename A, typename V>
+class CsvFormat {
+    static_assert(std::is_arithmetic_v<A> && std::is_arithmetic_v<V>,
+                  "CsvFormat parses arithmetic types only");
+
+public:
+    std::size_t complete(const char *data, std::size_t n) const {
+        std::size_t end = n;
+        while (end > 0 && data[end - 1] != '\n')
+            end--;
+        return end;
+    }
+
+    void parse(const char *data, std::size_t n,
+               std::vector<std::pair<A, V>> &out) const {
+        const char *p = data, *end = data + n;
+        while (p < end) {
+            const char *eol = std::find(p, end, '\n');
+            const char *comma = std::find(p, eol, ',');
+            if (!blank(p, eol)) {
+                if (comma == eol)
+                    throw InvalidFormat();
+                out.emplace_back(field<A>(p, comma), field<V>(comma + 1, eol));
+            }
+            p = eol + (eol < end);
+        }
+    }
+
+private:
+    static bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    static bool blank(const char *from, const char *to) {
+        return std::all_of(from, to, is_space);
+    }
+
+    template<typename T>
+    static T field(const char *from, const char *to) {
+        while (from < to && is_space(*from))
+            from++;
+        while (to > from && is_space(to[-1]))
+            to--;
+        T x{};
+        auto [ptr, ec] = std::from_chars(from, to, x);
+        if (ec != std::errc() || ptr != to)
+            throw InvalidFormat();
+        return x;
+    }
+};
+
+// Fixed-size records: A then V, each encoded as by MaximaCodec for
+// arithmetic types (little-endian, native width).
+template<typename A, typename V>
+class BinaryFormat {
+    static_assert((std::is_arithmetic_v<A> || std::is_enum_v<A>) &&
+                  (std::is_arithmetic_v<V> || std::is_enum_v<V>),
+                  "BinaryFormat decodes arithmetic types only");
+
+public:
+    static constexpr std::size_t record_size = sizeof(A) + sizeof(V);
+
+    std::size_t complete(const char *, std::size_t n) const {
+        return n - n % record_size;
+    }
+
+    void parse(const char *data, std::size_t n,
+               std::vector<std::pair<A, V>> &out) const {
+        if (n % record_size != 0)
+            throw InvalidFormat();
+        out.reserve(out.size() + n / record_size);
+        for (const char *p = data; p < data + n; p += record_size)
+            out.emplace_back(decode<A>(p), decode<V>(p + sizeof(A)));
+    }
+
+private:
+    template<typename T>
+    static T decode(const char *p) {
+        using bits = maxima_io::bits_t<T>;
+        bits b = 0;
+        for (std::size_t i = 0; i < sizeof(T); i++)
+            b = static_cast<bits>(
+                    b | static_cast<bits>(static_cast<unsigned char>(p[i]))
+                            << (8 * i));
+        T x;
+        std::memcpy(&x, &b, sizeof(T));
+        return x;
+    }
+};
+
+// Counters of a finished or running ingestion.
+struct IngestStats {
+    std::uint64_t bytes = 0;
+    std::uint64_t records = 0;
+    std::uint64_t batches = 0;
+    double seconds = 0;
+
+    double records_per_second() const {
+        return seconds > 0 ? static_cast<double>(records) / seconds : 0;
+    }
+
+    double bytes_per_second() const {
+        return seconds > 0 ? static_cast<double>(bytes) / seconds : 0;
+    }
+};
+
+struct IngestOptions {
+    // Bytes read from the stream per chunk. A record must fit in a chunk.
+    std::size_t chunk_size = 1 << 20;
+    // Number of parsing threads.
+    std::size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    // Maximum number of chunks alive at once.
+    std::size_t in_flight = 16;
+};
+
+template<typename A, typename V, typename Format = CsvFormat<A, V>>
+class MaximaIngestor {
+public:
+    using Options = IngestOptions;
+
+    explicit MaximaIngestor(FunctionMaxima<A, V> &into,
+                            Format parser = Format(),
+                            Options limits = Options())
+            : target(into), format(std::move(parser)), options(limits) {}
+
+    // Reads `in` to the end and applies all updates to the target, which
+    // must not be used by other threads meanwhile. If any stage throws,
+    // the exception of the earliest failing chunk is rethrown after all
+    // chunks before it are applied.
+    IngestStats run(std::istream &in);
+
+    // Counters so far, safe to call from another thread during run().
+    IngestStats stats() const;
+
+private:
+    using Batch = std::vector<std::pair<A, V>>;
+
+    struct Chunk {
+        std::uint64_t seq;
+        std::vector<char> bytes;
+    };
+
+    // Queue closed for good once `close()` is called.
+    template<typename T>
+    class Channel {
+    public:
+        void push(T item) {
+            std::lock_guard<std::mutex> lock(mutex);
+            items.push_back(std::move(item));
+            ready.notify_one();
+        }
+
+        std::optional<T> pop() {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this] { return closed || !items.empty(); });
+            if (items.empty())
+                return std::nullopt;
+            T item = std::move(items.front());
+            items.pop_front();
+            return item;
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            ready.notify_all();
+        }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<T> items;
+        bool closed = false;
+    };
+
+    void parse_loop();
+
+    void apply_loop();
+
+    // Blocks until fewer than `options.in_flight` chunks are alive.
+    // Returns false if the pipeline failed meanwhile.
+    bool acquire_slot();
+
+    void release_slot();
+
+    // Records failure of the chunk `seq`, nothing from it on is applied.
+    void fail(std::exception_ptr, std::uint64_t seq);
+
+    FunctionMaxima<A, V> &target;
+    Format format;
+    Options options;
+
+    Channel<Chunk> chunks;
+    Channel<std::pair<std::uint64_t, Batch>> parsed;
+
+    std::mutex slots_mutex;
+    std::condition_variable slots_freed;
+    std::size_t alive = 0;
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    std::atomic<bool> failed{false};
+    std::atomic<std::uint64_t> stop_at{UINT64_MAX};
+
+    std::atomic<std::uint64_t> bytes{0};
+    std::atomic<std::uint64_t> records{0};
+    std::atomic<std::uint64_t> batches{0};
+    std::atomic<std::chrono::steady_clock::rep> started{0};
+    std::atomic<double> finished{-1};
+};
+
+template<typename A, typename V, typename Format>
+IngestStats MaximaIngestor<A, V, Format>::run(std::istream &in) {
+    started = std::chrono::steady_clock::now().time_since_epoch().count();
+
+    std::vector<std::thread> workers;
+    std::thread applier;
+    std::uint64_t seq = 0;
+    try {
+        for (std::size_t i = 0; i < std::max<std::size_t>(1, options.workers); i++)
+            workers.emplace_back([this] { parse_loop(); });
+        applier = std::thread([this] { apply_loop(); });
+
+        std::vector<char> carry;
+        bool eof = false;
+        while (!eof && acquire_slot()) {
+            std::vector<char> buffer(std::move(carry));
+            std::size_t have = buffer.size();
+            buffer.resize(std::max(options.chunk_size, have + 1));
+            in.read(buffer.data() + have,
+                    static_cast<std::streamsize>(buffer.size() - have));
+            auto got = static_cast<std::size_t>(in.gcount());
+            bytes += got;
+            have += got;
+            eof = !in;
+            buffer.resize(have);
+
+            // The tail of the last chunk goes to the parser as is,
+            // otherwise it waits for the rest of its record.
+            std::size_t whole = eof ? have : format.complete(buffer.data(), have);
+            if (!eof && whole == 0)
+                throw InvalidFormat();
+            carry.assign(buffer.begin() + static_cast<std::ptrdiff_t>(whole),
+                         buffer.end());
+            buffer.resize(whole);
+            chunks.push(Chunk{seq++, std::move(buffer)});
+        }
+    } catch (...) {
+        fail(std::current_exception(), seq);
+    }
+
+    chunks.close();
+    for (auto &worker : workers)
+        worker.join();
+    parsed.close();
+    if (applier.joinable())
+        applier.join();
+
+    finished = stats().seconds;
+    if (error)
+        std::rethrow_exception(error);
+    return stats();
+}
+
+template<typename A, typename V, typename Format>
+IngestStats MaximaIngestor<A, V, Format>::stats() const {
+    IngestStats s;
+    s.bytes = bytes;
+    s.records = records;
+    s.batches = batches;
+    s.seconds = finished;
+    if (s.seconds < 0) {
+        auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+        s.seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::duration(now - started)).count();
+    }
+    return s;
+}
+
+template<typename A, typename V, typename Format>
+void MaximaIngestor<A, V, Format>::parse_loop() {
+    while (auto chunk = chunks.pop()) {
+        Batch batch;
+        try {
+            if (chunk->seq < stop_at)
+                format.parse(chunk->bytes.data(), chunk->bytes.size(), batch);
+        } catch (...) {
+            fail(std::current_exception(), chunk->seq);
+        }
+        parsed.push({chunk->seq, std::move(batch)});
+    }
+}
+
+template<typename A, typename V, typename Format>
+void MaximaIngestor<A, V, Format>::apply_loop() {
+    // Batches come out of order from parallel parsers and are held here
+    // until all earlier ones are applied; alive slots bound its size.
+    std::map<std::uint64_t, Batch> pending;
+    std::uint64_t next = 0;
+    while (auto item = parsed.pop()) {
+        pending.emplace(item->first, std::move(item->second));
+        for (auto it = pending.begin();
+             it != pending.end() && it->first == next;
+             it = pending.erase(it), next++) {
+            try {
+                if (it->first < stop_at) {
+                    target.set_values(it->second.begin(), it->second.end());
+                    records += it->second.size();
+                    batches++;
+                }
+            } catch (...) {
+                fail(std::current_exception(), it->first);
+            }
+            release_slot();
+        }
+    }
+}
+
+template<typename A, typename V, typename Format>
+bool MaximaIngestor<A, V, Format>::acquire_slot() {
+    std::unique_lock<std::mutex> lock(slots_mutex);
+    slots_freed.wait(lock, [this] {
+        return failed || alive < std::max<std::size_t>(1, options.in_flight);
+    });
+    if (failed)
+        return false;
+    alive++;
+    return true;
+}
+
+template<typename A, typename V, typename Format>
+void MaximaIngestor<A, V, Format>::release_slot() {
+    std::lock_guard<std::mutex> lock(slots_mutex);
+    alive--;
+    slots_freed.notify_one();
+}
+
+template<typename A, typename V, typename Format>
+void MaximaIngestor<A, V, Format>::fail(std::exception_ptr e,
+                                        std::uint64_t seq) {
+    {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (seq < stop_at || !error) {
+            error = e;
+            stop_at = std::min<std::uint64_t>(stop_at, seq);
+        }
+    }
+    std::lock_guard<std::mutex> lock(slots_mutex);
+    failed = true;
+    slots_freed.notify_all();
+}
+
+#endif /* MAXIMA_INGEST_H */
@@ -0,0 +1,523 @@
+#ifndef ORDER_STATISTICS_TREE_H
+#define ORDER_STATISTICS_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+
+/*
+ * Ordered multiset whose nodes know the sizes of their subtrees, so that
+ * the i-th element and the rank of an element are found in O(log n).
+ * It is a treap with parent links: expected depth O(log n), iterators
+ * stay valid until their element is erased.
+ *
+ * Only what FunctionMaxima needs of std::multiset is provided. insert
+ * gives the strong guarantee: all comparisons are made before the node
+ * is allocated. Equal elements are kept in the order of insertion.
+ *
+ * Nodes are allocated with Allocator rebound to the node type. As with the
+ * standard containers, copies take the allocator given by
+ * select_on_container_copy_construction, and nodes move only between trees
+ * with equal allocators.
+ */
+template<typename T, typename Compare, typename Allocator = std::allocator<T>>
+class OrderStatisticsTree {
+private:
+    struct Node;
+
+    using node_allocator = typename std::allocator_traits<
+            Allocator>::template rebind_alloc<Node>;
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+
+    // Elements are constant, as in std::multiset.
+    class iterator;
+
+    using const_iterator = iterator;
+
+    // Element owned outside of any tree, see extract.
+    class node_type;
+
+    OrderStatisticsTree() = default;
+
+    explicit OrderStatisticsTree(const Allocator &allocator)
+            : alloc(allocator) {}
+
+    OrderStatisticsTree(const OrderStatisticsTree &other)
+            : OrderStatisticsTree(other, std::allocator_traits<node_allocator>::
+                    select_on_container_copy_construction(other.alloc)) {}
+
+    OrderStatisticsTree(const OrderStatisticsTree &other,
+                        const Allocator &allocator)
+            : alloc(allocator), root(clone(other.root, nullptr)),
+              less(other.less), seed(other.seed) {}
+
+    // Takes the allocator of `other` along with its elements.
+    OrderStatisticsTree &operator=(OrderStatisticsTree other) noexcept {
+        std::swap(alloc, other.alloc);
+        std::swap(root, other.root);
+        std::swap(less, other.less);
+        std::swap(seed, other.seed);
+        return *this;
+    }
+
+    ~OrderStatisticsTree() { destroy(root); }
+
+    iterator begin() const noexcept { return iterator(leftmost(root), this); }
+
+    iterator end() const noexcept { return iterator(nullptr, this); }
+
+    size_type size() const noexcept { return size_of(root); }
+
+    bool empty() const noexcept { return root == nullptr; }
+
+    // Bytes allocated per element.
+    static constexpr size_type node_size() noexcept { return sizeof(Node); }
+
+    // Inserts after all elements equal to `value`.
+    iterator insert(const T &value);
+
+    // Appends `value`, which must not be less than any element,
+    // without comparing anything.
+    iterator push_back(const T &value) { return link(rightmost(root), false, value); }
+
+    void erase(const iterator &it) noexcept;
+
+    // Unlinks the element, keeping its allocation.
+    node_type extract(const iterator &it) noexcept;
+
+    // Links an extracted element in as insert(value) would, allocating
+    // nothing. The node is kept if a comparison throws. Its allocator must
+    // equal this tree's.
+    iterator insert(node_type &&node);
+
+    // The i-th element counting from zero, end() if there are not that many.
+    iterator find_by_order(size_type i) const noexcept;
+
+    // Number of elements before `it`, size() for end(). Makes no comparisons.
+    size_type rank(const iterator &it) const noexcept;
+
+    // Number of leading elements satisfying `pred`, which must hold
+    // for a prefix of the order.
+    template<typename Predicate>
+    size_type prefix_length(Predicate pred) const;
+
+    // The first element not satisfying `pred`, which must hold
+    // for a prefix of the order.
+    template<typename Predicate>
+    iterator partition_point(Predicate pred) const;
+
+private:
+    static size_type size_of(const Node *node) noexcept {
+        return node ? node->size : 0;
+    }
+
+    static Node *leftmost(Node *node) noexcept {
+        while (node && node->left)
+            node = node->left;
+        return node;
+    }
+
+    static Node *rightmost(Node *node) noexcept {
+        while (node && node->right)
+            node = node->right;
+        return node;
+    }
+
+    Node *make_node(const T &value);
+
+    void free_node(Node *node) noexcept;
+
+    // Copies the subtree, freeing what was copied if a copy throws.
+    Node *clone(const Node *node, Node *parent);
+
+    void destroy(Node *node) noexcept;
+
+    // Adds a leaf holding `value` under `parent` and restores the heap.
+    iterator link(Node *parent, bool as_left, const T &value);
+
+    // Adds `node` as a leaf under `parent` and restores the heap.
+    iterator attach(Node *parent, bool as_left, Node *node) noexcept;
+
+    // Where insert puts an element equal to `value`.
+    std::pair<Node *, bool> insert_position(const T &value) const;
+
+    // Unlinks `node` from the tree, keeping it allocated.
+    void unlink(Node *node) noexcept;
+
+    // Next pseudo-random priority, xorshift32.
+    std::uint32_t next_priority() noexcept;
+
+    // Puts `child` where `old` was under `parent`, or at the root.
+    void replace_child(Node *parent, Node *old, Node *child) noexcept;
+
+    // Rotates `node` above its parent, keeping subtree sizes.
+    void rotate_up(Node *node) noexcept;
+
+    node_allocator alloc;
+    Node *root = nullptr;
+    Compare less;
+    std::uint32_t seed = 2463534242u;
+};
+
+template<typename T, typename Compare, typename Allocator>
+struct OrderStatisticsTree<T, Compare, Allocator>::Node {
+    T value;
+    Node *left = nullptr;
+    Node *right = nullptr;
+    Node *parent = nullptr;
+    size_type size = 1;
+    // The tree is a max-heap of priorities.
+    std::uint32_t priority = 0;
+
+    explicit Node(const T &v) : value(v) {}
+};
+
+template<typename T, typename Compare, typename Allocator>
+class OrderStatisticsTree<T, Compare, Allocator>::iterator {
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T *;
+    using reference = const T &;
+
+    iterator() = default;
+
+    reference operator*() const noexcept { return node->value; }
+
+    pointer operator->() const noexcept { return &node->value; }
+
+    iterator &operator++() noexcept {
+        if (node->right) {
+            node = leftmost(node->right);
+        } else {
+            while (node->parent && node == node->parent->right)
+                node = node->parent;
+            node = node->parent;
+        }
+        return *this;
+    }
+
+    iterator operator++(int) noexcept {
+        iterator old = *this;
+        ++*this;
+        return old;
+    }
+
+    // Decrementing end() gives the last element.
+    iterator &operator--() noexcept {
+        if (!node) {
+            node = rightmost(tree->root);
+        } else if (node->left) {
+            node = rightmost(node->left);
+        } else {
+            while (node->parent && node == node->parent->left)
+                node = node->parent;
+            node = node->parent;
+        }
+        return *this;
+    }
+
+    iterator operator--(int) noexcept {
+        iterator old = *this;
+        --*this;
+        return old;
+    }
+
+    bool operator==(const iterator &other) const noexcept {
+        return node == other.node;
+    }
+
+    bool operator!=(const iterator &other) const noexcept {
+        return node != other.node;
+    }
+
+private:
+    iterator(Node *at, const OrderStatisticsTree *owner) noexcept
+            : node(at), tree(owner) {}
+
+    Node *node = nullptr;
+    const OrderStatisticsTree *tree = nullptr;
+
+    friend class OrderStatisticsTree;
+};
+
+template<typename T, typename Compare, typename Allocator>
+class OrderStatisticsTree<T, Compare, Allocator>::node_type {
+public:
+    node_type() = default;
+
+    node_type(node_type &&other) noexcept
+            : node(other.node), alloc(other.alloc) {
+        other.node = nullptr;
+    }
+
+    node_type &operator=(node_type &&other) noexcept {
+        std::swap(node, other.node);
+        std::swap(alloc, other.alloc);
+        return *this;
+    }
+
+    ~node_type() {
+        if (node) {
+            node->~Node();
+            alloc.deallocate(node, 1);
+        }
+    }
+
+    bool empty() const noexcept { return node == nullptr; }
+
+    // The element may be changed while it is outside of a tree.
+    T &value() const noexcept { return node->value; }
+
+private:
+    node_type(Node *owned, const node_allocator &allocator) noexcept
+            : node(owned), alloc(allocator) {}
+
+    Node *node = nullptr;
+    node_allocator alloc;
+
+    friend class OrderStatisticsTree;
+};
+
+template<typename T, typename Compare, typename Allocator>
+auto OrderStatisticsTree<T, Compare, Allocator>::insert(const T &value) -> iterator {
+    auto [parent, as_left] = insert_position(value);
+    return link(parent, as_left, value);
+}
+
+template<typename T, typename Compare, typename Allocator>
+auto OrderStatisticsTree<T, Compare, Allocator>::insert(node_type &&node) -> iterator {
+    auto [parent, as_left] = insert_position(node.value());
+    Node *linked = node.node;
+    node.node = nullptr;
+    return attach(parent, as_left, linked);
+}
+
+template<typename T, typename Compare, typename Allocator>
+auto OrderStatisticsTree<T, Compare, Allocator>::insert_position(const T &value) const
+-> std::pair<Node *, bool> {
+    Node *parent = nullptr;
+    bool as_left = false;
+    for (Node *node = root; node;) {
+        parent = node;
+        as_left = less(value, node->value);
+        node = as_left ? node->left : node->right;
+    }
+    return {parent, as_left};
+}
+
+template<typename T, typename Compare, typename Allocator>
+auto OrderStatisticsTree<T, Compare, Allocator>::link(Node *parent, bool as_left,
+                                           const T &value) -> iterator {
+    // Only the allocation may throw, before anything is changed.
+    Node *node = make_node(value);
+    node->priority = next_priority();
+    return attach(parent, as_left, node);
+}
+
+template<typename T, typename Compare, typename Allocator>
+auto OrderStatisticsTree<T, Compare, Allocator>::attach(Node *parent, bool as_left,
+                                             Node *node) noexcept -> iterator {
+    node->parent = parent;
+    if (!parent)
+        root = node;
+    else if (as_left)
+        parent->left = node;
+    else
+        parent->right = node;
+    for (Node *up = parent; up; up = up->parent)
+        up->size++;
+
+    while (node->parent && node->parent->priority < node->priority)
+        rotate_up(node);
+    return iterator(node, this);
+}
+
+template<typename T, typename Compare, typename Allocator>
+void OrderStatisticsTree<T, Compare, Allocator>::erase(const iterator &it) noexcept {
+    unlink(it.node);
+    free_node(it.node);
+}
+
+template<typename T, typename Compare, typename Allocator>
+auto OrderStatisticsTree<T, Compare, Allocator>::extract(const iterator &it) noexcept
+-> node_type {
+    unlink(it.node);
+    // Keeps the priority, which is as random in any tree.
+    it.node->left = it.node->right = it.node->parent = nullptr;
+    it.node->size = 1;
+    return node_type(it.node, alloc);
+}
+
+template<typename T, typename Compare, typename Allocator>
+void OrderStatisticsTree<T, Compare, Allocator>::unlink(Node *node) noexcept {
+    while (node->left && node->right)
+        rotate_up(node->left->priority > node->right->priority ? node->left
+                                                               : node->right);
+
+    Node *child = node->left ? node->left : node->right;
+    if (child)
+        child->parent = node->parent;
+    replace_child(node->parent, node, child);
+    for (Node *up = node->parent; up; up = up->parent)
+        up->size--;
+}
+
+template<typename T, typename Compare, typename Allocator>
+auto OrderStatisticsTree<T, Compare, Allocator>::find_by_order(size_type i) const noexcept
+-> iterator {
+    Node *node = root;
+    while (node) {
+        size_type left = size_of(node->left);
+        if (i < left) {
+            node = node->left;
+        } else if (i == left) {
+            break;
+        } else {
+            i -= left + 1;
+            node = node->right;
+        }
+    }
+    return iterator(node, this);
+}
+
+template<typename T, typename Compare, typename Allocator>
+auto OrderStatisticsTree<T, Compare, Allocator>::rank(const iterator &it) const noexcept
+-> size_type {
+    if (!it.node)
+        return size();
+    size_type result = size_of(it.node->left);
+    for (Node *node = it.node; node->parent; node = node->parent) {
+        if (node == node->parent->right)
+            result += size_of(node->parent->left) + 1;
+    }
+    return result;
+}
+
+template<typename T, typename Compare, typename Allocator>
+template<typename Predicate>
+auto OrderStatisticsTree<T, Compare, Allocator>::prefix_length(Predicate pred) const
+-> size_type {
+    size_type result = 0;
+    for (Node *node = root; node;) {
+        if (pred(node->value)) {
+            result += size_of(node->left) + 1;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return result;
+}
+
+template<typename T, typename Compare, typename Allocator>
+template<typename Predicate>
+auto OrderStatisticsTree<T, Compare, Allocator>::partition_point(Predicate pred) const
+-> iterator {
+    Node *result = nullptr;
+    for (Node *node = root; node;) {
+        if (pred(node->value)) {
+            node = node->right;
+        } else {
+            result = node;
+            node = node->left;
+        }
+    }
+    return iterator(result, this);
+}
+
+template<typename T, typename Compare, typename Allocator>
+auto OrderStatisticsTree<T, Compare, Allocator>::clone(const Node *node, Node *parent)
+-> Node * {
+    if (!node)
+        return nullptr;
+    Node *copy = make_node(node->value);
+    copy->parent = parent;
+    copy->size = node->size;
+    copy->priority = node->priority;
+    try {
+        copy->left = clone(node->left, copy);
+        copy->right = clone(node->right, copy);
+    } catch (...) {
+        destroy(copy);
+        throw;
+    }
+    return copy;
+}
+
+template<typename T, typename Compare, typename Allocator>
+void OrderStatisticsTree<T, Compare, Allocator>::destroy(Node *node) noexcept {
+    if (!node)
+        return;
+    destroy(node->left);
+    destroy(node->right);
+    free_node(node);
+}
+
+template<typename T, typename Compare, typename Allocator>
+auto OrderStatisticsTree<T, Compare, Allocator>::make_node(const T &value)
+-> Node * {
+    Node *node = alloc.allocate(1);
+    try {
+        return ::new(static_cast<void *>(node)) Node(value);
+    } catch (...) {
+        alloc.deallocate(node, 1);
+        throw;
+    }
+}
+
+template<typename T, typename Compare, typename Allocator>
+void OrderStatisticsTree<T, Compare, Allocator>::free_node(Node *node) noexcept {
+    node->~Node();
+    alloc.deallocate(node, 1);
+}
+
+template<typename T, typename Compare, typename Allocator>
+std::uint32_t OrderStatisticsTree<T, Compare, Allocator>::next_priority() noexcept {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+template<typename T, typename Compare, typename Allocator>
+void OrderStatisticsTree<T, Compare, Allocator>::replace_child(Node *parent, Node *old,
+                                                    Node *child) noexcept {
+    if (!parent)
+        root = child;
+    else if (parent->left == old)
+        parent->left = child;
+    else
+        parent->right = child;
+}
+
+template<typename T, typename Compare, typename Allocator>
+void OrderStatisticsTree<T, Compare, Allocator>::rotate_up(Node *node) noexcept {
+    Node *parent = node->parent;
+    if (node == parent->left) {
+        parent->left = node->right;
+        if (node->right)
+            node->right->parent = parent;
+        node->right = parent;
+    } else {
+        parent->right = node->left;
+        if (node->left)
+            node->left->parent = parent;
+        node->left = parent;
+    }
+    node->parent = parent->parent;
+    replace_child(parent->parent, parent, node);
+    parent->parent = node;
+
+    node->size = parent->size;
+    parent->size = 1 + size_of(parent->left) + size_of(parent->right);
+}
+
+#endif /* ORDER_STATISTICS_TREE_H */
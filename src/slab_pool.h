@@ -0,0 +1,408 @@
+#ifndef SLAB_POOL_H
+#define SLAB_POOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Free-list allocator of small fixed-size blocks, carved from slabs of
+ * about slab_bytes. Blocks of each size (rounded up to the fundamental
+ * alignment) have their own free list; freed blocks go back to it and are
+ * handed out again without calling operator new. A new slab is allocated
+ * only when a free list runs dry, and all its blocks are put on the free
+ * list at once, so the memory is touched then rather than on later
+ * allocations.
+ *
+ * reserve(n) makes room for n blocks of every size, including sizes first
+ * requested later; reserve_class(size) makes that room for a size before
+ * its first block is requested. shrink_to_fit() frees the slabs with no
+ * allocated blocks, sorting the slabs and walking the free lists, without
+ * allocating.
+ *
+ * Pools are made by create() and owned through std::shared_ptr, but
+ * allocators only point to theirs: node handles of the standard containers
+ * may keep a copy of the allocator past the insertion of their node, which
+ * would keep a counted pool alive for ever. The pool is freed once its last
+ * owner is gone and the last block has been deallocated, so payloads and
+ * extracted nodes may outlive the containers that made them. Calls are
+ * serialized by a Mutex, which may be a no-op lock when all the users are
+ * on one thread.
+ */
+template<typename Mutex>
+class SlabPool {
+public:
+    static std::shared_ptr<SlabPool> create();
+
+    SlabPool(const SlabPool &) = delete;
+
+    SlabPool &operator=(const SlabPool &) = delete;
+
+    void *allocate(std::size_t size);
+
+    // `size` must be the one the block was allocated with.
+    void deallocate(void *block, std::size_t size) noexcept;
+
+    // Makes room for `n` blocks of each size, until shrink_to_fit().
+    void reserve(std::size_t n);
+
+    // Makes the room of reserve() for blocks of `size` bytes now.
+    void reserve_class(std::size_t size);
+
+    // Frees the slabs none of whose blocks is allocated.
+    void shrink_to_fit() noexcept;
+
+    // Bytes of free blocks.
+    std::size_t unused() const noexcept;
+
+private:
+    SlabPool() = default;
+
+    ~SlabPool();
+
+    // Called when the last owner is gone.
+    void release() noexcept;
+
+    static constexpr std::size_t slab_bytes = 64 * 1024;
+    static constexpr std::size_t alignment = alignof(std::max_align_t);
+
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    struct Slab {
+        char *base;
+        // Free blocks in the slab, counted by shrink_to_fit().
+        std::size_t free;
+    };
+
+    // Blocks of one size.
+    struct SizeClass {
+        std::size_t size;
+        std::size_t blocks_per_slab;
+        FreeBlock *free_list = nullptr;
+        std::size_t free = 0;
+        std::vector<Slab> slabs;
+    };
+
+    static std::size_t rounded(std::size_t size) noexcept {
+        return (std::max(size, sizeof(FreeBlock)) + alignment - 1) /
+               alignment * alignment;
+    }
+
+    // The class of blocks of `size` bytes, created if there is none.
+    SizeClass &size_class(std::size_t size);
+
+    // Adds slabs until the class holds `n` blocks.
+    static void grow(SizeClass &sizes, std::size_t n);
+
+    std::vector<SizeClass> classes;
+    std::size_t reserved = 0;
+    // Blocks handed out and not deallocated yet.
+    std::size_t allocated = 0;
+    bool owned = true;
+    mutable Mutex mutex;
+};
+
+/*
+ * Allocator taking single objects from a SlabPool, and from std::allocator
+ * without one. Allocators compare equal when they share the pool, so nodes
+ * move between containers only within a pool.
+ *
+ * Copies of a container do not take its pool: pools are dedicated to the
+ * container that created them.
+ */
+template<typename T, typename Mutex>
+class SlabAllocator {
+public:
+    using value_type = T;
+    using pool_type = SlabPool<Mutex>;
+    // Moving an empty container into another one hands it the pool.
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    SlabAllocator() noexcept = default;
+
+    // The pool, if any, must have an owner.
+    explicit SlabAllocator(pool_type *pool) noexcept : slabs(pool) {}
+
+    template<typename U>
+    SlabAllocator(const SlabAllocator<U, Mutex> &other) noexcept
+            : slabs(other.slabs) {}
+
+    T *allocate(std::size_t n) {
+        if (!pooled(n))
+            return std::allocator<T>().allocate(n);
+        return static_cast<T *>(slabs->allocate(sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        if (!pooled(n))
+            std::allocator<T>().deallocate(p, n);
+        else
+            slabs->deallocate(p, sizeof(T));
+    }
+
+    SlabAllocator select_on_container_copy_construction() const noexcept {
+        return SlabAllocator();
+    }
+
+    pool_type *pool() const noexcept { return slabs; }
+
+    template<typename U>
+    bool operator==(const SlabAllocator<U, Mutex> &other) const noexcept {
+        return slabs == other.slabs;
+    }
+
+    template<typename U>
+    bool operator!=(const SlabAllocator<U, Mutex> &other) const noexcept {
+        return slabs != other.slabs;
+    }
+
+private:
+    template<typename, typename>
+    friend class SlabAllocator;
+
+    bool pooled(std::size_t n) const noexcept {
+        return slabs && n == 1 && alignof(T) <= alignof(std::max_align_t);
+    }
+
+    pool_type *slabs = nullptr;
+};
+
+// Thrown by BlockSizeProbe once it has recorded a block size.
+struct BlockMeasured {};
+
+/*
+ * Allocator measuring the nodes of standard containers and the control
+ * blocks of std::allocate_shared, whose layout is left to the
+ * implementation. Its first allocation records the size of the requested
+ * block and throws BlockMeasured, so nothing is allocated or constructed.
+ */
+template<typename T>
+class BlockSizeProbe {
+public:
+    using value_type = T;
+
+    explicit BlockSizeProbe(std::size_t *block_size) noexcept
+            : size(block_size) {}
+
+    template<typename U>
+    BlockSizeProbe(const BlockSizeProbe<U> &other) noexcept
+            : size(other.size) {}
+
+    T *allocate(std::size_t) {
+        *size = sizeof(T);
+        throw BlockMeasured();
+    }
+
+    void deallocate(T *, std::size_t) noexcept {}
+
+    template<typename U>
+    bool operator==(const BlockSizeProbe<U> &other) const noexcept {
+        return size == other.size;
+    }
+
+    template<typename U>
+    bool operator!=(const BlockSizeProbe<U> &other) const noexcept {
+        return size != other.size;
+    }
+
+private:
+    template<typename>
+    friend class BlockSizeProbe;
+
+    std::size_t *size;
+};
+
+// Bytes of the first block `request` asks of the BlockSizeProbe<T> it is
+// given, 0 if it asks for none.
+template<typename T, typename Request>
+std::size_t measure_block(Request request) noexcept {
+    std::size_t size = 0;
+    try {
+        request(BlockSizeProbe<T>(&size));
+    } catch (const BlockMeasured &) {
+    }
+    return size;
+}
+
+// Takes the place of a T in a block measured with BlockSizeProbe, so that
+// no T has to be made: blocks depend only on the size and alignment of
+// their elements.
+template<typename T>
+struct alignas(T) BlockStandIn {
+    unsigned char bytes[sizeof(T)];
+};
+
+/*
+ * SlabPool definitions.
+ */
+template<typename Mutex>
+std::shared_ptr<SlabPool<Mutex>> SlabPool<Mutex>::create() {
+    return std::shared_ptr<SlabPool>(new SlabPool(),
+                                     [](SlabPool *pool) { pool->release(); });
+}
+
+template<typename Mutex>
+SlabPool<Mutex>::~SlabPool() {
+    for (SizeClass &sizes : classes) {
+        for (Slab &slab : sizes.slabs)
+            ::operator delete(slab.base);
+    }
+}
+
+template<typename Mutex>
+void *SlabPool<Mutex>::allocate(std::size_t size) {
+    std::lock_guard<Mutex> lock(mutex);
+    SizeClass &sizes = size_class(size);
+    if (!sizes.free_list)
+        grow(sizes, sizes.slabs.size() * sizes.blocks_per_slab + 1);
+    FreeBlock *block = sizes.free_list;
+    sizes.free_list = block->next;
+    sizes.free--;
+    allocated++;
+    return block;
+}
+
+template<typename Mutex>
+void SlabPool<Mutex>::deallocate(void *block, std::size_t size) noexcept {
+    bool last;
+    {
+        std::lock_guard<Mutex> lock(mutex);
+        size = rounded(size);
+        for (SizeClass &sizes : classes) {
+            if (sizes.size == size) {
+                sizes.free_list = ::new(block) FreeBlock{sizes.free_list};
+                sizes.free++;
+                break;
+            }
+        }
+        last = --allocated == 0 && !owned;
+    }
+    if (last)
+        delete this;
+}
+
+template<typename Mutex>
+void SlabPool<Mutex>::release() noexcept {
+    bool last;
+    {
+        std::lock_guard<Mutex> lock(mutex);
+        owned = false;
+        last = allocated == 0;
+    }
+    if (last)
+        delete this;
+}
+
+template<typename Mutex>
+void SlabPool<Mutex>::reserve(std::size_t n) {
+    std::lock_guard<Mutex> lock(mutex);
+    reserved = std::max(reserved, n);
+    for (SizeClass &sizes : classes)
+        grow(sizes, reserved);
+}
+
+template<typename Mutex>
+void SlabPool<Mutex>::reserve_class(std::size_t size) {
+    std::lock_guard<Mutex> lock(mutex);
+    // A new class is grown to the reserved size.
+    size_class(size);
+}
+
+template<typename Mutex>
+void SlabPool<Mutex>::shrink_to_fit() noexcept {
+    std::lock_guard<Mutex> lock(mutex);
+    reserved = 0;
+    for (SizeClass &sizes : classes) {
+        std::vector<Slab> &slabs = sizes.slabs;
+        // std::less orders pointers into different slabs.
+        std::less<const char *> before;
+        std::sort(slabs.begin(), slabs.end(), [before](const Slab &a, const Slab &b) {
+            return before(a.base, b.base);
+        });
+        // The slab holding a block is the last one starting at or before it.
+        auto slab_of = [&slabs, before](const FreeBlock *block) -> Slab & {
+            const char *p = reinterpret_cast<const char *>(block);
+            return *std::prev(std::partition_point(
+                    slabs.begin(), slabs.end(),
+                    [&](const Slab &slab) { return !before(p, slab.base); }));
+        };
+
+        for (Slab &slab : slabs)
+            slab.free = 0;
+        for (FreeBlock *block = sizes.free_list; block; block = block->next)
+            slab_of(block).free++;
+
+        // Blocks of the slabs to be freed leave the free list first.
+        FreeBlock **link = &sizes.free_list;
+        while (*link) {
+            if (slab_of(*link).free == sizes.blocks_per_slab) {
+                *link = (*link)->next;
+                sizes.free--;
+            } else {
+                link = &(*link)->next;
+            }
+        }
+        auto unused = [&sizes](const Slab &slab) {
+            if (slab.free != sizes.blocks_per_slab)
+                return false;
+            ::operator delete(slab.base);
+            return true;
+        };
+        slabs.erase(std::remove_if(slabs.begin(), slabs.end(), unused),
+                    slabs.end());
+    }
+}
+
+template<typename Mutex>
+std::size_t SlabPool<Mutex>::unused() const noexcept {
+    std::lock_guard<Mutex> lock(mutex);
+    std::size_t bytes = 0;
+    for (const SizeClass &sizes : classes)
+        bytes += sizes.free * sizes.size;
+    return bytes;
+}
+
+template<typename Mutex>
+auto SlabPool<Mutex>::size_class(std::size_t size) -> SizeClass & {
+    size = rounded(size);
+    for (SizeClass &sizes : classes) {
+        if (sizes.size == size)
+            return sizes;
+    }
+    SizeClass sizes;
+    sizes.size = size;
+    sizes.blocks_per_slab = std::max<std::size_t>(1, slab_bytes / size);
+    classes.push_back(std::move(sizes));
+    grow(classes.back(), reserved);
+    return classes.back();
+}
+
+template<typename Mutex>
+void SlabPool<Mutex>::grow(SizeClass &sizes, std::size_t n) {
+    while (sizes.slabs.size() * sizes.blocks_per_slab < n) {
+        char *base = static_cast<char *>(
+                ::operator new(sizes.blocks_per_slab * sizes.size));
+        try {
+            sizes.slabs.push_back(Slab{base, 0});
+        } catch (...) {
+            ::operator delete(base);
+            throw;
+        }
+        // Pushed from the end, so that blocks are handed out in address order.
+        for (std::size_t i = sizes.blocks_per_slab; i-- > 0;)
+            sizes.free_list = ::new(base + i * sizes.size)
+                    FreeBlock{sizes.free_list};
+        sizes.free += sizes.blocks_per_slab;
+    }
+}
+
+#endif /* SLAB_POOL_H */
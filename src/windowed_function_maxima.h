@@ -0,0 +1,118 @@
+#ifndef WINDOWED_FUNCTION_MAXIMA_H
+#define WINDOWED_FUNCTION_MAXIMA_H
+
+#include "function_maxima.h"
+
+#include <iterator>
+#include <optional>
+#include <type_traits>
+
+/*
+ * FunctionMaxima restricted to a sliding window of the newest arguments.
+ * After every set_value, points falling out of the window are evicted from
+ * the low end with FunctionMaxima::erase_prefix, which costs amortized O(1)
+ * per evicted point and fixes up only the maximum status of the new first
+ * point.
+ *
+ * The window is bounded by a horizon, keeping arguments a with
+ * !(horizon < newest - a), and/or by a maximum number of points.
+ * A horizon must not be negative and requires `A - A` to be defined.
+ * Integral arguments are subtracted in the unsigned type, so the whole
+ * range of A may be used.
+ */
+template<typename A, typename V>
+class WindowedFunctionMaxima {
+public:
+    using function_type = FunctionMaxima<A, V>;
+    using point_type = typename function_type::point_type;
+    using iterator = typename function_type::iterator;
+    using mx_iterator = typename function_type::mx_iterator;
+    using size_type = typename function_type::size_type;
+
+    // Keeps arguments within `horizon` of the newest one.
+    static WindowedFunctionMaxima by_horizon(const A &horizon) {
+        return WindowedFunctionMaxima(horizon, std::nullopt);
+    }
+
+    // Keeps at most `capacity` newest points.
+    static WindowedFunctionMaxima by_count(size_type capacity) {
+        return WindowedFunctionMaxima(std::nullopt, capacity);
+    }
+
+    WindowedFunctionMaxima(std::optional<A> max_age,
+                           std::optional<size_type> max_points)
+            : horizon(std::move(max_age)), capacity(max_points) {}
+
+    iterator begin() const { return fun.begin(); }
+
+    iterator end() const { return fun.end(); }
+
+    iterator find(A const &x) const { return fun.find(x); }
+
+    mx_iterator mx_begin() const { return fun.mx_begin(); }
+
+    mx_iterator mx_end() const { return fun.mx_end(); }
+
+    size_type size() const { return fun.size(); }
+
+    V const &value_at(const A &a) const { return fun.value_at(a); }
+
+    // Sets f(a) = v and evicts points that fell out of the window.
+    // Arguments already out of the window are evicted right away.
+    // If eviction throws, the new value stays set and the window
+    // is trimmed by the next successful call.
+    void set_value(const A &a, const V &v);
+
+    void erase(const A &a) { fun.erase(a); }
+
+    // The windowed function itself.
+    function_type const &function() const noexcept { return fun; }
+
+private:
+    void evict();
+
+    // Whether `a` is further than the horizon from `newest`.
+    bool too_old(const A &a, const A &newest) const;
+
+    function_type fun;
+    std::optional<A> horizon;
+    std::optional<size_type> capacity;
+};
+
+template<typename A, typename V>
+void WindowedFunctionMaxima<A, V>::set_value(const A &a, const V &v) {
+    fun.set_value(a, v);
+    evict();
+}
+
+template<typename A, typename V>
+void WindowedFunctionMaxima<A, V>::evict() {
+    if (fun.size() == 0)
+        return;
+
+    iterator last = fun.begin();
+    if (capacity) {
+        for (size_type kept = fun.size(); kept > *capacity; kept--)
+            ++last;
+    }
+    if (horizon) {
+        const A &newest = std::prev(fun.end())->arg();
+        while (last != fun.end() && too_old(last->arg(), newest))
+            ++last;
+    }
+    fun.erase_prefix(last);
+}
+
+template<typename A, typename V>
+bool WindowedFunctionMaxima<A, V>::too_old(const A &a, const A &newest) const {
+    if constexpr (std::is_integral_v<A>) {
+        // a <= newest, so the distance fits the unsigned type.
+        using U = std::make_unsigned_t<A>;
+        return static_cast<U>(*horizon) <
+               static_cast<U>(static_cast<U>(newest) - static_cast<U>(a));
+    } else {
+        return *horizon < newest - a;
+    }
+}
+
+#endif /* WINDOWED_FUNCTION_MAXIMA_H */
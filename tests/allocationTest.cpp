@@ -0,0 +1,275 @@
+// Built as a separate executable: it replaces operator new and malloc to
+// count allocations, which runTests replaces to inject failures.
+#include "gtest/gtest.h"
+#include "../src/function_maxima.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// Allocations made by each operation, measured on fixture(). A test fails
+// when an operation allocates a different number of times: raise a count
+// only for a deliberate change, and lower it when an optimization makes
+// the operation allocate less.
+namespace budget {
+    // Noexcept comparisons, taking the unguarded update path.
+    constexpr long set_value_new_argument = 3;
+    constexpr long set_value_new_maximum = 5;
+    constexpr long set_value_existing_argument = 2;
+    constexpr long set_value_existing_new_maximum = 4;
+    constexpr long set_value_unchanged = 0;
+    constexpr long erase = 0;
+    constexpr long erase_maximum = 0;
+    // Comparisons that may throw, taking the guarded update path.
+    constexpr long guarded_set_value_new_argument = 6;
+    constexpr long guarded_set_value_new_maximum = 8;
+    constexpr long guarded_set_value_existing_argument = 5;
+    constexpr long guarded_set_value_existing_new_maximum = 7;
+    constexpr long guarded_set_value_unchanged = 0;
+    constexpr long guarded_erase = 2;
+    constexpr long guarded_erase_maximum = 2;
+    // Reads, for any argument type.
+    constexpr long find = 0;
+    constexpr long value_at = 0;
+    constexpr long iteration = 0;
+    constexpr long mx_iteration = 0;
+    // Copying the 100 points and 50 maxima of fixture().
+    constexpr long copy = 252;
+    // Noexcept comparisons on a function with room made by reserve().
+    constexpr long reserved_set_value_new_argument = 0;
+    constexpr long reserved_set_value_new_maximum = 0;
+    constexpr long reserved_set_value_existing_argument = 0;
+    constexpr long reserved_erase = 0;
+    // Filling an empty function with room made by reserve(100).
+    constexpr long reserved_fill = 0;
+}
+
+bool counting = false;
+long allocations_made = 0;
+
+// Allocations made by `op`.
+template<typename Op>
+long allocations(Op op) {
+    allocations_made = 0;
+    counting = true;
+    op();
+    counting = false;
+    return allocations_made;
+}
+
+void count() noexcept {
+    if (counting)
+        allocations_made++;
+}
+
+// Ordered like int, but its comparisons are not noexcept.
+struct Guarded {
+    int value;
+
+    Guarded(int v) : value(v) {}
+
+    bool operator<(const Guarded &other) const { return value < other.value; }
+};
+
+// 100 points, maxima at the odd arguments.
+template<typename T, typename Threading = MultiThreaded>
+FunctionMaxima<T, T, Threading> fixture() {
+    FunctionMaxima<T, T, Threading> fun;
+    for (int i = 0; i < 100; i++)
+        fun.set_value(i, i % 2 ? 10 : 0);
+    return fun;
+}
+
+// Runs the unguarded update checks on functions made by fixture().
+template<typename Threading>
+void expect_unguarded_budgets() {
+    auto fun = fixture<int, Threading>();
+    EXPECT_EQ(allocations([&] { fun.set_value(200, 0); }),
+              budget::set_value_new_argument);
+    fun = fixture<int, Threading>();
+    EXPECT_EQ(allocations([&] { fun.set_value(200, 20); }),
+              budget::set_value_new_maximum);
+    fun = fixture<int, Threading>();
+    EXPECT_EQ(allocations([&] { fun.set_value(0, 5); }),
+              budget::set_value_existing_argument);
+    fun = fixture<int, Threading>();
+    EXPECT_EQ(allocations([&] { fun.set_value(0, 50); }),
+              budget::set_value_existing_new_maximum);
+    fun = fixture<int, Threading>();
+    EXPECT_EQ(allocations([&] { fun.set_value(1, 10); }),
+              budget::set_value_unchanged);
+    EXPECT_EQ(allocations([&] { fun.erase(50); }), budget::erase);
+    EXPECT_EQ(allocations([&] { fun.erase(51); }), budget::erase_maximum);
+}
+
+}
+
+// Every form of operator new is counted once, whatever it is built on;
+// malloc is hooked as in CursedAllocator.cpp, for direct calls.
+extern "C" void *__libc_malloc(std::size_t size);
+extern "C" void __libc_free(void *p);
+
+extern "C" void *malloc(std::size_t size) {
+    count();
+    return __libc_malloc(size);
+}
+
+void *operator new(std::size_t size) {
+    count();
+    if (void *p = __libc_malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    count();
+    return __libc_malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept {
+    return operator new(size, tag);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+    count();
+    auto align = static_cast<std::size_t>(alignment);
+    // aligned_alloc wants a multiple of the alignment.
+    if (void *p = std::aligned_alloc(align, (size + align - 1) / align * align))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment,
+                   const std::nothrow_t &) noexcept {
+    try {
+        return operator new(size, alignment);
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &tag) noexcept {
+    return operator new(size, alignment, tag);
+}
+
+void operator delete(void *p) noexcept { __libc_free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { __libc_free(p); }
+
+void operator delete[](void *p) noexcept { __libc_free(p); }
+
+void operator delete[](void *p, std::size_t) noexcept { __libc_free(p); }
+
+void operator delete(void *p, std::align_val_t) noexcept { __libc_free(p); }
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+    __libc_free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept { __libc_free(p); }
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+    __libc_free(p);
+}
+
+TEST(allocationBudget, everyFormIsCounted) {
+    EXPECT_EQ(allocations([] { delete new int(1); }), 1);
+    EXPECT_EQ(allocations([] { delete[] new int[4]; }), 1);
+    EXPECT_EQ(allocations([] { delete new(std::nothrow) int(1); }), 1);
+    EXPECT_EQ(allocations([] { delete[] new(std::nothrow) int[4]; }), 1);
+    struct alignas(64) Wide {
+        char bytes[64];
+    };
+    EXPECT_EQ(allocations([] { delete new Wide(); }), 1);
+    EXPECT_EQ(allocations([] { delete[] new Wide[2]; }), 1);
+    EXPECT_EQ(allocations([] { std::free(std::malloc(16)); }), 1);
+}
+
+TEST(allocationBudget, unguardedUpdates) {
+    expect_unguarded_budgets<MultiThreaded>();
+}
+
+TEST(allocationBudget, singleThreadedUpdates) {
+    expect_unguarded_budgets<SingleThreaded>();
+}
+
+TEST(allocationBudget, guardedUpdates) {
+    auto fun = fixture<Guarded>();
+    EXPECT_EQ(allocations([&] { fun.set_value(200, 0); }),
+              budget::guarded_set_value_new_argument);
+    fun = fixture<Guarded>();
+    EXPECT_EQ(allocations([&] { fun.set_value(200, 20); }),
+              budget::guarded_set_value_new_maximum);
+    fun = fixture<Guarded>();
+    EXPECT_EQ(allocations([&] { fun.set_value(0, 5); }),
+              budget::guarded_set_value_existing_argument);
+    fun = fixture<Guarded>();
+    EXPECT_EQ(allocations([&] { fun.set_value(0, 50); }),
+              budget::guarded_set_value_existing_new_maximum);
+    fun = fixture<Guarded>();
+    EXPECT_EQ(allocations([&] { fun.set_value(1, 10); }),
+              budget::guarded_set_value_unchanged);
+    EXPECT_EQ(allocations([&] { fun.erase(50); }), budget::guarded_erase);
+    EXPECT_EQ(allocations([&] { fun.erase(51); }),
+              budget::guarded_erase_maximum);
+}
+
+TEST(allocationBudget, reads) {
+    const auto fun = fixture<int>();
+    EXPECT_EQ(allocations([&] { fun.find(50); }), budget::find);
+    EXPECT_EQ(allocations([&] { fun.value_at(50); }), budget::value_at);
+    EXPECT_EQ(allocations([&] {
+        for (const auto &p : fun)
+            (void) p;
+    }), budget::iteration);
+    EXPECT_EQ(allocations([&] {
+        for (auto it = fun.mx_begin(); it != fun.mx_end(); ++it)
+            (void) *it;
+    }), budget::mx_iteration);
+
+    const auto guarded = fixture<Guarded>();
+    EXPECT_EQ(allocations([&] { guarded.find(50); }), budget::find);
+    EXPECT_EQ(allocations([&] { guarded.value_at(50); }), budget::value_at);
+}
+
+TEST(allocationBudget, copy) {
+    const auto fun = fixture<int>();
+    EXPECT_EQ(allocations([&] { FunctionMaxima<int, int> copy(fun); }),
+              budget::copy);
+    const auto guarded = fixture<Guarded>();
+    EXPECT_EQ(allocations([&] { FunctionMaxima<Guarded, Guarded> copy(guarded); }),
+              budget::copy);
+    const auto single = fixture<int, SingleThreaded>();
+    EXPECT_EQ(allocations([&] {
+        FunctionMaxima<int, int, SingleThreaded> copy(single);
+    }), budget::copy);
+}
+
+TEST(allocationBudget, reservedUpdates) {
+    auto fun = fixture<int>();
+    fun.reserve(1000);
+    EXPECT_EQ(allocations([&] { fun.set_value(200, 0); }),
+              budget::reserved_set_value_new_argument);
+    EXPECT_EQ(allocations([&] { fun.set_value(201, 20); }),
+              budget::reserved_set_value_new_maximum);
+    EXPECT_EQ(allocations([&] { fun.set_value(0, 50); }),
+              budget::reserved_set_value_existing_argument);
+    EXPECT_EQ(allocations([&] { fun.erase(201); }), budget::reserved_erase);
+}
+
+TEST(allocationBudget, reservedEmptyFunction) {
+    FunctionMaxima<int, int> fun;
+    fun.reserve(100);
+    EXPECT_EQ(allocations([&] {
+        for (int i = 0; i < 100; i++)
+            fun.set_value(i, i % 2 ? 10 : 0);
+    }), budget::reserved_fill);
+    EXPECT_EQ(fun.size(), 100u);
+}
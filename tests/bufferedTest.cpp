@@ -0,0 +1,160 @@
+#include "gtest/gtest.h"
+#include "../src/buffered_function_maxima.h"
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+template<typename F>
+std::vector<std::pair<int, int>> points_of(const F &f) {
+  std::vector<std::pair<int, int>> pts;
+  for (const auto &p : f)
+    pts.emplace_back(p.arg(), p.value());
+  return pts;
+}
+
+template<typename F>
+std::vector<std::pair<int, int>> maxima_of(const F &f) {
+  std::vector<std::pair<int, int>> mx;
+  for (auto it = f.mx_begin(); it != f.mx_end(); ++it)
+    mx.emplace_back(it->arg(), it->value());
+  return mx;
+}
+
+// Copy-constructible only, like BMV in test_damiana.cc.
+class Sealed {
+public:
+  static bool armed;
+
+  explicit Sealed(int v) : value(v) {}
+
+  Sealed(const Sealed &) = default;
+
+  Sealed &operator=(const Sealed &) = delete;
+
+  bool operator<(const Sealed &other) const {
+    if (armed)
+      throw std::string("BOOM");
+    return value < other.value;
+  }
+
+  int value;
+};
+bool Sealed::armed = false;
+
+}
+
+TEST(buffered, matchesUnbuffered) {
+  BufferOptions options;
+  options.capacity = 16;
+  BufferedFunctionMaxima<int, int> fun(options);
+  FunctionMaxima<int, int> expected;
+  std::mt19937 rng(9);
+
+  for (int step = 0; step < 5000; step++) {
+    int a = static_cast<int>(rng() % 40);
+    if (rng() % 5 == 0) {
+      fun.erase(a);
+      expected.erase(a);
+    } else {
+      int v = static_cast<int>(rng() % 20);
+      fun.set_value(a, v);
+      expected.set_value(a, v);
+    }
+    ASSERT_LT(fun.buffered(), 16u);
+
+    int probe = static_cast<int>(rng() % 40);
+    if (expected.find(probe) != expected.end())
+      ASSERT_EQ(fun.value_at(probe), expected.value_at(probe));
+    else
+      ASSERT_THROW(fun.value_at(probe), InvalidArg);
+
+    if (step % 97 == 0) {
+      ASSERT_EQ(points_of(fun), points_of(expected));
+      ASSERT_EQ(maxima_of(fun), maxima_of(expected));
+      ASSERT_EQ(fun.buffered(), 0u);
+    }
+  }
+}
+
+TEST(buffered, coalescesRepeatedWrites) {
+  BufferedFunctionMaxima<int, int> fun;
+  for (int i = 0; i < 100; i++) {
+    fun.set_value(1, i);
+    fun.set_value(2, 100 - i);
+  }
+  EXPECT_EQ(fun.buffered(), 2u);
+  EXPECT_EQ(fun.value_at(1), 99);
+  EXPECT_EQ(fun.value_at(2), 1);
+
+  fun.erase(1);
+  EXPECT_EQ(fun.buffered(), 1u);
+  EXPECT_THROW(fun.value_at(1), InvalidArg);
+
+  std::vector<std::pair<int, int>> expected = {{2, 1}};
+  EXPECT_EQ(points_of(fun), expected);
+  EXPECT_EQ(maxima_of(fun), expected);
+  EXPECT_EQ(fun.buffered(), 0u);
+}
+
+TEST(buffered, flushesOldWrites) {
+  BufferOptions options;
+  options.max_delay = std::chrono::milliseconds(20);
+  BufferedFunctionMaxima<int, int> fun(options);
+  fun.set_value(1, 1);
+  EXPECT_EQ(fun.buffered(), 1u);
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  fun.set_value(2, 2);
+  EXPECT_EQ(fun.buffered(), 0u);
+  EXPECT_EQ(fun.function().size(), 2u);
+}
+
+TEST(buffered, valuesNeedOnlyCopyConstruction) {
+  BufferedFunctionMaxima<int, Sealed> fun;
+  fun.set_value(1, Sealed(1));
+  fun.set_value(1, Sealed(5));
+  fun.set_value(2, Sealed(3));
+  EXPECT_EQ(fun.buffered(), 2u);
+  EXPECT_EQ(fun.value_at(1).value, 5);
+  EXPECT_EQ(fun.mx_begin()->arg(), 1);
+}
+
+TEST(buffered, failedFlushKeepsTheWrite) {
+  BufferOptions options;
+  options.capacity = 2;
+  BufferedFunctionMaxima<int, Sealed> fun(options);
+  fun.set_value(1, Sealed(1));
+  Sealed::armed = true;
+  EXPECT_NO_THROW(fun.set_value(2, Sealed(2)));
+  Sealed::armed = false;
+  EXPECT_EQ(fun.buffered(), 2u);
+  EXPECT_EQ(fun.value_at(2).value, 2);
+
+  fun.flush();
+  EXPECT_EQ(fun.buffered(), 0u);
+  EXPECT_EQ(fun.size(), 2u);
+  EXPECT_EQ(fun.mx_begin()->arg(), 2);
+}
+
+TEST(buffered, valueReferencesLiveUntilTheNextFlush) {
+  BufferOptions options;
+  options.capacity = 3;
+  BufferedFunctionMaxima<int, int> fun(options);
+  fun.set_value(1, 10);
+  fun.flush();
+  const int &flushed = fun.value_at(1);
+  fun.set_value(2, 20);
+  const int &buffered = fun.value_at(2);
+  fun.set_value(3, 30);
+  // Neither write has flushed yet.
+  EXPECT_EQ(fun.buffered(), 2u);
+  EXPECT_EQ(buffered, 20);
+
+  // The flush ends the buffered reference, not the flushed one.
+  fun.set_value(4, 40);
+  EXPECT_EQ(fun.buffered(), 0u);
+  EXPECT_EQ(flushed, 10);
+  EXPECT_EQ(&fun.value_at(1), &flushed);
+}
@@ -0,0 +1,93 @@
+#include "gtest/gtest.h"
+#include "../src/compressed_function_maxima.h"
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace {
+
+template<typename F>
+std::vector<std::pair<std::int64_t, int>> points_of(const F &f) {
+  std::vector<std::pair<std::int64_t, int>> pts;
+  for (const auto &p : f)
+    pts.emplace_back(p.arg(), p.value());
+  return pts;
+}
+
+template<typename F>
+std::vector<std::pair<std::int64_t, int>> maxima_of(const F &f) {
+  std::vector<std::pair<std::int64_t, int>> mx;
+  for (auto it = f.mx_begin(); it != f.mx_end(); ++it)
+    mx.emplace_back(it->arg(), it->value());
+  return mx;
+}
+
+}
+
+TEST(compressed, matchesOriginal) {
+  FunctionMaxima<std::int64_t, int> fun;
+  std::mt19937_64 rng(5);
+  // Timestamps with mostly small gaps and a few huge ones, crossing zero.
+  std::int64_t t = -1000000;
+  for (int i = 0; i < 5000; i++) {
+    t += i % 500 == 0 ? static_cast<std::int64_t>(rng() % (1ull << 40)) + 1
+                      : static_cast<std::int64_t>(rng() % 100) + 1;
+    fun.set_value(t, static_cast<int>(rng() % 50));
+  }
+
+  CompressedFunctionMaxima<std::int64_t, int> cold(fun);
+  ASSERT_EQ(cold.size(), fun.size());
+  ASSERT_EQ(points_of(cold), points_of(fun));
+  ASSERT_EQ(maxima_of(cold), maxima_of(fun));
+  EXPECT_LT(cold.memory_usage(),
+            fun.size() * (sizeof(std::int64_t) + sizeof(int)));
+
+  for (const auto &p : fun) {
+    ASSERT_EQ(cold.value_at(p.arg()), p.value());
+    ASSERT_EQ(cold.find(p.arg())->arg(), p.arg());
+    ASSERT_TRUE(cold.find(p.arg() + 1) == cold.end() ||
+                fun.find(p.arg() + 1) != fun.end());
+  }
+  EXPECT_THROW(cold.value_at(-2000000), InvalidArg);
+  EXPECT_TRUE(cold.find(t + 1) == cold.end());
+
+  auto thawed = cold.decompress();
+  ASSERT_EQ(points_of(thawed), points_of(fun));
+  ASSERT_EQ(maxima_of(thawed), maxima_of(fun));
+  thawed.set_value(t + 1, 1000);
+  fun.set_value(t + 1, 1000);
+  EXPECT_EQ(maxima_of(thawed), maxima_of(fun));
+}
+
+TEST(compressed, emptyAndUnsigned) {
+  FunctionMaxima<std::uint8_t, int> empty;
+  CompressedFunctionMaxima<std::uint8_t, int> cold_empty(empty);
+  EXPECT_TRUE(cold_empty.begin() == cold_empty.end());
+  EXPECT_TRUE(cold_empty.find(3) == cold_empty.end());
+  EXPECT_EQ(cold_empty.decompress().size(), 0u);
+
+  FunctionMaxima<std::uint8_t, int> full;
+  for (int a = 0; a < 256; a++)
+    full.set_value(static_cast<std::uint8_t>(a), a % 7);
+  CompressedFunctionMaxima<std::uint8_t, int> cold(full);
+  EXPECT_EQ(cold.value_at(255), 255 % 7);
+  EXPECT_EQ(cold.value_at(0), 0);
+  EXPECT_EQ(maxima_of(cold), maxima_of(full));
+}
+
+TEST(compressed, pointsOutliveIterators) {
+  FunctionMaxima<int, int> fun;
+  fun.set_value(1, 5);
+  fun.set_value(2, 3);
+  CompressedFunctionMaxima<int, int> cold(fun);
+  // Points are returned by value, so they stay valid after the iterator.
+  auto it = cold.begin();
+  auto first = *it;
+  ++it;
+  EXPECT_EQ(first.arg(), 1);
+  EXPECT_EQ(first.value(), 5);
+  EXPECT_EQ(it->arg(), 2);
+  auto top = *cold.mx_begin();
+  EXPECT_EQ(top.arg(), 1);
+  EXPECT_EQ(top.value(), 5);
+}
@@ -0,0 +1,90 @@
+#include "gtest/gtest.h"
+#include "../src/eytzinger_function_maxima.h"
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+template<typename F>
+std::vector<std::pair<int, int>> points_of(const F &f) {
+  std::vector<std::pair<int, int>> pts;
+  for (const auto &p : f)
+    pts.emplace_back(p.arg(), p.value());
+  return pts;
+}
+
+template<typename F>
+std::vector<std::pair<int, int>> maxima_of(const F &f) {
+  std::vector<std::pair<int, int>> mx;
+  for (auto it = f.mx_begin(); it != f.mx_end(); ++it)
+    mx.emplace_back(it->arg(), it->value());
+  return mx;
+}
+
+}
+
+TEST(eytzinger, matchesOriginal) {
+  std::mt19937 rng(11);
+  // Sizes around powers of two leave the last level empty, partial or full.
+  for (int n : {0, 1, 2, 3, 7, 8, 9, 100, 1023, 1024, 1025}) {
+    FunctionMaxima<int, int> fun;
+    while (static_cast<int>(fun.size()) < n)
+      fun.set_value(2 * static_cast<int>(rng() % 5000),
+                    static_cast<int>(rng() % 50));
+
+    auto frozen = freeze(fun);
+    ASSERT_EQ(frozen.size(), fun.size());
+    ASSERT_EQ(points_of(frozen), points_of(fun));
+    ASSERT_EQ(maxima_of(frozen), maxima_of(fun));
+
+    for (const auto &p : fun) {
+      ASSERT_EQ(frozen.value_at(p.arg()), p.value());
+      ASSERT_EQ(frozen.find(p.arg())->arg(), p.arg());
+      // Odd arguments are never set.
+      ASSERT_TRUE(frozen.find(p.arg() + 1) == frozen.end());
+      ASSERT_TRUE(frozen.find(p.arg() - 1) == frozen.end());
+    }
+    EXPECT_THROW(frozen.value_at(-1), InvalidArg);
+    EXPECT_TRUE(frozen.find(10000) == frozen.end());
+
+    std::vector<std::pair<int, int>> backwards;
+    for (auto it = frozen.end(); it != frozen.begin();) {
+      --it;
+      backwards.emplace_back(it->arg(), it->value());
+    }
+    auto pts = points_of(fun);
+    std::reverse(pts.begin(), pts.end());
+    ASSERT_EQ(backwards, pts);
+  }
+}
+
+TEST(eytzinger, outlivesOriginal) {
+  auto frozen = [] {
+    FunctionMaxima<std::string, int> fun;
+    fun.set_value("b", 1);
+    fun.set_value("a", 3);
+    fun.set_value("c", 3);
+    return freeze(fun);
+  }();
+  EXPECT_EQ(frozen.value_at("a"), 3);
+  EXPECT_EQ(frozen.find("b")->value(), 1);
+  EXPECT_TRUE(frozen.find("d") == frozen.end());
+  ASSERT_EQ(std::distance(frozen.mx_begin(), frozen.mx_end()), 2);
+  EXPECT_EQ(frozen.mx_begin()->arg(), "a");
+}
+
+TEST(eytzinger, pointsOutliveIterators) {
+  FunctionMaxima<int, int> fun;
+  fun.set_value(1, 5);
+  fun.set_value(2, 3);
+  auto frozen = freeze(fun);
+  // Points are returned by value, so they stay valid after the iterator.
+  auto last = *--frozen.end();
+  auto top = *frozen.mx_begin();
+  EXPECT_EQ(last.arg(), 2);
+  EXPECT_EQ(last.value(), 3);
+  EXPECT_EQ(top.arg(), 1);
+  EXPECT_EQ(top.value(), 5);
+}
@@ -0,0 +1,141 @@
+#include "gtest/gtest.h"
+#include "../src/frozen_function_maxima.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct TempPath {
+  std::string path;
+  TempPath() {
+    char name[] = "/tmp/frozen_maxima_XXXXXX";
+    int fd = mkstemp(name);
+    close(fd);
+    path = name;
+  }
+  ~TempPath() { std::remove(path.c_str()); }
+};
+
+struct Sample {
+  int id;
+  double weight;
+  bool operator<(const Sample &s) const { return weight < s.weight; }
+};
+
+template<typename F, typename G>
+void expect_same(const F &frozen, const G &fun) {
+  ASSERT_EQ(frozen.size(), fun.size());
+  auto it = fun.begin();
+  for (const auto &p : frozen) {
+    ASSERT_TRUE(it != fun.end());
+    EXPECT_FALSE(p.arg() < it->arg() || it->arg() < p.arg());
+    EXPECT_FALSE(p.value() < it->value() || it->value() < p.value());
+    ++it;
+  }
+  auto mx = fun.mx_begin();
+  for (auto f = frozen.mx_begin(); f != frozen.mx_end(); ++f, ++mx) {
+    ASSERT_TRUE(mx != fun.mx_end());
+    EXPECT_FALSE(f->arg() < mx->arg() || mx->arg() < f->arg());
+  }
+  EXPECT_TRUE(mx == fun.mx_end());
+}
+
+}
+
+TEST(frozen, sameSemanticsAsMutable) {
+  FunctionMaxima<int, int> fun;
+  for (int i = 0; i < 10000; i++)
+    fun.set_value((i * 7919) % 10007, (i * 31) % 101);
+  fun.set_value(-5, 1000);
+  fun.set_value(-4, 1000);
+
+  TempPath tmp;
+  FrozenFunctionMaxima<int, int>::write(fun, tmp.path);
+  FrozenFunctionMaxima<int, int> frozen(tmp.path);
+
+  expect_same(frozen, fun);
+  EXPECT_EQ(frozen.mx_begin()->arg(), -5);
+  EXPECT_EQ(frozen.value_at(-4), 1000);
+  EXPECT_THROW(frozen.value_at(-3), InvalidArg);
+  EXPECT_TRUE(frozen.find(-3) == frozen.end());
+  for (auto p : fun)
+    EXPECT_EQ(frozen.find(p.arg())->value(), p.value());
+
+  auto last = frozen.end();
+  --last;
+  EXPECT_EQ(last->arg(), std::prev(fun.end())->arg());
+}
+
+TEST(frozen, structValuesAndMove) {
+  FunctionMaxima<long, Sample> fun;
+  fun.set_value(1, {1, 0.5});
+  fun.set_value(2, {2, 2.5});
+  fun.set_value(3, {3, 1.5});
+
+  TempPath tmp;
+  FrozenFunctionMaxima<long, Sample>::write(fun, tmp.path);
+  FrozenFunctionMaxima<long, Sample> a(tmp.path);
+  FrozenFunctionMaxima<long, Sample> b = std::move(a);
+  expect_same(b, fun);
+  EXPECT_EQ(b.mx_begin()->value().id, 2);
+}
+
+TEST(frozen, emptyFunction) {
+  FunctionMaxima<int, int> fun;
+  TempPath tmp;
+  FrozenFunctionMaxima<int, int>::write(fun, tmp.path);
+  FrozenFunctionMaxima<int, int> frozen(tmp.path);
+  EXPECT_EQ(frozen.size(), 0u);
+  EXPECT_TRUE(frozen.begin() == frozen.end());
+  EXPECT_TRUE(frozen.mx_begin() == frozen.mx_end());
+}
+
+TEST(frozen, rewriteKeepsOpenMappings) {
+  FunctionMaxima<int, int> fun;
+  for (int i = 0; i < 100; i++)
+    fun.set_value(i, i % 7);
+  TempPath tmp;
+  FrozenFunctionMaxima<int, int>::write(fun, tmp.path);
+  FrozenFunctionMaxima<int, int> old(tmp.path);
+
+  FunctionMaxima<int, int> other;
+  other.set_value(1, 1);
+  FrozenFunctionMaxima<int, int>::write(other, tmp.path);
+  EXPECT_EQ(old.size(), 100u);
+  EXPECT_EQ(old.value_at(99), 99 % 7);
+  EXPECT_EQ((FrozenFunctionMaxima<int, int>(tmp.path).size()), 1u);
+  EXPECT_NE(::access((tmp.path + ".tmp").c_str(), F_OK), 0);
+}
+
+TEST(frozen, pointsOutliveIterators) {
+  FunctionMaxima<int, int> fun;
+  fun.set_value(1, 5);
+  fun.set_value(2, 3);
+  TempPath tmp;
+  FrozenFunctionMaxima<int, int>::write(fun, tmp.path);
+  FrozenFunctionMaxima<int, int> frozen(tmp.path);
+  // Points are returned by value, so they stay valid after the iterator.
+  auto last = *--frozen.end();
+  auto top = *frozen.mx_begin();
+  EXPECT_EQ(last.arg(), 2);
+  EXPECT_EQ(last.value(), 3);
+  EXPECT_EQ(top.arg(), 1);
+  EXPECT_EQ(top.value(), 5);
+}
+
+TEST(frozen, rejectsWrongTypesAndGarbage) {
+  FunctionMaxima<int, int> fun;
+  fun.set_value(1, 1);
+  TempPath tmp;
+  FrozenFunctionMaxima<int, int>::write(fun, tmp.path);
+  EXPECT_THROW((FrozenFunctionMaxima<int, double>(tmp.path)), InvalidFormat);
+
+  {
+    std::ofstream out(tmp.path, std::ios::binary | std::ios::app);
+    out << "trailing";
+  }
+  EXPECT_THROW((FrozenFunctionMaxima<int, int>(tmp.path)), InvalidFormat);
+  EXPECT_THROW((FrozenFunctionMaxima<int, int>("/nonexistent/frozen")),
+               std::system_error);
+}
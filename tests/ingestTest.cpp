@@ -0,0 +1,90 @@
+#include "gtest/gtest.h"
+#include "../src/maxima_ingest.h"
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+template<typename A, typename V>
+bool same_function(const FunctionMaxima<A, V> &F, const FunctionMaxima<A, V> &G) {
+  auto eq = [](const auto &p, const auto &q) {
+    return !(p.arg() < q.arg()) && !(q.arg() < p.arg()) &&
+           !(p.value() < q.value()) && !(q.value() < p.value());
+  };
+  return F.size() == G.size() &&
+         std::equal(F.begin(), F.end(), G.begin(), eq) &&
+         std::distance(F.mx_begin(), F.mx_end()) ==
+         std::distance(G.mx_begin(), G.mx_end()) &&
+         std::equal(F.mx_begin(), F.mx_end(), G.mx_begin(), eq);
+}
+
+IngestOptions small_chunks() {
+  IngestOptions options;
+  options.chunk_size = 64;
+  options.workers = 4;
+  options.in_flight = 3;
+  return options;
+}
+
+}
+
+TEST(ingest, csvKeepsStreamOrder) {
+  std::ostringstream text;
+  FunctionMaxima<int, double> expected;
+  for (int i = 0; i < 20000; i++) {
+    int a = (i * 7919) % 3001;
+    double v = (i % 13) * 0.5;
+    text << a << ", " << v << (i % 7 == 0 ? "\r\n" : "\n");
+    expected.set_value(a, v);
+  }
+  text << "5,1.25";  // last line without a newline
+  expected.set_value(5, 1.25);
+
+  FunctionMaxima<int, double> fun;
+  std::istringstream in(text.str());
+  MaximaIngestor<int, double> ingestor(fun, {}, small_chunks());
+  IngestStats stats = ingestor.run(in);
+
+  EXPECT_EQ(stats.records, 20001u);
+  EXPECT_EQ(stats.bytes, text.str().size());
+  EXPECT_GE(stats.seconds, 0);
+  ASSERT_TRUE(same_function(fun, expected));
+}
+
+TEST(ingest, binaryRecords) {
+  std::ostringstream bytes;
+  FunctionMaxima<std::int32_t, std::uint16_t> expected;
+  for (std::int32_t i = 0; i < 5000; i++) {
+    std::int32_t a = (i * 37) % 1013 - 500;
+    auto v = static_cast<std::uint16_t>(i % 101);
+    MaximaCodec<std::int32_t>::write(bytes, a);
+    MaximaCodec<std::uint16_t>::write(bytes, v);
+    expected.set_value(a, v);
+  }
+
+  FunctionMaxima<std::int32_t, std::uint16_t> fun;
+  std::istringstream in(bytes.str());
+  MaximaIngestor<std::int32_t, std::uint16_t,
+          BinaryFormat<std::int32_t, std::uint16_t>> ingestor(fun, {}, small_chunks());
+  EXPECT_EQ(ingestor.run(in).records, 5000u);
+  ASSERT_TRUE(same_function(fun, expected));
+}
+
+TEST(ingest, badRecordStopsAfterEarlierChunks) {
+  std::ostringstream text;
+  for (int i = 0; i < 1000; i++)
+    text << i << "," << i << "\n";
+  text << "oops\n";
+  for (int i = 1000; i < 2000; i++)
+    text << i << "," << i << "\n";
+
+  FunctionMaxima<int, int> fun;
+  std::istringstream in(text.str());
+  MaximaIngestor<int, int> ingestor(fun, {}, small_chunks());
+  EXPECT_THROW(ingestor.run(in), InvalidFormat);
+  // Every chunk before the bad one is applied, nothing after it.
+  EXPECT_GT(fun.size(), 990u);
+  EXPECT_LE(fun.size(), 1000u);
+  EXPECT_EQ(std::prev(fun.end())->arg(), static_cast<int>(fun.size()) - 1);
+}
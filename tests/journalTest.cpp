@@ -0,0 +1,186 @@
+#include "gtest/gtest.h"
+#include "../src/function_maxima_journal.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct TempDir {
+  std::string path;
+  TempDir() {
+    char name[] = "/tmp/journal_maxima_XXXXXX";
+    path = mkdtemp(name);
+  }
+  ~TempDir() {
+    for (const char *file : {"/checkpoint", "/checkpoint.tmp", "/journal"})
+      std::remove((path + file).c_str());
+    rmdir(path.c_str());
+  }
+  std::string checkpoint() const { return path + "/checkpoint"; }
+  std::string journal() const { return path + "/journal"; }
+};
+
+std::string contents(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+void overwrite(const std::string &path, const std::string &data) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << data;
+}
+
+template<typename F>
+std::vector<std::pair<int, int>> points_of(const F &f) {
+  std::vector<std::pair<int, int>> pts;
+  for (const auto &p : f)
+    pts.emplace_back(p.arg(), p.value());
+  return pts;
+}
+
+template<typename F>
+std::vector<std::pair<int, int>> maxima_of(const F &f) {
+  std::vector<std::pair<int, int>> mx;
+  for (auto it = f.mx_begin(); it != f.mx_end(); ++it)
+    mx.emplace_back(it->arg(), it->value());
+  return mx;
+}
+
+struct Fragile {
+  int value;
+  static bool armed;
+  bool operator<(const Fragile &f) const {
+    if (armed && f.value == 42)
+      throw std::string("BOOM");
+    return value < f.value;
+  }
+};
+bool Fragile::armed = false;
+
+struct FragileCodec {
+  static void write(std::ostream &os, const Fragile &f) {
+    MaximaCodec<int>::write(os, f.value);
+  }
+  static Fragile read(std::istream &is) {
+    return Fragile{MaximaCodec<int>::read(is)};
+  }
+};
+
+}
+
+TEST(journal, replaysUpdates) {
+  TempDir dir;
+  FunctionMaxima<int, int> expected;
+  JournalOptions options;
+  options.group_records = 7;
+  options.checkpoint_bytes = 0;
+  {
+    JournaledFunctionMaxima<int, int> fun(dir.checkpoint(), dir.journal(),
+                                          options);
+    std::mt19937 rng(3);
+    for (int i = 0; i < 500; i++) {
+      int a = static_cast<int>(rng() % 100);
+      if (rng() % 4 == 0) {
+        fun.erase(a);
+        expected.erase(a);
+      } else {
+        int v = static_cast<int>(rng() % 30);
+        fun.set_value(a, v);
+        expected.set_value(a, v);
+      }
+    }
+    EXPECT_EQ(points_of(fun), points_of(expected));
+  }
+
+  JournaledFunctionMaxima<int, int> recovered(dir.checkpoint(), dir.journal());
+  EXPECT_EQ(recovered.pending(), 0u);
+  EXPECT_EQ(points_of(recovered), points_of(expected));
+  EXPECT_EQ(maxima_of(recovered), maxima_of(expected));
+}
+
+TEST(journal, uncommittedAndTornRecordsAreLost) {
+  TempDir dir;
+  JournalOptions options;
+  options.group_records = 1000;
+  std::string committed;
+  {
+    JournaledFunctionMaxima<int, int> fun(dir.checkpoint(), dir.journal(),
+                                          options);
+    fun.set_value(1, 10);
+    fun.set_value(2, 20);
+    EXPECT_EQ(fun.pending(), 2u);
+    fun.commit();
+    EXPECT_EQ(fun.pending(), 0u);
+    committed = contents(dir.journal());
+    fun.set_value(3, 30);
+  }
+  // A crash before the last commit, in the middle of writing a record.
+  std::string torn = contents(dir.journal());
+  overwrite(dir.journal(), torn.substr(0, torn.size() - 3));
+
+  JournaledFunctionMaxima<int, int> recovered(dir.checkpoint(), dir.journal());
+  std::vector<std::pair<int, int>> expected = {{1, 10}, {2, 20}};
+  EXPECT_EQ(points_of(recovered), expected);
+  EXPECT_EQ(contents(dir.journal()), committed);
+}
+
+TEST(journal, checkpointTruncatesJournal) {
+  TempDir dir;
+  JournalOptions options;
+  options.group_records = 10;
+  options.checkpoint_bytes = 200;
+  FunctionMaxima<int, int> expected;
+  {
+    JournaledFunctionMaxima<int, int> fun(dir.checkpoint(), dir.journal(),
+                                          options);
+    for (int i = 0; i < 1000; i++) {
+      fun.set_value(i % 64, i % 13);
+      expected.set_value(i % 64, i % 13);
+      ASSERT_LT(contents(dir.journal()).size(), 400u);
+    }
+    fun.erase(5);
+    expected.erase(5);
+  }
+  EXPECT_FALSE(contents(dir.checkpoint()).empty());
+
+  JournaledFunctionMaxima<int, int> recovered(dir.checkpoint(), dir.journal());
+  EXPECT_EQ(points_of(recovered), points_of(expected));
+  EXPECT_EQ(maxima_of(recovered), maxima_of(expected));
+
+  // Replaying records already in the checkpoint changes nothing.
+  std::string journal = contents(dir.journal());
+  recovered.checkpoint();
+  overwrite(dir.journal(), journal);
+  JournaledFunctionMaxima<int, int> again(dir.checkpoint(), dir.journal());
+  EXPECT_EQ(points_of(again), points_of(expected));
+}
+
+TEST(journal, rolledBackUpdatesAreNotJournaled) {
+  TempDir dir;
+  JournalOptions options;
+  options.group_records = 1;
+  {
+    JournaledFunctionMaxima<int, Fragile, MaximaCodec<int>, FragileCodec>
+            fun(dir.checkpoint(), dir.journal(), options);
+    fun.set_value(1, Fragile{42});
+    fun.set_value(2, Fragile{7});
+    std::string before = contents(dir.journal());
+
+    Fragile::armed = true;
+    EXPECT_THROW(fun.set_value(3, Fragile{5}), std::string);
+    Fragile::armed = false;
+    EXPECT_EQ(fun.pending(), 0u);
+    EXPECT_EQ(contents(dir.journal()), before);
+    EXPECT_EQ(fun.size(), 2u);
+  }
+
+  JournaledFunctionMaxima<int, Fragile, MaximaCodec<int>, FragileCodec>
+          recovered(dir.checkpoint(), dir.journal());
+  EXPECT_EQ(recovered.size(), 2u);
+  EXPECT_TRUE(recovered.find(3) == recovered.end());
+  EXPECT_EQ(recovered.value_at(1).value, 42);
+}
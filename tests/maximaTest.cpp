@@ -6,6 +6,10 @@
 #include <algorithm>
 #include <thread>
 #include <chrono>
+#include <cstdlib>
+#include <optional>
+#include <set>
+#include <map>
 
 #define GTEST_COUT std::cerr << "\033[1;36m[          ] [ INFO ]\033[0m"
 
@@ -335,3 +339,960 @@ TEST(expensiveCompare, performanceTest) {
     GTEST_COUT << "Ustawienie nowego lokalnego maksimum wykonalo " << compareNum - compareNumMiddle << " porownan\n";
 }
 
+
+TEST(setValues, lastWriteWinsAndMatchesSequential) {
+    std::vector<std::pair<int, int>> updates;
+    for (int i = 0; i < 5000; i++)
+        updates.emplace_back((i * 7919) % 1000, (i * 31) % 97);
+
+    FunctionMaxima<int, int> batched, sequential;
+    batched.set_values(updates.begin(), updates.end());
+    for (const auto &u : updates)
+        sequential.set_value(u.first, u.second);
+
+    ASSERT_EQ(batched.size(), sequential.size());
+    ASSERT_TRUE(std::equal(batched.begin(), batched.end(), sequential.begin(),
+                           [](const auto &p, const auto &q) {
+                               return p.arg() == q.arg() && p.value() == q.value();
+                           }));
+    ASSERT_TRUE(std::equal(batched.mx_begin(), batched.mx_end(), sequential.mx_begin(),
+                           [](const auto &p, const auto &q) {
+                               return p.arg() == q.arg() && p.value() == q.value();
+                           }));
+}
+
+namespace {
+
+// Counts comparisons of all instances with the same Tag.
+template<typename Tag>
+class Counted {
+public:
+    static inline long comparisons = 0;
+
+    Counted(int v) : x(v) {}
+
+    bool operator<(const Counted &other) const {
+        comparisons++;
+        return x < other.x;
+    }
+
+private:
+    int x;
+};
+
+struct ArgTag {};
+struct ValueTag {};
+
+using CountedArg = Counted<ArgTag>;
+using CountedValue = Counted<ValueTag>;
+
+// Worst case comparisons of a single update, over many updates.
+struct Worst {
+    long args = 0;
+    long values = 0;
+
+    template<typename F>
+    void measure(F &&update) {
+        long args_before = CountedArg::comparisons;
+        long values_before = CountedValue::comparisons;
+        update();
+        args = std::max(args, CountedArg::comparisons - args_before);
+        values = std::max(values, CountedValue::comparisons - values_before);
+    }
+};
+
+// Depth of a red-black tree with n nodes is at most 2 * log2(n + 1),
+// and a search compares at most twice per level on ties in mx_points.
+long tree_search(long n) {
+    long log = 0;
+    while ((1L << log) < n + 1)
+        log++;
+    return 2 * log + 2;
+}
+
+}
+
+TEST(comparisons, boundedPerUpdate) {
+    const int n = 4096;
+    const std::function<int(int)> shapes[] = {
+            [](int i) { return (i * 7919) % 1009; },
+            [](int i) { return i; },
+            [](int) { return 7; },
+    };
+    for (const auto &shape : shapes) {
+        FunctionMaxima<CountedArg, CountedValue> fun;
+        Worst worst;
+        for (int i = 0; i < n; i++)
+            worst.measure([&] { fun.set_value((i * 7919) % n, shape(i)); });
+        for (int i = 0; i < n; i += 3)
+            worst.measure([&] { fun.set_value(i, shape(i + 1)); });
+        for (int i = 0; i < n; i += 5)
+            worst.measure([&] { fun.erase(i); });
+
+        // One search in the domain and at most three searches among the
+        // maxima, which compare arguments on value ties only.
+        EXPECT_LE(worst.args, 4 * tree_search(n)) << worst.args;
+        // Neighbours are compared a constant number of times, the rest is
+        // spent on at most three searches and three insertions among maxima.
+        EXPECT_LE(worst.values, 8 + 5 * tree_search(n)) << worst.values;
+    }
+}
+
+TEST(comparisons, constantValueComparisonsWithSingleMaximum) {
+    // With one maximum, searches among the maxima are constant time, so
+    // only neighbour comparisons are left.
+    FunctionMaxima<CountedArg, CountedValue> fun;
+    Worst worst;
+    for (int i = 0; i < 4096; i++)
+        worst.measure([&] { fun.set_value(i, 2 * i); });
+    for (int i = 0; i < 4000; i += 7)
+        worst.measure([&] { fun.set_value(i, 2 * i - 1); });
+    for (int i = 1; i < 4000; i += 7)
+        worst.measure([&] { fun.erase(i); });
+    EXPECT_EQ(std::distance(fun.mx_begin(), fun.mx_end()), 1);
+    EXPECT_LE(worst.values, 16) << worst.values;
+}
+
+TEST(comparisons, erasingMaximumDoesNotSearchMaxima) {
+    // Maxima at every odd argument, erasing one leaves its neighbours
+    // below theirs, so only the neighbours are compared.
+    FunctionMaxima<CountedArg, CountedValue> fun;
+    for (int i = 0; i < 4096; i++)
+        fun.set_value(i, i % 2);
+    Worst worst;
+    for (int i = 5; i < 4005; i += 4)
+        worst.measure([&] { fun.erase(i); });
+    EXPECT_EQ(std::distance(fun.mx_begin(), fun.mx_end()), 2048 - 1000);
+    EXPECT_LE(worst.values, 4) << worst.values;
+}
+
+TEST(maximaStatus, copyTracksItsOwnMaxima) {
+    FunctionMaxima<int, int> original;
+    for (int i = 0; i < 1000; i++)
+        original.set_value(i, (i * 37) % 101);
+    FunctionMaxima<int, int> copy(original);
+    FunctionMaxima<int, int> expected;
+    for (int i = 0; i < 1000; i++)
+        expected.set_value(i, (i * 37) % 101);
+
+    for (int i = 0; i < 1000; i += 3)
+        copy.set_value(i, (i * 53) % 89);
+    for (int i = 1; i < 1000; i += 7)
+        copy.erase(i);
+
+    FunctionMaxima<int, int> rebuilt;
+    for (const auto &p : copy)
+        rebuilt.set_value(p.arg(), p.value());
+    auto same_points = [](const auto &p, const auto &q) {
+        return p.arg() == q.arg() && p.value() == q.value();
+    };
+    ASSERT_TRUE(std::equal(copy.mx_begin(), copy.mx_end(), rebuilt.mx_begin(),
+                           rebuilt.mx_end(), same_points));
+    ASSERT_TRUE(std::equal(original.mx_begin(), original.mx_end(),
+                           expected.mx_begin(), expected.mx_end(), same_points));
+}
+
+namespace {
+
+// Allocations left before operator new throws, negative for no limit.
+long allocations_left = -1;
+
+template<typename Threading>
+std::vector<std::pair<int, int>>
+points_of(const FunctionMaxima<int, int, Threading> &f) {
+    std::vector<std::pair<int, int>> result;
+    for (const auto &p : f)
+        result.emplace_back(p.arg(), p.value());
+    return result;
+}
+
+template<typename Threading>
+std::vector<std::pair<int, int>>
+maxima_of(const FunctionMaxima<int, int, Threading> &f) {
+    std::vector<std::pair<int, int>> result;
+    for (auto it = f.mx_begin(); it != f.mx_end(); ++it)
+        result.emplace_back(it->arg(), it->value());
+    return result;
+}
+
+}
+
+void *operator new(std::size_t size) {
+    if (allocations_left == 0)
+        throw std::bad_alloc();
+    if (allocations_left > 0)
+        allocations_left--;
+    if (void *p = std::malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+TEST(nothrowComparisons, strongGuaranteeOnAllocationFailure) {
+    static_assert(noexcept(std::declval<int>() < std::declval<int>()));
+    const std::function<void(FunctionMaxima<int, int> &)> updates[] = {
+            [](auto &f) { f.set_value(5, 100); },
+            [](auto &f) { f.set_value(4, 100); },
+            [](auto &f) { f.set_value(3, 0); },
+            [](auto &f) { f.set_value(100, 7); },
+            [](auto &f) { f.erase(4); },
+            [](auto &f) { f.erase(0); },
+    };
+    for (const auto &update : updates) {
+        for (long allowed = 0;; allowed++) {
+            FunctionMaxima<int, int> fun;
+            for (int i = 0; i < 10; i++)
+                fun.set_value(i, i % 3);
+            auto points = points_of(fun);
+            auto maxima = maxima_of(fun);
+
+            allocations_left = allowed;
+            try {
+                update(fun);
+                allocations_left = -1;
+                break;
+            } catch (const std::bad_alloc &) {
+                allocations_left = -1;
+                ASSERT_EQ(points_of(fun), points);
+                ASSERT_EQ(maxima_of(fun), maxima);
+            }
+        }
+    }
+}
+
+TEST(setValues, sortedBatchMatchesSequential) {
+    std::mt19937 rng(17);
+    for (int round = 0; round < 200; round++) {
+        for (bool lazy : {false, true}) {
+            FunctionMaxima<int, int> batched, sequential;
+            batched.set_lazy_maxima(lazy);
+            // Every tenth round spans several groups of set_sorted_values.
+            unsigned scale = round % 10 ? 1 : 20;
+            int n = static_cast<int>(rng() % (30 * scale));
+            for (int i = 0; i < n; i++) {
+                int a = static_cast<int>(rng() % (40 * scale));
+                int v = static_cast<int>(rng() % 5);
+                batched.set_value(a, v);
+                sequential.set_value(a, v);
+            }
+            // Small ranges make changes adjacent, replace points and leave
+            // some values unchanged.
+            std::map<int, int> batch;
+            int k = static_cast<int>(rng() % (20 * scale));
+            for (int i = 0; i < k; i++)
+                batch[static_cast<int>(rng() % (40 * scale))] = static_cast<int>(rng() % 5);
+            batched.set_sorted_values(batch.begin(), batch.end());
+            for (const auto &[a, v] : batch)
+                sequential.set_value(a, v);
+
+            ASSERT_EQ(points_of(batched), points_of(sequential));
+            ASSERT_EQ(maxima_of(batched), maxima_of(sequential));
+        }
+    }
+}
+
+TEST(setValues, sortedBatchRejectsUnsortedArguments) {
+    FunctionMaxima<int, int> fun;
+    fun.set_value(1, 1);
+    std::vector<std::pair<int, int>> unsorted{{2, 5}, {4, 0}, {3, 7}};
+    std::vector<std::pair<int, int>> repeated{{2, 5}, {2, 6}};
+    EXPECT_THROW(fun.set_sorted_values(unsorted.begin(), unsorted.end()), InvalidArg);
+    EXPECT_THROW(fun.set_sorted_values(repeated.begin(), repeated.end()), InvalidArg);
+    EXPECT_EQ(fun.size(), 1u);
+}
+
+TEST(setValues, strongGuaranteeOnAllocationFailure) {
+    std::vector<std::pair<int, int>> updates{
+            {-1, 5}, {0, 100}, {1, 1}, {2, 2}, {4, 0}, {5, 9}, {7, 100}, {12, 3}};
+    for (long allowed = 0;; allowed++) {
+        FunctionMaxima<int, int> fun;
+        for (int i = 0; i < 10; i++)
+            fun.set_value(i, i % 3);
+        auto points = points_of(fun);
+        auto maxima = maxima_of(fun);
+
+        allocations_left = allowed;
+        try {
+            fun.set_values(updates.begin(), updates.end());
+            allocations_left = -1;
+            break;
+        } catch (const std::bad_alloc &) {
+            allocations_left = -1;
+            ASSERT_EQ(points_of(fun), points);
+            ASSERT_EQ(maxima_of(fun), maxima);
+        }
+    }
+}
+
+TEST(lazyMaxima, matchesEagerMode) {
+    std::mt19937 rng(2024);
+    FunctionMaxima<int, int> eager, lazy;
+    lazy.set_lazy_maxima(true);
+    ASSERT_TRUE(lazy.lazy_maxima());
+    auto same_points = [](const auto &p, const auto &q) {
+        return p.arg() == q.arg() && p.value() == q.value();
+    };
+    for (int round = 0; round < 50; round++) {
+        for (int i = 0; i < 200; i++) {
+            int a = static_cast<int>(rng() % 500), v = static_cast<int>(rng() % 20);
+            if (rng() % 4 == 0) {
+                eager.erase(a);
+                lazy.erase(a);
+            } else {
+                eager.set_value(a, v);
+                lazy.set_value(a, v);
+            }
+        }
+        if (round % 10 == 9 && eager.size() > 10) {
+            eager.erase_prefix(std::next(eager.begin(), 10));
+            lazy.erase_prefix(std::next(lazy.begin(), 10));
+        }
+        ASSERT_TRUE(std::equal(eager.begin(), eager.end(), lazy.begin(),
+                               lazy.end(), same_points));
+        ASSERT_TRUE(std::equal(eager.mx_begin(), eager.mx_end(),
+                               lazy.mx_begin(), lazy.mx_end(), same_points));
+    }
+
+    FunctionMaxima<int, int> copy(lazy);
+    lazy.set_value(1000, 1000);
+    lazy.set_lazy_maxima(false);
+    EXPECT_FALSE(copy.lazy_maxima());
+    EXPECT_EQ(lazy.mx_begin()->arg(), 1000);
+    EXPECT_TRUE(std::equal(eager.mx_begin(), eager.mx_end(), copy.mx_begin(),
+                           copy.mx_end(), same_points));
+}
+
+TEST(lazyMaxima, updatesLeaveMaximaAlone) {
+    FunctionMaxima<CountedArg, CountedValue> fun;
+    fun.set_lazy_maxima(true);
+    for (int i = 0; i < 1000; i++)
+        fun.set_value(i, i % 10);
+    fun.mx_begin();
+
+    // Only values equal to the old ones are looked for.
+    Worst worst;
+    for (int i = 0; i < 1000; i += 100)
+        worst.measure([&] { fun.set_value(i, 20); });
+    EXPECT_LE(worst.values, 2);
+
+    // Three points around each of the ten updates are re-evaluated.
+    long before = CountedValue::comparisons;
+    auto top = fun.mx_begin();
+    EXPECT_LE(CountedValue::comparisons - before, 30 * (2 + tree_search(200)));
+    EXPECT_FALSE(top->value() < 20 || CountedValue(20) < top->value());
+}
+
+TEST(maximaOrder, matchesLinearWalk) {
+    FunctionMaxima<int, int> fun;
+    for (int i = 0; i < 3000; i++)
+        fun.set_value((i * 7919) % 3001, (i * 31) % 211);
+    for (int i = 0; i < 3000; i += 11)
+        fun.erase(i);
+
+    std::size_t k = 0;
+    for (auto it = fun.mx_begin(); it != fun.mx_end(); ++it, ++k) {
+        ASSERT_TRUE(fun.nth_maximum(k) == it);
+        ASSERT_EQ(fun.mx_rank(it), k);
+    }
+    EXPECT_TRUE(fun.nth_maximum(k) == fun.mx_end());
+    EXPECT_EQ(fun.mx_rank(fun.mx_end()), k);
+
+    for (int v = -1; v <= 212; v++) {
+        std::size_t expected = 0;
+        for (auto it = fun.mx_begin(); it != fun.mx_end(); ++it)
+            expected += it->value() >= v;
+        ASSERT_EQ(fun.count_maxima_at_least(v), expected) << v;
+    }
+
+    fun.set_lazy_maxima(true);
+    fun.set_value(5000, 1000);
+    EXPECT_EQ(fun.nth_maximum(0)->arg(), 5000);
+    EXPECT_EQ(fun.count_maxima_at_least(1000), 1u);
+}
+
+TEST(nearestMaximum, matchesLinearWalk) {
+    FunctionMaxima<int, int> fun;
+    for (int i = 0; i < 2000; i++)
+        fun.set_value((i * 7919) % 2003 * 2, (i * 31) % 97);
+    for (int i = 0; i < 4000; i += 26)
+        fun.erase(i);
+    FunctionMaxima<int, int> copy(fun);
+    copy.set_lazy_maxima(true);
+    copy.set_value(4001, 1000);
+    copy.erase(4001);
+
+    for (const auto *f : {&fun, &copy}) {
+        std::set<int> maxima;
+        for (auto it = f->mx_begin(); it != f->mx_end(); ++it)
+            maxima.insert(it->arg());
+        for (int a = -1; a <= 4008; a++) {
+            auto after = maxima.upper_bound(a);
+            auto prev = f->prev_maximum(a);
+            if (after == maxima.begin())
+                ASSERT_TRUE(prev == f->end()) << a;
+            else
+                ASSERT_EQ(prev->arg(), *std::prev(after)) << a;
+
+            auto first = maxima.lower_bound(a);
+            auto next = f->next_maximum(a);
+            if (first == maxima.end())
+                ASSERT_TRUE(next == f->end()) << a;
+            else
+                ASSERT_EQ(next->arg(), *first) << a;
+        }
+    }
+}
+
+TEST(interning, equalPayloadsAreShared) {
+    auto args = std::make_shared<InternPool<int>>();
+    auto values = std::make_shared<InternPool<int>>();
+    {
+        FunctionMaxima<int, int> fun;
+        fun.set_intern_pools(args, values);
+        for (int i = 0; i < 1000; i++)
+            fun.set_value(i, i % 3);
+        EXPECT_EQ(args->size(), 1000u);
+        EXPECT_EQ(values->size(), 3u);
+        EXPECT_EQ(&fun.value_at(0), &fun.value_at(999));
+
+        FunctionMaxima<int, int> other = fun;
+        other.set_value(1000, 2);
+        EXPECT_EQ(&other.value_at(1000), &fun.value_at(2));
+        EXPECT_EQ(values->size(), 3u);
+
+        fun.set_intern_pools(nullptr, nullptr);
+        fun.set_value(1001, 1);
+        EXPECT_NE(&fun.value_at(1001), &fun.value_at(1));
+        for (int i = 0; i < 1000; i++)
+            other.erase(i);
+        EXPECT_EQ(args->size(), 1001u);
+    }
+    // Entries go away with the last function holding them.
+    EXPECT_EQ(args->size(), 0u);
+    EXPECT_EQ(values->size(), 0u);
+}
+
+TEST(readModifyWrite, matchesFindThenSetValue) {
+    FunctionMaxima<int, int> fun, expected;
+    std::mt19937 rng(17);
+    for (int step = 0; step < 3000; step++) {
+        int a = static_cast<int>(rng() % 60);
+        int v = static_cast<int>(rng() % 40);
+        if (step % 2 == 0) {
+            // Increment, starting from v when missing.
+            fun.update(a, [&](const int *old) {
+                return std::optional<int>(old ? *old + 1 : v);
+            });
+            auto it = expected.find(a);
+            expected.set_value(a, it != expected.end() ? it->value() + 1 : v);
+        } else {
+            // Keep the maximum of the old and the new value.
+            fun.set_value_if(a, v, [&](const int *old) {
+                return !old || *old < v;
+            });
+            auto it = expected.find(a);
+            if (it == expected.end() || it->value() < v)
+                expected.set_value(a, v);
+        }
+        ASSERT_EQ(points_of(fun), points_of(expected));
+        ASSERT_EQ(maxima_of(fun), maxima_of(expected));
+    }
+
+    // Declining leaves a missing argument missing.
+    fun.update(1000, [](const int *) { return std::optional<int>(); });
+    fun.set_value_if(1000, 1, [](const int *old) { return old != nullptr; });
+    EXPECT_TRUE(fun.find(1000) == fun.end());
+}
+
+TEST(readModifyWrite, strongGuarantee) {
+    FunctionMaxima<ThrowsOnCompare, ThrowsOnCompare> fun;
+    fun.set_value(ThrowsOnCompare::create(1), ThrowsOnCompare::create(10));
+    fun.set_value(ThrowsOnCompare::create(2), ThrowsOnCompare::create(20));
+
+    EXPECT_THROW(fun.update(ThrowsOnCompare::create(3), [](const auto *old) {
+        EXPECT_EQ(old, nullptr);
+        return std::optional(ThrowsOnCompare::create(SPECIAL_THROW_VALUE));
+    }), std::string);
+    EXPECT_THROW(fun.set_value_if(ThrowsOnCompare::create(1),
+                                  ThrowsOnCompare::create(SPECIAL_THROW_VALUE),
+                                  [](const auto *old) { return old->get() == 10; }),
+                 std::string);
+    ASSERT_EQ(fun.size(), 2u);
+    EXPECT_EQ(fun.begin()->value().get(), 10);
+    EXPECT_EQ(std::next(fun.begin())->value().get(), 20);
+    EXPECT_EQ(fun.mx_begin()->value().get(), 20);
+}
+
+namespace {
+
+// Argument order of the maxima, as seen through prev_maximum.
+std::vector<int> maxima_by_arg(const FunctionMaxima<int, int> &f) {
+    std::vector<int> result;
+    for (auto it = f.next_maximum(-1000); it != f.end();
+         it = f.next_maximum(it->arg() + 1))
+        result.push_back(it->arg());
+    return result;
+}
+
+}
+
+TEST(nodeHandles, extractAndInsertKeepPayloads) {
+    FunctionMaxima<int, int> from, to;
+    for (int i = 0; i < 10; i++) {
+        from.set_value(i, i % 4);
+        to.set_value(i + 5, i % 3);
+    }
+    const int *payload = &from.value_at(3);
+
+    auto node = from.extract(3);
+    ASSERT_FALSE(node.empty());
+    EXPECT_EQ(&node.value(), payload);
+    EXPECT_TRUE(from.find(3) == from.end());
+    EXPECT_TRUE(from.extract(3).empty());
+
+    // An argument already present gives the node back.
+    auto taken = to.insert(from.extract(7));
+    EXPECT_FALSE(taken.inserted);
+    ASSERT_TRUE(taken.node);
+    EXPECT_EQ(taken.position->arg(), 7);
+    from.insert(std::move(taken.node));
+
+    to.insert(std::move(node));
+    EXPECT_EQ(&to.value_at(3), payload);
+
+    FunctionMaxima<int, int> expected_from, expected_to;
+    for (int i = 0; i < 10; i++) {
+        if (i != 3)
+            expected_from.set_value(i, i % 4);
+        expected_to.set_value(i + 5, i % 3);
+    }
+    expected_to.set_value(3, 3);
+    EXPECT_EQ(points_of(from), points_of(expected_from));
+    EXPECT_EQ(maxima_of(from), maxima_of(expected_from));
+    EXPECT_EQ(points_of(to), points_of(expected_to));
+    EXPECT_EQ(maxima_of(to), maxima_of(expected_to));
+    EXPECT_EQ(maxima_by_arg(to), maxima_by_arg(expected_to));
+}
+
+TEST(nodeHandles, mergeMatchesSetValue) {
+    std::mt19937 rng(23);
+    for (int round = 0; round < 200; round++) {
+        FunctionMaxima<int, int> fun, other, expected, expected_other;
+        // Disjoint, overlapping and interleaved argument ranges.
+        int offset = static_cast<int>(rng() % 3) * 50;
+        int step = 1 + static_cast<int>(rng() % 2);
+        for (int i = 0; i < 40; i++) {
+            int a = static_cast<int>(rng() % 100) * step;
+            int v = static_cast<int>(rng() % 10);
+            fun.set_value(a, v);
+            expected.set_value(a, v);
+        }
+        for (int i = 0; i < 40; i++) {
+            int a = static_cast<int>(rng() % 100) + offset;
+            int v = static_cast<int>(rng() % 10);
+            other.set_value(a, v);
+        }
+        for (const auto &p : other) {
+            if (expected.find(p.arg()) == expected.end())
+                expected.set_value(p.arg(), p.value());
+            else
+                expected_other.set_value(p.arg(), p.value());
+        }
+        if (round % 2 == 0)
+            other.set_lazy_maxima(true);
+
+        fun.merge(other);
+        ASSERT_EQ(points_of(fun), points_of(expected));
+        ASSERT_EQ(maxima_of(fun), maxima_of(expected));
+        ASSERT_EQ(maxima_by_arg(fun), maxima_by_arg(expected));
+        ASSERT_EQ(points_of(other), points_of(expected_other));
+        ASSERT_EQ(maxima_of(other), maxima_of(expected_other));
+        ASSERT_EQ(maxima_by_arg(other), maxima_by_arg(expected_other));
+
+        // Both stay fully operational.
+        fun.set_value(offset + 1, 5);
+        expected.set_value(offset + 1, 5);
+        other.erase(offset + 2);
+        expected_other.erase(offset + 2);
+        ASSERT_EQ(maxima_of(fun), maxima_of(expected));
+        ASSERT_EQ(maxima_of(other), maxima_of(expected_other));
+    }
+}
+
+TEST(nodeHandles, mergeStrongGuaranteeOnAllocationFailure) {
+    for (long allowed = 0;; allowed++) {
+        FunctionMaxima<int, int> fun, other;
+        for (int i = 0; i < 20; i++) {
+            fun.set_value(3 * i, i % 4);
+            other.set_value(3 * i + (i % 3), (i * 7) % 5);
+        }
+        auto points = points_of(fun), other_points = points_of(other);
+        auto maxima = maxima_of(fun), other_maxima = maxima_of(other);
+
+        allocations_left = allowed;
+        try {
+            fun.merge(other);
+            allocations_left = -1;
+            break;
+        } catch (const std::bad_alloc &) {
+            allocations_left = -1;
+            ASSERT_EQ(points_of(fun), points);
+            ASSERT_EQ(maxima_of(fun), maxima);
+            ASSERT_EQ(points_of(other), other_points);
+            ASSERT_EQ(maxima_of(other), other_maxima);
+            ASSERT_EQ(maxima_by_arg(other).size(), other_maxima.size());
+        }
+    }
+}
+
+TEST(nodeHandles, mergeWithThrowingComparisons) {
+    FunctionMaxima<ThrowsOnCompare, ThrowsOnCompare> fun, other;
+    for (int i = 0; i < 5; i++) {
+        fun.set_value(ThrowsOnCompare::create(2 * i), ThrowsOnCompare::create(i));
+        other.set_value(ThrowsOnCompare::create(2 * i + 1),
+                        ThrowsOnCompare::create(5 - i));
+    }
+    other.set_value(ThrowsOnCompare::create(2), ThrowsOnCompare::create(9));
+    fun.merge(other);
+    ASSERT_EQ(fun.size(), 10u);
+    ASSERT_EQ(other.size(), 1u);
+    EXPECT_EQ(other.begin()->value().get(), 9);
+    int expected_arg = 0;
+    for (const auto &p : fun)
+        EXPECT_EQ(p.arg().get(), expected_arg++);
+    EXPECT_EQ(fun.mx_begin()->arg().get(), 1);
+}
+
+TEST(splitJoin, matchesRebuiltFunctions) {
+    std::mt19937 rng(29);
+    for (int round = 0; round < 200; round++) {
+        FunctionMaxima<int, int> fun, expected_lo, expected_hi;
+        int n = static_cast<int>(rng() % 40);
+        // Cuts near either end move either part.
+        int cut = static_cast<int>(rng() % 110) - 5;
+        for (int i = 0; i < n; i++) {
+            int a = static_cast<int>(rng() % 100);
+            int v = static_cast<int>(rng() % 6);
+            fun.set_value(a, v);
+        }
+        for (const auto &p : fun)
+            (p.arg() < cut ? expected_lo : expected_hi).set_value(p.arg(),
+                                                                  p.value());
+        auto whole = points_of(fun);
+        auto whole_maxima = maxima_of(fun);
+
+        FunctionMaxima<int, int> hi = fun.split(cut);
+        ASSERT_EQ(points_of(fun), points_of(expected_lo));
+        ASSERT_EQ(maxima_of(fun), maxima_of(expected_lo));
+        ASSERT_EQ(maxima_by_arg(fun), maxima_by_arg(expected_lo));
+        ASSERT_EQ(points_of(hi), points_of(expected_hi));
+        ASSERT_EQ(maxima_of(hi), maxima_of(expected_hi));
+        ASSERT_EQ(maxima_by_arg(hi), maxima_by_arg(expected_hi));
+
+        auto joined = FunctionMaxima<int, int>::join(std::move(fun),
+                                                     std::move(hi));
+        ASSERT_EQ(points_of(joined), whole);
+        ASSERT_EQ(maxima_of(joined), whole_maxima);
+
+        // The parts stay fully operational.
+        fun.set_value(cut - 1, 3);
+        expected_lo = FunctionMaxima<int, int>();
+        expected_lo.set_value(cut - 1, 3);
+        ASSERT_EQ(maxima_of(fun), maxima_of(expected_lo));
+    }
+}
+
+TEST(splitJoin, splitMovesPayloadsAndKeepsSettings) {
+    FunctionMaxima<int, int> fun;
+    fun.set_lazy_maxima(true);
+    for (int i = 0; i < 10; i++)
+        fun.set_value(i, i % 3);
+    const int *low = &fun.value_at(1), *high = &fun.value_at(8);
+
+    auto hi = fun.split(2);
+    EXPECT_EQ(&fun.value_at(1), low);
+    EXPECT_EQ(&hi.value_at(8), high);
+    EXPECT_TRUE(hi.lazy_maxima());
+    EXPECT_EQ(fun.size(), 2u);
+    EXPECT_EQ(hi.size(), 8u);
+}
+
+TEST(splitJoin, joinRejectsOverlappingArguments) {
+    FunctionMaxima<int, int> lo, hi;
+    lo.set_value(1, 1);
+    lo.set_value(5, 2);
+    hi.set_value(5, 3);
+    hi.set_value(7, 1);
+    using Function = FunctionMaxima<int, int>;
+    EXPECT_THROW((Function::join(std::move(lo), std::move(hi))), InvalidArg);
+    EXPECT_EQ(lo.size(), 2u);
+    EXPECT_EQ(hi.size(), 2u);
+
+    FunctionMaxima<int, int> empty;
+    auto joined = FunctionMaxima<int, int>::join(std::move(empty),
+                                                 std::move(hi));
+    EXPECT_EQ(joined.size(), 2u);
+}
+
+TEST(splitJoin, splitStrongGuaranteeOnAllocationFailure) {
+    for (long allowed = 0;; allowed++) {
+        FunctionMaxima<int, int> fun;
+        for (int i = 0; i < 20; i++)
+            fun.set_value(i, (i * 7) % 5);
+        auto points = points_of(fun);
+        auto maxima = maxima_of(fun);
+
+        allocations_left = allowed;
+        try {
+            auto hi = fun.split(allowed % 2 == 0 ? 4 : 15);
+            allocations_left = -1;
+            break;
+        } catch (const std::bad_alloc &) {
+            allocations_left = -1;
+            ASSERT_EQ(points_of(fun), points);
+            ASSERT_EQ(maxima_of(fun), maxima);
+            ASSERT_EQ(maxima_by_arg(fun).size(), maxima.size());
+        }
+    }
+}
+
+TEST(splitJoin, splitWithThrowingComparisons) {
+    FunctionMaxima<ThrowsOnCompare, ThrowsOnCompare> fun;
+    for (int i = 0; i < 6; i++)
+        fun.set_value(ThrowsOnCompare::create(i), ThrowsOnCompare::create(i % 3));
+    auto hi = fun.split(ThrowsOnCompare::create(3));
+    ASSERT_EQ(fun.size(), 3u);
+    ASSERT_EQ(hi.size(), 3u);
+    EXPECT_EQ(fun.mx_begin()->arg().get(), 2);
+    EXPECT_EQ(hi.mx_begin()->arg().get(), 5);
+    EXPECT_EQ(std::next(hi.mx_begin()), hi.mx_end());
+}
+
+TEST(threadingPolicy, singleThreadedMatchesMultiThreaded) {
+    std::mt19937 rng(31);
+    FunctionMaxima<int, int, SingleThreaded> fun;
+    FunctionMaxima<int, int> expected;
+    for (int i = 0; i < 2000; i++) {
+        int a = static_cast<int>(rng() % 200);
+        int v = static_cast<int>(rng() % 10);
+        if (rng() % 4 == 0) {
+            fun.erase(a);
+            expected.erase(a);
+        } else {
+            fun.set_value(a, v);
+            expected.set_value(a, v);
+        }
+    }
+    ASSERT_EQ(points_of(fun), points_of(expected));
+    ASSERT_EQ(maxima_of(fun), maxima_of(expected));
+
+    // Copies share payloads and outlive the function they came from.
+    std::vector<FunctionMaxima<int, int, SingleThreaded>::point_type> kept;
+    {
+        FunctionMaxima<int, int, SingleThreaded> copy = fun;
+        EXPECT_EQ(&copy.begin()->arg(), &fun.begin()->arg());
+        for (const auto &p : copy)
+            kept.push_back(p);
+        fun = FunctionMaxima<int, int, SingleThreaded>();
+    }
+    ASSERT_EQ(kept.size(), expected.size());
+    auto it = expected.begin();
+    for (const auto &p : kept) {
+        EXPECT_EQ(p.arg(), it->arg());
+        EXPECT_EQ(p.value(), (it++)->value());
+    }
+}
+
+TEST(threadingPolicy, singleThreadedInterning) {
+    auto values = std::make_shared<InternPool<int>>();
+    {
+        FunctionMaxima<int, int, SingleThreaded> fun;
+        fun.set_intern_pools(nullptr, values);
+        for (int i = 0; i < 100; i++)
+            fun.set_value(i, i % 3);
+        EXPECT_EQ(values->size(), 3u);
+        EXPECT_EQ(&fun.value_at(0), &fun.value_at(99));
+    }
+    EXPECT_EQ(values->size(), 0u);
+}
+
+TEST(memoryUsage, splitsOwnAndSharedPayloads) {
+    FunctionMaxima<int, int> fun;
+    MaximaMemory empty = fun.memory_usage();
+    EXPECT_EQ(empty.points + empty.maxima + empty.args + empty.values, 0u);
+    EXPECT_EQ(empty.total(), empty.bookkeeping);
+
+    for (int i = 0; i < 100; i++)
+        fun.set_value(i, i % 3);
+    MaximaMemory own = fun.exact_memory_usage();
+    EXPECT_GT(own.points, 0u);
+    EXPECT_GT(own.maxima, 0u);
+    EXPECT_EQ(own.args, 100 * sizeof(int));
+    EXPECT_EQ(own.values, 100 * sizeof(int));
+    EXPECT_EQ(own.shared_args + own.shared_values, 0u);
+
+    // A copy takes half of every payload.
+    FunctionMaxima<int, int> copy = fun;
+    MaximaMemory shared = fun.exact_memory_usage();
+    EXPECT_EQ(shared.args + shared.values, 0u);
+    EXPECT_EQ(shared.shared_args, 50 * sizeof(int));
+    EXPECT_EQ(shared.shared_values, 50 * sizeof(int));
+    EXPECT_EQ(shared.control_blocks * 2, own.control_blocks);
+    EXPECT_EQ(shared.points, own.points);
+    EXPECT_EQ(shared.maxima, own.maxima);
+
+    // Fewer maxima take fewer index nodes.
+    for (int i = 0; i < 100; i++)
+        copy.set_value(i, i);
+    EXPECT_LT(copy.memory_usage().maxima, own.maxima);
+}
+
+TEST(memoryUsage, internedPayloadsCountOnce) {
+    FunctionMaxima<int, int, SingleThreaded> fun;
+    fun.set_intern_pools(nullptr, std::make_shared<InternPool<int>>());
+    for (int i = 0; i < 100; i++)
+        fun.set_value(i, i % 3);
+    MaximaMemory usage = fun.exact_memory_usage();
+    EXPECT_EQ(usage.args, 100 * sizeof(int));
+    EXPECT_EQ(usage.values, 0u);
+    EXPECT_EQ(usage.shared_values, 3 * sizeof(int));
+}
+
+TEST(memoryUsage, summaryCountsPayloadsAsOwn) {
+    FunctionMaxima<int, int> fun;
+    for (int i = 0; i < 100; i++)
+        fun.set_value(i, i % 3);
+    MaximaMemory summary = fun.memory_usage();
+    MaximaMemory exact = fun.exact_memory_usage();
+    EXPECT_EQ(summary.total(), exact.total());
+    EXPECT_EQ(summary.control_blocks, exact.control_blocks);
+
+    // Sharing is not looked at.
+    FunctionMaxima<int, int> copy = fun;
+    MaximaMemory shared = fun.memory_usage();
+    EXPECT_EQ(shared.args, summary.args);
+    EXPECT_EQ(shared.shared_args + shared.shared_values, 0u);
+    EXPECT_EQ(shared.total(), summary.total());
+}
+
+TEST(slabPool, reservedMatchesHeapFunction) {
+    std::mt19937 rng(37);
+    FunctionMaxima<int, int> fun, expected;
+    fun.reserve(50);
+    for (int i = 0; i < 3000; i++) {
+        int a = static_cast<int>(rng() % 300);
+        int v = static_cast<int>(rng() % 10);
+        if (rng() % 4 == 0) {
+            fun.erase(a);
+            expected.erase(a);
+        } else {
+            fun.set_value(a, v);
+            expected.set_value(a, v);
+        }
+        if (i == 1500)
+            fun.shrink_to_fit();
+    }
+    ASSERT_EQ(points_of(fun), points_of(expected));
+    ASSERT_EQ(maxima_of(fun), maxima_of(expected));
+    ASSERT_EQ(maxima_by_arg(fun), maxima_by_arg(expected));
+
+    // Reserving for a function with points moves them to the pool.
+    expected.set_lazy_maxima(true);
+    expected.reserve(0);
+    EXPECT_TRUE(expected.lazy_maxima());
+    expected.set_value(1000, 100);
+    fun.set_value(1000, 100);
+    ASSERT_EQ(points_of(expected), points_of(fun));
+    ASSERT_EQ(maxima_of(expected), maxima_of(fun));
+    EXPECT_EQ(expected.memory_usage().points, fun.memory_usage().points);
+}
+
+TEST(slabPool, insertionsWithinReserveDoNotAllocate) {
+    FunctionMaxima<int, int> fun;
+    for (int i = 0; i < 10; i++)
+        fun.set_value(i, i % 3);
+    fun.reserve(100);
+    EXPECT_GT(fun.memory_usage().reserved, 0u);
+
+    allocations_left = 0;
+    for (int i = 10; i < 100; i++)
+        fun.set_value(i, i % 7);
+    for (int i = 0; i < 100; i += 2)
+        fun.erase(i);
+    for (int i = 0; i < 100; i += 2)
+        fun.set_value(i, 8);
+    allocations_left = -1;
+    EXPECT_EQ(fun.size(), 100u);
+    EXPECT_EQ(fun.mx_begin()->value(), 8);
+}
+
+TEST(slabPool, splitPartsSharePoolAndNodesMoveAcrossPools) {
+    FunctionMaxima<int, int> fun, other;
+    fun.reserve(100);
+    other.reserve(100);
+    for (int i = 0; i < 40; i++) {
+        fun.set_value(2 * i, i % 5);
+        other.set_value(2 * i + 1, i % 4);
+    }
+    auto hi = fun.split(60);
+    EXPECT_EQ(hi.memory_usage().reserved, fun.memory_usage().reserved);
+    auto whole = FunctionMaxima<int, int>::join(std::move(fun), std::move(hi));
+    EXPECT_EQ(whole.size(), 40u);
+
+    // Other pools give copies sharing the payloads.
+    const int *value = &other.value_at(1);
+    auto node = other.extract(1);
+    auto inserted = whole.insert(std::move(node));
+    ASSERT_TRUE(inserted.inserted);
+    EXPECT_EQ(&inserted.position->value(), value);
+
+    FunctionMaxima<int, int> expected = whole;
+    for (const auto &p : other)
+        expected.set_value(p.arg(), p.value());
+    whole.merge(other);
+    EXPECT_EQ(other.size(), 0u);
+    ASSERT_EQ(points_of(whole), points_of(expected));
+    ASSERT_EQ(maxima_of(whole), maxima_of(expected));
+    ASSERT_EQ(maxima_by_arg(whole), maxima_by_arg(expected));
+}
+
+TEST(slabPool, shrinkToFitFreesUnusedSlabs) {
+    std::vector<FunctionMaxima<int, int>::point_type> kept;
+    {
+        FunctionMaxima<int, int> fun;
+        fun.reserve(10000);
+        for (int i = 0; i < 10000; i++)
+            fun.set_value(i, i % 100);
+        for (int i = 0; i < 9990; i++)
+            fun.erase(i);
+        std::size_t reserved = fun.memory_usage().reserved;
+        fun.shrink_to_fit();
+        EXPECT_LT(fun.memory_usage().reserved, reserved / 10);
+        for (const auto &p : fun)
+            kept.push_back(p);
+    }
+    // Payloads keep the pool until they are gone.
+    ASSERT_EQ(kept.size(), 10u);
+    EXPECT_EQ(kept.front().arg(), 9990);
+    EXPECT_EQ(kept.back().value(), 99);
+}
+
+TEST(slabPool, strongGuaranteeOnAllocationFailure) {
+    for (long allowed = 0;; allowed++) {
+        FunctionMaxima<int, int> fun;
+        fun.reserve(10);
+        allocations_left = allowed;
+        try {
+            fun.set_value(1, 1);
+            allocations_left = -1;
+            break;
+        } catch (const std::bad_alloc &) {
+            allocations_left = -1;
+            ASSERT_EQ(fun.size(), 0u);
+            ASSERT_EQ(fun.mx_begin(), fun.mx_end());
+        }
+    }
+}
@@ -0,0 +1,221 @@
+#include "gtest/gtest.h"
+#include "../src/order_statistics_tree.h"
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Ordered by key only, id tells equal elements apart.
+struct Item {
+  int key;
+  int id;
+};
+
+struct ByKey {
+  static bool armed;
+  bool operator()(const Item &x, const Item &y) const {
+    if (armed)
+      throw std::string("BOOM");
+    return x.key < y.key;
+  }
+};
+bool ByKey::armed = false;
+
+using Tree = OrderStatisticsTree<Item, ByKey>;
+
+// Keeps the number of nodes it has allocated and not freed in `*live`.
+template<typename T>
+struct CountingAllocator {
+  using value_type = T;
+  int *live;
+
+  explicit CountingAllocator(int *counter) : live(counter) {}
+
+  template<typename U>
+  CountingAllocator(const CountingAllocator<U> &other) : live(other.live) {}
+
+  T *allocate(std::size_t n) {
+    T *p = std::allocator<T>().allocate(n);
+    *live += static_cast<int>(n);
+    return p;
+  }
+
+  void deallocate(T *p, std::size_t n) noexcept {
+    *live -= static_cast<int>(n);
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template<typename U>
+  bool operator==(const CountingAllocator<U> &other) const {
+    return live == other.live;
+  }
+
+  template<typename U>
+  bool operator!=(const CountingAllocator<U> &other) const {
+    return live != other.live;
+  }
+};
+
+std::vector<int> ids(const Tree &tree) {
+  std::vector<int> result;
+  for (const Item &item : tree)
+    result.push_back(item.id);
+  return result;
+}
+
+// Checks links and sizes against a walk of the whole tree.
+void expect_consistent(const Tree &tree) {
+  std::size_t i = 0;
+  for (auto it = tree.begin(); it != tree.end(); ++it, ++i) {
+    ASSERT_TRUE(tree.find_by_order(i) == it);
+    ASSERT_EQ(tree.rank(it), i);
+    if (it != tree.begin()) {
+      ASSERT_FALSE(it->key < std::prev(it)->key);
+    }
+  }
+  EXPECT_EQ(tree.size(), i);
+  EXPECT_TRUE(tree.find_by_order(i) == tree.end());
+  EXPECT_EQ(tree.rank(tree.end()), i);
+  if (i > 0) {
+    EXPECT_EQ(std::prev(tree.end())->id, tree.find_by_order(i - 1)->id);
+  }
+}
+
+}
+
+TEST(orderStatistics, matchesSortedVector) {
+  std::mt19937 rng(42);
+  Tree tree;
+  std::vector<Item> expected;
+  std::vector<Tree::iterator> handles;
+  for (int id = 0; id < 2000; id++) {
+    Item item{static_cast<int>(rng() % 100), id};
+    handles.push_back(tree.insert(item));
+    auto pos = std::upper_bound(
+        expected.begin(), expected.end(), item,
+        [](const Item &x, const Item &y) { return x.key < y.key; });
+    expected.insert(pos, item);
+  }
+  for (int id = 0; id < 2000; id += 3) {
+    tree.erase(handles[static_cast<std::size_t>(id)]);
+    expected.erase(std::find_if(expected.begin(), expected.end(),
+                                [id](const Item &x) { return x.id == id; }));
+  }
+
+  std::vector<int> expected_ids;
+  for (const Item &item : expected)
+    expected_ids.push_back(item.id);
+  EXPECT_EQ(ids(tree), expected_ids);
+  expect_consistent(tree);
+
+  for (int key = -1; key <= 100; key++) {
+    auto below = std::count_if(expected.begin(), expected.end(),
+                               [key](const Item &x) { return x.key < key; });
+    ASSERT_EQ(tree.prefix_length([key](const Item &x) { return x.key < key; }),
+              static_cast<std::size_t>(below));
+  }
+}
+
+TEST(orderStatistics, pushBackMakesNoComparisons) {
+  Tree tree;
+  ByKey::armed = true;
+  for (int i = 0; i < 100; i++)
+    tree.push_back({i / 2, i});
+  ByKey::armed = false;
+  EXPECT_EQ(tree.size(), 100u);
+  EXPECT_EQ(tree.find_by_order(37)->id, 37);
+  expect_consistent(tree);
+}
+
+TEST(orderStatistics, failedInsertChangesNothing) {
+  Tree tree;
+  for (int i = 0; i < 10; i++)
+    tree.insert({i, i});
+  ByKey::armed = true;
+  EXPECT_THROW(tree.insert({5, 10}), std::string);
+  ByKey::armed = false;
+  EXPECT_EQ(ids(tree), (std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+  expect_consistent(tree);
+}
+
+TEST(orderStatistics, copyIsIndependent) {
+  Tree tree;
+  for (int i = 0; i < 50; i++)
+    tree.insert({i % 7, i});
+  Tree copy(tree);
+  expect_consistent(copy);
+  EXPECT_EQ(ids(copy), ids(tree));
+
+  copy.erase(copy.begin());
+  copy.insert({100, 50});
+  EXPECT_EQ(tree.size(), 50u);
+  EXPECT_EQ(std::prev(copy.end())->id, 50);
+  expect_consistent(tree);
+  expect_consistent(copy);
+
+  tree = copy;
+  EXPECT_EQ(ids(tree), ids(copy));
+}
+
+TEST(orderStatistics, nodesMoveBetweenTrees) {
+  Tree from, to;
+  for (int id = 0; id < 50; id++) {
+    from.insert(Item{id % 10, id});
+    to.insert(Item{id % 7, 100 + id});
+  }
+  std::vector<Tree::iterator> moved;
+  for (auto it = from.begin(); it != from.end(); ++it)
+    if (it->id % 3 == 0)
+      moved.push_back(it);
+  for (auto &it : moved) {
+    auto node = from.extract(it);
+    const Item *address = &node.value();
+    node.value().key += 1;
+    auto placed = to.insert(std::move(node));
+    ASSERT_TRUE(node.empty());
+    ASSERT_EQ(&*placed, address);
+  }
+  EXPECT_EQ(from.size(), 33u);
+  EXPECT_EQ(to.size(), 67u);
+  expect_consistent(from);
+  expect_consistent(to);
+
+  // A failed insert keeps the node.
+  auto node = to.extract(to.begin());
+  ByKey::armed = true;
+  EXPECT_THROW(from.insert(std::move(node)), std::string);
+  ByKey::armed = false;
+  ASSERT_FALSE(node.empty());
+  from.insert(std::move(node));
+  expect_consistent(from);
+}
+
+TEST(orderStatistics, nodesComeFromTheAllocator) {
+  using CountedTree = OrderStatisticsTree<Item, ByKey, CountingAllocator<Item>>;
+  int live = 0, copied = 0;
+  {
+    CountedTree tree{CountingAllocator<Item>(&live)};
+    for (int i = 0; i < 10; i++)
+      tree.insert({i, i});
+    EXPECT_EQ(live, 10);
+
+    CountedTree copy(tree, CountingAllocator<Item>(&copied));
+    EXPECT_EQ(copied, 10);
+    EXPECT_EQ(live, 10);
+
+    // Extracted nodes are freed by the tree's allocator.
+    { auto node = tree.extract(tree.begin()); }
+    EXPECT_EQ(live, 9);
+    tree.erase(tree.begin());
+    EXPECT_EQ(live, 8);
+
+    // Assignment takes the allocator along.
+    tree = copy;
+    EXPECT_EQ(live, 0);
+    EXPECT_EQ(copied, 20);
+  }
+  EXPECT_EQ(copied, 0);
+}
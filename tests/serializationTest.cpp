@@ -0,0 +1,177 @@
+#include "gtest/gtest.h"
+#include "../src/function_maxima_io.h"
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+template<typename A, typename V>
+std::vector<std::pair<A, V>> points_of(const FunctionMaxima<A, V> &F) {
+  std::vector<std::pair<A, V>> v;
+  for (const auto &p : F)
+    v.emplace_back(p.arg(), p.value());
+  return v;
+}
+
+template<typename A, typename V>
+std::vector<std::pair<A, V>> maxima_of(const FunctionMaxima<A, V> &F) {
+  std::vector<std::pair<A, V>> v;
+  for (auto it = F.mx_begin(); it != F.mx_end(); ++it)
+    v.emplace_back(it->arg(), it->value());
+  return v;
+}
+
+// Value type without a default constructor, encoded by a user codec.
+class Tag {
+public:
+  static Tag create(int v) { return Tag(v); }
+  int get() const { return value; }
+  bool operator<(const Tag &t) const { return value < t.value; }
+  bool operator==(const Tag &t) const { return value == t.value; }
+private:
+  explicit Tag(int v) : value(v) {}
+  int value;
+};
+
+struct TagCodec {
+  static void write(std::ostream &os, const Tag &t) {
+    MaximaCodec<int>::write(os, t.get());
+  }
+  static Tag read(std::istream &is) {
+    return Tag::create(MaximaCodec<int>::read(is));
+  }
+};
+
+}
+
+TEST(serialization, roundTrip) {
+  FunctionMaxima<int, double> fun;
+  for (int i = 0; i < 1000; i++)
+    fun.set_value((i * 7919) % 1000, (i * 31) % 17 - 8.5);
+  fun.erase(3);
+
+  std::stringstream ss;
+  serialize(fun, ss);
+  auto loaded = deserialize<int, double>(ss);
+
+  ASSERT_EQ(loaded.size(), fun.size());
+  ASSERT_EQ(points_of(loaded), points_of(fun));
+  ASSERT_EQ(maxima_of(loaded), maxima_of(fun));
+  // Maxima in argument order are rebuilt as well.
+  for (int a = 0; a < 1000; a += 37) {
+    auto prev = fun.prev_maximum(a);
+    ASSERT_EQ(loaded.prev_maximum(a) == loaded.end(), prev == fun.end());
+    if (prev != fun.end()) {
+      ASSERT_EQ(loaded.prev_maximum(a)->arg(), prev->arg());
+    }
+    auto next = fun.next_maximum(a);
+    ASSERT_EQ(loaded.next_maximum(a) == loaded.end(), next == fun.end());
+    if (next != fun.end()) {
+      ASSERT_EQ(loaded.next_maximum(a)->arg(), next->arg());
+    }
+  }
+
+  // The loaded function stays fully operational.
+  loaded.set_value(3, 100.0);
+  fun.set_value(3, 100.0);
+  ASSERT_EQ(maxima_of(loaded), maxima_of(fun));
+}
+
+TEST(serialization, emptyAndStrings) {
+  FunctionMaxima<std::string, std::string> empty;
+  std::stringstream ss;
+  serialize(empty, ss);
+  ASSERT_EQ((deserialize<std::string, std::string>(ss).size()), 0u);
+
+  FunctionMaxima<std::string, std::string> fun;
+  fun.set_value("Ala", "ma");
+  fun.set_value("Kot", "kota");
+  fun.set_value("Tom", std::string(10000, 'x'));
+  std::stringstream ss2;
+  serialize(fun, ss2);
+  auto loaded = deserialize<std::string, std::string>(ss2);
+  ASSERT_EQ(points_of(loaded), points_of(fun));
+  ASSERT_EQ(maxima_of(loaded), maxima_of(fun));
+}
+
+TEST(serialization, littleEndianLayout) {
+  FunctionMaxima<std::uint16_t, std::uint8_t> fun;
+  fun.set_value(0x0102, 7);
+  std::stringstream ss;
+  serialize(fun, ss);
+  const std::string expected("FMAX\x01\0\0\0"
+                             "\x01\0\0\0\0\0\0\0"
+                             "\x01\0\0\0\0\0\0\0"
+                             "\x01\x02\x01\x07"
+                             "\0\0\0\0\0\0\0\0", 36);
+  ASSERT_EQ(ss.str(), expected);
+}
+
+TEST(serialization, userCodec) {
+  FunctionMaxima<int, Tag> fun;
+  fun.set_value(1, Tag::create(5));
+  fun.set_value(2, Tag::create(3));
+  fun.set_value(3, Tag::create(5));
+  std::stringstream ss;
+  serialize<int, Tag, MaximaCodec<int>, TagCodec>(fun, ss);
+  auto loaded = deserialize<int, Tag, MaximaCodec<int>, TagCodec>(ss);
+  ASSERT_EQ(points_of(loaded), points_of(fun));
+  ASSERT_EQ(maxima_of(loaded), maxima_of(fun));
+}
+
+TEST(serialization, fileDescriptor) {
+  FunctionMaxima<int, int> fun;
+  for (int i = 0; i < 100000; i++)
+    fun.set_value(i, i % 10);
+
+  FILE *tmp = std::tmpfile();
+  ASSERT_NE(tmp, nullptr);
+  int fd = fileno(tmp);
+  serialize(fun, fd);
+  ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+  auto loaded = deserialize<int, int>(fd);
+  std::fclose(tmp);
+
+  ASSERT_EQ(points_of(loaded), points_of(fun));
+  ASSERT_EQ(maxima_of(loaded), maxima_of(fun));
+}
+
+TEST(serialization, rejectsMalformedInput) {
+  FunctionMaxima<int, int> fun;
+  fun.set_value(1, 1);
+  fun.set_value(2, 0);
+  std::stringstream ss;
+  serialize(fun, ss);
+  const std::string good = ss.str();
+
+  std::stringstream truncated(good.substr(0, good.size() - 1));
+  EXPECT_THROW((deserialize<int, int>(truncated)), InvalidFormat);
+
+  std::string bad_magic = good;
+  bad_magic[0] = 'X';
+  std::stringstream s1(bad_magic);
+  EXPECT_THROW((deserialize<int, int>(s1)), InvalidFormat);
+
+  // Rank of the only maximum out of range.
+  std::string bad_rank = good;
+  bad_rank[bad_rank.size() - 8] = 1;
+  std::stringstream s2(bad_rank);
+  EXPECT_THROW((deserialize<int, int>(s2)), InvalidFormat);
+
+  // Arguments not increasing: the third one overwritten with the first.
+  fun.set_value(3, 5);
+  std::stringstream ss3;
+  serialize(fun, ss3);
+  std::string unsorted = ss3.str();
+  // Header of 24 bytes, then flags, argument and value of each point.
+  const std::size_t third_arg = 24 + 2 * 9 + 1;
+  unsorted.replace(third_arg, 4, std::string("\x01\x00\x00\x00", 4));
+  std::stringstream s3(unsorted);
+  EXPECT_THROW((deserialize<int, int>(s3)), InvalidFormat);
+  // Equal arguments are rejected too.
+  unsorted.replace(third_arg, 4, std::string("\x02\x00\x00\x00", 4));
+  std::stringstream s4(unsorted);
+  EXPECT_THROW((deserialize<int, int>(s4)), InvalidFormat);
+}
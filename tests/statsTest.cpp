@@ -0,0 +1,87 @@
+// Built as a separate executable: instrumentation changes the class layout,
+// so it must not be mixed with uninstrumented translation units.
+#define FUNCTION_MAXIMA_STATS
+#include "gtest/gtest.h"
+#include "../src/function_maxima.h"
+#include <string>
+
+namespace {
+
+struct Fragile {
+  int value;
+  static bool armed;
+  bool operator<(const Fragile &f) const {
+    if (armed && f.value == 42)
+      throw std::string("BOOM");
+    return value < f.value;
+  }
+};
+bool Fragile::armed = false;
+
+std::uint64_t total(const std::uint64_t (&histogram)[MaximaStats::buckets]) {
+  std::uint64_t sum = 0;
+  for (auto count : histogram)
+    sum += count;
+  return sum;
+}
+
+}
+
+TEST(stats, countsCallsAndMaxima) {
+  using F = FunctionMaxima<int, int>;
+  F::reset_stats();
+  F fun;
+  fun.set_value(1, 1);
+  fun.set_value(2, 2);
+  fun.set_value(3, 3);
+  fun.find(2);
+  fun.erase(3);
+  F copy(fun);
+  (void) copy;
+
+  MaximaStats s = F::stats();
+  // erase looks the argument up with find as well, set_value does not.
+  EXPECT_EQ(s.calls_of(MaximaOp::set_value), 3u);
+  EXPECT_EQ(s.calls_of(MaximaOp::erase), 1u);
+  EXPECT_EQ(s.calls_of(MaximaOp::find), 2u);
+  EXPECT_EQ(s.calls_of(MaximaOp::copy), 1u);
+  EXPECT_EQ(total(s.latency[static_cast<std::size_t>(MaximaOp::set_value)]), 3u);
+  EXPECT_GT(s.arg_comparisons, 0u);
+  EXPECT_GT(s.value_comparisons, 0u);
+  EXPECT_GT(s.allocations, 0u);
+  EXPECT_EQ(s.rollbacks, 0u);
+  // 1, then 2 replacing 1, then 3 replacing 2, then 2 again after erase.
+  EXPECT_EQ(s.maxima_inserted, 4u);
+  EXPECT_EQ(s.maxima_removed, 3u);
+
+  F::reset_stats();
+  EXPECT_EQ(F::stats().calls_of(MaximaOp::set_value), 0u);
+}
+
+TEST(stats, internedPayloadsAreNotAllocations) {
+  using F = FunctionMaxima<int, int>;
+  auto allocations_of = [](F &fun) {
+    F::reset_stats();
+    fun.set_value(1, 1);
+    fun.set_value(2, 1);
+    return F::stats().allocations;
+  };
+  F plain;
+  F interned;
+  interned.set_intern_pools(std::make_shared<InternPool<int>>(),
+                            std::make_shared<InternPool<int>>());
+  // Each point takes an argument and a value payload.
+  EXPECT_EQ(allocations_of(interned) + 4, allocations_of(plain));
+}
+
+TEST(stats, countsRollbacks) {
+  using F = FunctionMaxima<Fragile, Fragile>;
+  F::reset_stats();
+  F fun;
+  fun.set_value({1}, {10});
+  Fragile::armed = true;
+  EXPECT_THROW(fun.set_value({2}, {42}), std::string);
+  Fragile::armed = false;
+  EXPECT_EQ(fun.size(), 1u);
+  EXPECT_GT(F::stats().rollbacks, 0u);
+}
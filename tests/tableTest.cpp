@@ -0,0 +1,154 @@
+#include "gtest/gtest.h"
+#include "../src/function_maxima_table.h"
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Table = FunctionMaximaTable<int, int>;
+
+std::vector<std::pair<int, int>> maxima_of(const Table &t, std::size_t column) {
+  std::vector<std::pair<int, int>> mx;
+  for (auto it = t.mx_begin(column); it != t.mx_end(column); ++it)
+    mx.emplace_back(it->arg(), it->value());
+  return mx;
+}
+
+std::vector<std::pair<int, int>> maxima_of(const FunctionMaxima<int, int> &f) {
+  std::vector<std::pair<int, int>> mx;
+  for (auto it = f.mx_begin(); it != f.mx_end(); ++it)
+    mx.emplace_back(it->arg(), it->value());
+  return mx;
+}
+
+struct Fragile {
+  int value;
+  static bool armed;
+  bool operator<(const Fragile &f) const {
+    if (armed && f.value == 42)
+      throw std::string("BOOM");
+    return value < f.value;
+  }
+};
+bool Fragile::armed = false;
+
+}
+
+TEST(table, columnsMatchSeparateFunctions) {
+  const std::size_t columns = 4;
+  Table table(columns);
+  std::vector<FunctionMaxima<int, int>> separate(columns);
+  std::mt19937 rng(7);
+
+  for (int step = 0; step < 3000; step++) {
+    int a = static_cast<int>(rng() % 300);
+    switch (rng() % 4) {
+      case 0: {
+        table.erase(a);
+        for (auto &f : separate)
+          f.erase(a);
+        break;
+      }
+      case 1: {
+        if (table.find(a) == table.end())
+          break;
+        std::size_t column = rng() % columns;
+        int v = static_cast<int>(rng() % 20);
+        table.set_value(a, column, v);
+        separate[column].set_value(a, v);
+        break;
+      }
+      default: {
+        std::vector<int> row;
+        for (std::size_t c = 0; c < columns; c++)
+          row.push_back(static_cast<int>(rng() % (5 + 10 * c)));
+        table.set_row(a, row);
+        for (std::size_t c = 0; c < columns; c++)
+          separate[c].set_value(a, row[c]);
+      }
+    }
+  }
+
+  ASSERT_EQ(table.size(), separate[0].size());
+  Table copy(table);
+  for (std::size_t c = 0; c < columns; c++) {
+    ASSERT_EQ(maxima_of(table, c), maxima_of(separate[c])) << c;
+    ASSERT_EQ(maxima_of(copy, c), maxima_of(separate[c])) << c;
+    for (const auto &p : separate[c])
+      ASSERT_EQ(table.value_at(p.arg(), c), p.value());
+  }
+
+  // The copy is independent.
+  copy.set_row(1000, {100, 100, 100, 100});
+  EXPECT_EQ(copy.mx_begin(0)->arg(), 1000);
+  EXPECT_NE(table.mx_begin(0)->arg(), 1000);
+}
+
+TEST(table, rowsShareArguments) {
+  Table table(2);
+  table.set_row(2, {1, 5});
+  table.set_row(1, {3, 4});
+  ASSERT_EQ(table.size(), 2u);
+  EXPECT_EQ(table.begin()->arg(), 1);
+  EXPECT_EQ(table.begin()->value(1), 4);
+  EXPECT_EQ(table.mx_begin(0)->arg(), 1);
+  EXPECT_EQ(table.mx_begin(1)->arg(), 2);
+  EXPECT_THROW(table.value_at(3, 0), InvalidArg);
+  EXPECT_THROW(table.set_value(3, 0, 1), InvalidArg);
+  EXPECT_THROW(table.set_row(3, {1}), std::invalid_argument);
+  EXPECT_EQ(table.size(), 2u);
+}
+
+TEST(table, strongGuarantee) {
+  FunctionMaximaTable<int, Fragile> table(3);
+  for (int i = 0; i < 10; i++)
+    table.set_row(i, {{i}, {10 - i}, {i % 3}});
+  auto before = [&table](std::size_t c) {
+    std::vector<std::pair<int, int>> mx;
+    for (auto it = table.mx_begin(c); it != table.mx_end(c); ++it)
+      mx.emplace_back(it->arg(), it->value().value);
+    return mx;
+  };
+  std::vector<std::vector<std::pair<int, int>>> expected;
+  for (std::size_t c = 0; c < 3; c++)
+    expected.push_back(before(c));
+
+  Fragile::armed = true;
+  EXPECT_THROW(table.set_row(5, {{1}, {2}, {42}}), std::string);
+  EXPECT_THROW(table.set_row(20, {{1}, {2}, {42}}), std::string);
+  EXPECT_THROW(table.set_value(5, 2, {42}), std::string);
+  Fragile::armed = false;
+
+  EXPECT_EQ(table.size(), 10u);
+  EXPECT_EQ(table.value_at(5, 2).value, 2);
+  for (std::size_t c = 0; c < 3; c++)
+    EXPECT_EQ(before(c), expected[c]);
+
+  // Without a failure, the copied row is updated whole.
+  table.set_value(5, 2, {42});
+  EXPECT_EQ(table.mx_begin(2)->arg(), 5);
+  EXPECT_EQ(table.value_at(5, 1).value, 5);
+}
+
+TEST(table, setValueUpdatesInPlace) {
+  Table table(3);
+  for (int i = 0; i < 10; i++)
+    table.set_row(i, {i, 10 - i, i % 3});
+  const int *kept = &table.value_at(4, 0);
+  const int *updated = &table.value_at(4, 2);
+
+  table.set_value(4, 2, 7);
+  EXPECT_EQ(&table.value_at(4, 0), kept);
+  EXPECT_EQ(&table.value_at(4, 2), updated);
+  EXPECT_EQ(table.mx_begin(2)->arg(), 4);
+  EXPECT_EQ(table.mx_begin(2)->value(), 7);
+
+  // The entry moves with the value and goes once the cell is no maximum.
+  table.set_value(4, 2, 8);
+  EXPECT_EQ(table.mx_begin(2)->value(), 8);
+  table.set_value(4, 2, 0);
+  EXPECT_EQ(maxima_of(table, 2),
+            (std::vector<std::pair<int, int>>{{2, 2}, {5, 2}, {8, 2}}));
+  EXPECT_EQ(maxima_of(table, 0), (std::vector<std::pair<int, int>>{{9, 9}}));
+}
@@ -0,0 +1,96 @@
+#include "gtest/gtest.h"
+#include "../src/windowed_function_maxima.h"
+#include <limits>
+#include <map>
+#include <vector>
+
+namespace {
+
+// Maxima recomputed from scratch, in mx_iterator order.
+std::vector<std::pair<int, int>> brute_maxima(const std::map<int, int> &f) {
+  std::vector<std::pair<int, int>> mx;
+  for (auto it = f.begin(); it != f.end(); ++it) {
+    bool left = it == f.begin() || std::prev(it)->second <= it->second;
+    bool right = std::next(it) == f.end() || std::next(it)->second <= it->second;
+    if (left && right)
+      mx.emplace_back(it->first, it->second);
+  }
+  std::stable_sort(mx.begin(), mx.end(), [](const auto &x, const auto &y) {
+    return x.second > y.second;
+  });
+  return mx;
+}
+
+template<typename F>
+std::vector<std::pair<int, int>> maxima_of(const F &f) {
+  std::vector<std::pair<int, int>> mx;
+  for (auto it = f.mx_begin(); it != f.mx_end(); ++it)
+    mx.emplace_back(it->arg(), it->value());
+  return mx;
+}
+
+}
+
+TEST(window, horizonAtTheEndsOfTheRange) {
+  constexpr int top = std::numeric_limits<int>::max();
+  constexpr int bottom = std::numeric_limits<int>::min();
+  auto fun = WindowedFunctionMaxima<int, int>::by_horizon(10);
+  fun.set_value(bottom, 1);
+  fun.set_value(top - 20, 2);
+  EXPECT_EQ(fun.size(), 1u);
+  fun.set_value(top - 5, 3);
+  fun.set_value(top, 4);
+  EXPECT_EQ(fun.size(), 2u);
+  EXPECT_EQ(fun.begin()->arg(), top - 5);
+
+  auto wide = WindowedFunctionMaxima<int, int>::by_horizon(top);
+  wide.set_value(bottom, 1);
+  wide.set_value(-1, 2);
+  EXPECT_EQ(wide.size(), 2u);
+  wide.set_value(0, 3);
+  EXPECT_EQ(wide.size(), 2u);
+  EXPECT_EQ(wide.begin()->arg(), -1);
+}
+
+TEST(window, horizonEvictsOldArguments) {
+  auto fun = WindowedFunctionMaxima<int, int>::by_horizon(10);
+  std::map<int, int> model;
+  for (int t = 0; t < 2000; t++) {
+    int v = (t * 37) % 23;
+    fun.set_value(t, v);
+    model[t] = v;
+    model.erase(model.begin(), model.lower_bound(t - 10));
+    ASSERT_EQ(fun.size(), model.size());
+    ASSERT_EQ(fun.begin()->arg(), model.begin()->first);
+    ASSERT_EQ(maxima_of(fun), brute_maxima(model));
+  }
+}
+
+TEST(window, countBoundAndOutOfOrderWrites) {
+  auto fun = WindowedFunctionMaxima<int, int>::by_count(5);
+  std::map<int, int> model;
+  for (int i = 0; i < 500; i++) {
+    int a = (i * 13) % 97, v = (i * 7) % 11;
+    fun.set_value(a, v);
+    model[a] = v;
+    while (model.size() > 5)
+      model.erase(model.begin());
+    ASSERT_EQ(fun.size(), model.size());
+    ASSERT_EQ(maxima_of(fun), brute_maxima(model));
+  }
+}
+
+TEST(erasePrefix, fixesNewFirstPoint) {
+  FunctionMaxima<int, int> fun;
+  fun.set_value(0, 9);
+  fun.set_value(1, 5);
+  fun.set_value(2, 3);
+  fun.set_value(3, 4);
+  // Only 0 and 3 are maxima; without 0, 1 becomes one.
+  fun.erase_prefix(fun.find(1));
+  ASSERT_EQ(maxima_of(fun), (std::vector<std::pair<int, int>>{{1, 5}, {3, 4}}));
+
+  fun.erase_prefix(fun.end());
+  ASSERT_EQ(fun.size(), 0u);
+  ASSERT_TRUE(fun.mx_begin() == fun.mx_end());
+}